@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "MappedFile.h"
+#include "miniz/miniz.h"
+
+#define CROM_READER_BUFFER_SIZE (64 * 1024)
+
+// Reader for the legacy cROM format. The data comes from a mapped cROM file,
+// a memory buffer or is decompressed from a cRZ archive while reading, so no
+// temporary file needs to be extracted.
+// All reads are bounds checked against the size of the data. Once a read
+// fails, the reader stays failed and all further reads fail as well, so a
+// parser can check failed() once after a sequence of reads.
+class CRomReader {
+ private:
+  // memory source (mapped file or buffer)
+  std::shared_ptr<MappedFile> m_file;
+  const uint8_t *m_data = nullptr;
+
+  // streaming source (cRZ archive), buffered
+  mz_zip_archive m_zip;
+  bool m_zipInitialized = false;
+  mz_zip_reader_extract_iter_state *m_zipIter = nullptr;
+  std::vector<uint8_t> m_buffer;
+  size_t m_bufferPos = 0;
+  size_t m_bufferAvailable = 0;
+
+  uint64_t m_size = 0;
+  uint64_t m_position = 0;
+  bool m_failed = false;
+
+  std::function<void(uint8_t)> m_progressCallback;
+  uint64_t m_nextProgress = 0;  // position of the next percent
+
+  void advance(uint64_t size) {
+    m_position += size;
+    if (m_progressCallback && m_position >= m_nextProgress && m_size > 0) {
+      uint8_t percent = (uint8_t)(m_position * 100 / m_size);
+      m_nextProgress = (m_size * (percent + 1) + 99) / 100;
+      m_progressCallback(percent);
+    }
+  }
+
+  bool readStream(uint8_t *target, size_t size) {
+    while (size > 0) {
+      if (m_bufferPos < m_bufferAvailable) {
+        size_t chunk = std::min(size, m_bufferAvailable - m_bufferPos);
+        if (target) memcpy(target, m_buffer.data() + m_bufferPos, chunk);
+        m_bufferPos += chunk;
+        if (target) target += chunk;
+        size -= chunk;
+      } else if (target && size >= m_buffer.size()) {
+        // big reads bypass the buffer
+        size_t chunk =
+            mz_zip_reader_extract_iter_read(m_zipIter, target, size);
+        if (chunk == 0) return false;
+        target += chunk;
+        size -= chunk;
+      } else {
+        m_bufferPos = 0;
+        m_bufferAvailable = mz_zip_reader_extract_iter_read(
+            m_zipIter, m_buffer.data(), m_buffer.size());
+        if (m_bufferAvailable == 0) return false;
+      }
+    }
+    return true;
+  }
+
+ public:
+  CRomReader() { memset(&m_zip, 0, sizeof(m_zip)); }
+  ~CRomReader() { close(); }
+
+  CRomReader(const CRomReader &) = delete;
+  CRomReader &operator=(const CRomReader &) = delete;
+
+  bool openFile(const char *filename) {
+    close();
+    m_file = MappedFile::Open(filename);
+    if (!m_file) return false;
+    m_data = m_file->data();
+    m_size = m_file->size();
+    return true;
+  }
+
+  // The data must stay valid while reading
+  bool openMemory(const uint8_t *data, size_t size) {
+    close();
+    m_data = data;
+    m_size = size;
+    return data != nullptr;
+  }
+
+  // Reads the first file of a cRZ archive
+  bool openZip(const char *filename) {
+    close();
+    if (!mz_zip_reader_init_file(&m_zip, filename, 0)) return false;
+    m_zipInitialized = true;
+    mz_zip_archive_file_stat stat;
+    if (mz_zip_reader_get_num_files(&m_zip) == 0 ||
+        !mz_zip_reader_file_stat(&m_zip, 0, &stat)) {
+      close();
+      return false;
+    }
+    m_zipIter = mz_zip_reader_extract_iter_new(&m_zip, 0, 0);
+    if (!m_zipIter) {
+      close();
+      return false;
+    }
+    m_size = stat.m_uncomp_size;
+    m_buffer.resize(CROM_READER_BUFFER_SIZE);
+    return true;
+  }
+
+  void close() {
+    m_file.reset();
+    m_data = nullptr;
+    if (m_zipIter) {
+      mz_zip_reader_extract_iter_free(m_zipIter);
+      m_zipIter = nullptr;
+    }
+    if (m_zipInitialized) {
+      mz_zip_reader_end(&m_zip);
+      m_zipInitialized = false;
+    }
+    std::vector<uint8_t>().swap(m_buffer);
+    m_bufferPos = m_bufferAvailable = 0;
+    m_size = m_position = 0;
+    m_failed = false;
+  }
+
+  // Called with the percentage of the data read so far whenever it changes
+  void setProgressCallback(std::function<void(uint8_t)> callback) {
+    m_progressCallback = std::move(callback);
+    m_nextProgress = 0;
+  }
+
+  bool failed() const { return m_failed; }
+  uint64_t remaining() const { return m_size - m_position; }
+
+  // Returns false (and fails the reader) if fewer than size bytes are left,
+  // to be checked before allocating memory for data sizes read from the file
+  bool canRead(uint64_t size) {
+    if (m_failed || size > remaining()) m_failed = true;
+    return !m_failed;
+  }
+
+  bool readBytes(void *buffer, size_t size) {
+    if (!canRead(size)) return false;
+    if (m_data) {
+      memcpy(buffer, m_data + m_position, size);
+    } else if (!m_zipIter ||
+               !readStream(static_cast<uint8_t *>(buffer), size)) {
+      m_failed = true;
+      return false;
+    }
+    advance(size);
+    return true;
+  }
+
+  bool skip(uint64_t size) {
+    if (!canRead(size)) return false;
+    if (!m_data) {
+      for (uint64_t left = size; left > 0;) {
+        size_t chunk =
+            (size_t)std::min<uint64_t>(left, CROM_READER_BUFFER_SIZE);
+        if (!m_zipIter || !readStream(nullptr, chunk)) {
+          m_failed = true;
+          return false;
+        }
+        left -= chunk;
+      }
+    }
+    advance(size);
+    return true;
+  }
+
+  template <typename T>
+  bool readValue(T &value) {
+    return readBytes(&value, sizeof(T));
+  }
+
+  template <typename T>
+  bool readArray(T *values, size_t count) {
+    if (count > SIZE_MAX / sizeof(T)) {
+      m_failed = true;
+      return false;
+    }
+    return readBytes(values, count * sizeof(T));
+  }
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#include "FileUtils.h"
+#include "lz4/lz4.h"
+#include "lz4/lz4hc.h"
+
+// Custom stream class that compresses on the fly, the counterpart of
+// DecompressingIStream for writing. The data is split into chunks which are
+// LZ4 compressed independently and written to the file as soon as they are
+// full, so only one chunk is kept in memory. The file gets:
+// uint32 number of chunks, uint32 compressed size per chunk, the chunks.
+// The values are written in host byte order, the caller has to make sure
+// that this is little-endian.
+// The number of chunks is given by the size passed to the constructor, the
+// compressed sizes are filled in by finish(). With a compression level of 0,
+// the data is written as is, without a chunk table, and the size is unused.
+class CompressingOStream : public std::ostream {
+ private:
+  class CompressingStreamBuf : public std::streambuf {
+   private:
+    FILE *m_fp;
+    int m_compressionLevel;
+    uint64_t m_size;
+    uint64_t m_written;     // uncompressed bytes written so far
+    uint64_t m_storedSize;  // bytes written to the file so far
+    int64_t m_tableOffset;     // position of the chunk table in the file
+    bool m_failed;
+
+    std::vector<char> m_buffer;
+    std::vector<char> m_compressedBuffer;
+    std::vector<uint32_t> m_chunkSizes;
+
+   public:
+    CompressingStreamBuf(FILE *fp, uint64_t size, size_t chunkSize,
+                         int compressionLevel)
+        : m_fp(fp),
+          m_compressionLevel(compressionLevel),
+          m_size(size),
+          m_written(0),
+          m_storedSize(0),
+          m_tableOffset(FileTell(fp)),
+          m_failed(m_tableOffset < 0) {
+      m_buffer.resize(chunkSize);
+      if (m_compressionLevel > 0) {
+        m_compressedBuffer.resize(LZ4_compressBound((int)chunkSize));
+        // the table is written again by finish(), once the sizes are known
+        const uint64_t chunkCount = (size + chunkSize - 1) / chunkSize;
+        m_chunkSizes.reserve((size_t)chunkCount);
+        std::vector<uint32_t> table((size_t)(1 + chunkCount), 0);
+        writeFile(table.data(), table.size() * sizeof(uint32_t));
+      }
+      setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+    }
+
+    // Writes the last chunk and the chunk table. Returns false if writing
+    // failed or if not exactly the announced size has been written.
+    bool finish() {
+      if (!writeChunk()) return false;
+      if (m_compressionLevel == 0) return true;
+      if (m_written != m_size) return false;
+
+      std::vector<uint32_t> table;
+      table.reserve(1 + m_chunkSizes.size());
+      table.push_back((uint32_t)m_chunkSizes.size());
+      table.insert(table.end(), m_chunkSizes.begin(), m_chunkSizes.end());
+      if (FileSeek(m_fp, (uint64_t)m_tableOffset, SEEK_SET) != 0 ||
+          fwrite(table.data(), sizeof(uint32_t), table.size(), m_fp) !=
+              table.size() ||
+          FileSeek(m_fp, (uint64_t)m_tableOffset + m_storedSize, SEEK_SET) !=
+              0) {
+        m_failed = true;
+      }
+      return !m_failed;
+    }
+
+    uint64_t storedSize() const { return m_storedSize; }
+
+   protected:
+    int_type overflow(int_type c) override {
+      if (!writeChunk()) return traits_type::eof();
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+   private:
+    void writeFile(const void *data, size_t size) {
+      if (m_failed) return;
+      if (fwrite(data, 1, size, m_fp) != size) m_failed = true;
+      m_storedSize += size;
+    }
+
+    bool writeChunk() {
+      const size_t size = pptr() - pbase();
+      if (size > 0 && !m_failed) {
+        if (m_compressionLevel == 0) {
+          writeFile(m_buffer.data(), size);
+        } else {
+          int compressedSize = LZ4_compress_HC(
+              m_buffer.data(), m_compressedBuffer.data(), (int)size,
+              (int)m_compressedBuffer.size(), m_compressionLevel);
+          if (compressedSize <= 0) {
+            m_failed = true;
+          } else {
+            m_chunkSizes.push_back((uint32_t)compressedSize);
+            writeFile(m_compressedBuffer.data(), compressedSize);
+          }
+        }
+        m_written += size;
+      }
+      setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+      return !m_failed;
+    }
+  };
+
+  CompressingStreamBuf m_buf;
+
+ public:
+  CompressingOStream(FILE *fp, uint64_t size, size_t chunkSize,
+                     int compressionLevel)
+      : std::ostream(&m_buf), m_buf(fp, size, chunkSize, compressionLevel) {}
+
+  bool finish() { return m_buf.finish() && good(); }
+  uint64_t storedSize() const { return m_buf.storedSize(); }
+};
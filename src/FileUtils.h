@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+// fseek() and ftell() with 64-bit positions, long is only 32 bits on Windows.
+// Positions which don't fit into the platform's file offset fail.
+inline int FileSeek(FILE *fp, uint64_t offset, int origin) {
+#ifdef _WIN32
+  if (offset > (uint64_t)std::numeric_limits<__int64>::max()) return -1;
+  return _fseeki64(fp, (__int64)offset, origin);
+#else
+  if (offset > (uint64_t)std::numeric_limits<off_t>::max()) return -1;
+  return fseeko(fp, (off_t)offset, origin);
+#endif
+}
+
+// Returns -1 on failure
+inline int64_t FileTell(FILE *fp) {
+#ifdef _WIN32
+  return _ftelli64(fp);
+#else
+  return ftello(fp);
+#endif
+}
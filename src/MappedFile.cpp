@@ -0,0 +1,100 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "FileUtils.h"
+
+MappedFile::~MappedFile() {
+  if (!m_data) return;
+  if (!m_mapped) {
+    free(m_data);
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(m_data);
+  CloseHandle((HANDLE)m_mapping);
+#else
+  munmap(m_data, m_size);
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::Open(const char *filename, bool map) {
+  std::shared_ptr<MappedFile> file(new MappedFile());
+
+#ifdef _WIN32
+  HANDLE handle = map ? CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ,
+                                    NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                                    NULL)
+                      : INVALID_HANDLE_VALUE;
+  if (handle != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(handle, &size) && size.QuadPart > 0 &&
+        (unsigned long long)size.QuadPart <= SIZE_MAX) {
+      HANDLE mapping =
+          CreateFileMappingA(handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+      if (mapping) {
+        void *view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        if (view) {
+          file->m_data = (uint8_t *)view;
+          file->m_size = (size_t)size.QuadPart;
+          file->m_mapped = true;
+          file->m_mapping = mapping;
+        } else {
+          CloseHandle(mapping);
+        }
+      }
+    }
+    CloseHandle(handle);
+  }
+#else
+  int fd = map ? open(filename, O_RDONLY) : -1;
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+        (unsigned long long)st.st_size <= SIZE_MAX) {
+      void *view = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+      if (view != MAP_FAILED) {
+        file->m_data = (uint8_t *)view;
+        file->m_size = (size_t)st.st_size;
+        file->m_mapped = true;
+      }
+    }
+    close(fd);
+  }
+#endif
+  if (file->m_mapped) return file;
+
+  // mapping not supported or not wanted, read the whole file
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) return nullptr;
+  FileSeek(fp, 0, SEEK_END);
+  const int64_t size = FileTell(fp);
+  FileSeek(fp, 0, SEEK_SET);
+  if (size <= 0 || (uint64_t)size > SIZE_MAX) {
+    fclose(fp);
+    return nullptr;
+  }
+  // malloc() is aligned for any fundamental type, the sections of a file
+  // only need 8 byte alignment to be used in place
+  file->m_data = (uint8_t *)malloc((size_t)size);
+  if (!file->m_data ||
+      fread(file->m_data, 1, (size_t)size, fp) != (size_t)size) {
+    fclose(fp);
+    return nullptr;
+  }
+  file->m_size = (size_t)size;
+  fclose(fp);
+  return file;
+}
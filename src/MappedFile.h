@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// A whole file mapped into memory. The mapping is copy-on-write, so the file
+// is never modified, and pages which are never accessed are never read.
+// Where mapping isn't possible, the file is read into memory instead.
+class MappedFile {
+ public:
+  ~MappedFile();
+
+  // Returns nullptr if the file can't be opened or is empty. Without map, the
+  // file is always read, so it can be replaced while the data is in use.
+  static std::shared_ptr<MappedFile> Open(const char *filename,
+                                          bool map = true);
+
+  uint8_t *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  bool isMapped() const { return m_mapped; }
+
+ private:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  uint8_t *m_data = nullptr;
+  size_t m_size = 0;
+  bool m_mapped = false;
+#ifdef _WIN32
+  void *m_mapping = nullptr;
+#endif
+};
@@ -208,8 +208,7 @@ bool SceneGenerator::getAutoStartSceneInfo(
 uint16_t SceneGenerator::generateFrame(uint16_t sceneId, uint16_t frameIndex,
                                        uint8_t *buffer, int group,
                                        bool disableTimer) {
-  static uint32_t lastTime = 0;
-  if (frameIndex == 0) lastTime = 0;  // Reset timer for new scene
+  if (frameIndex == 0) m_lastTime = 0;  // Reset timer for new scene
   uint32_t now = GetMonotonicTimeMs();
 
   auto it = std::find_if(
@@ -224,11 +223,11 @@ uint16_t SceneGenerator::generateFrame(uint16_t sceneId, uint16_t frameIndex,
     return 0;
   }
 
-  if (!disableTimer && (lastTime + it->durationPerFrame) > now) {
+  if (!disableTimer && (m_lastTime + it->durationPerFrame) > now) {
     // Too soon to generate the next frame, return remaining time
-    return it->durationPerFrame - (now - lastTime);
+    return it->durationPerFrame - (now - m_lastTime);
   }
-  lastTime = now;
+  m_lastTime = now;
 
   if (frameIndex == 0) {
     if (group == -1) {
@@ -101,4 +101,5 @@ class SceneGenerator {
 
   uint8_t m_autoStartTimer = 0;     // Timer for auto-start scenes
   uint16_t m_autoStartSceneId = 0;  // Scene ID to auto-start
+  uint32_t m_lastTime = 0;          // Time the last scene frame was generated
 };
@@ -1,12 +1,145 @@
 #include "SerumData.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "CompressingOStream.h"
 #include "DecompressingIStream.h"
+#include "FileUtils.h"
+#include "MappedFile.h"
+#include "crc32.h"
 #include "miniz/miniz.h"
 #include "serum-version.h"
 
+// cROMc v5 layout, all values are little-endian:
+//   "CROM", uint16 version, uint16 0, uint32 number of sections, uint32 0
+//   table of contents, per section: uint32 id, uint32 codec, uint64 offset,
+//   uint64 stored size, uint64 size
+//   the sections, each one starting 64-byte aligned
+// Section 0 holds the header data and the scenes as cereal portable binary,
+// the others the frozen SparseVector blocks in the order of ForEachVector().
+// Uncompressed vector sections are used in place from the mapped file.
+// LZ4 sections are split into chunks which are compressed independently, so
+// they can be decompressed in parallel: uint32 number of chunks, uint32
+// compressed size per chunk, the chunks.
+// A cROMc generated from a cROM or cRZ file has a source section, see
+// SerumData::SourceInfo: uint64 size, int64 time, uint32 CRC32,
+// uint8 resolutions, padded to 32 bytes. Older readers ignore it.
+// From v6 on, the v2 sprites are stored cropped, see SerumData::spritebounds.
+// v7 adds SerumData::framedynabounds, which older files have to compute from
+// the payload on every load.
+#define CROMC_HEADER_SIZE 16
+#define CROMC_TOC_ENTRY_SIZE 32
+#define CROMC_SECTION_ALIGNMENT 64
+#define CROMC_SECTION_METADATA 0
+#define CROMC_SECTION_SOURCE 0xffffffff
+#define CROMC_SOURCE_SIZE 32
+#define CROMC_COMPACT_SPRITES_VERSION 6
+#define CROMC_CODEC_RAW 0
+#define CROMC_CODEC_LZ4 1
+#define CROMC_LZ4_CHUNK_SIZE (1024 * 1024)
+// Codec of the sections which can't be used in place. Uncompressed files are
+// bigger, but can be mapped completely without decoding anything.
+#ifdef CROMC_LZ4
+#define CROMC_SECTION_CODEC CROMC_CODEC_LZ4
+#else
+#define CROMC_SECTION_CODEC CROMC_CODEC_RAW
+#endif
+// Vector sections smaller than this are always stored uncompressed
+#define CROMC_MIN_LZ4_SECTION_SIZE 4096
+// Maximum number of threads used to load a cROMc
+#define CROMC_MAX_THREADS 8
+
+static bool IsLittleEndianHost() {
+  const uint16_t value = 1;
+  return *(const uint8_t *)&value == 1;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+static double MegabytesPerSecond(uint64_t bytes, double milliseconds) {
+  if (milliseconds <= 0.0) return 0.0;
+  return bytes / 1048576.0 / (milliseconds / 1000.0);
+}
+
+static void EncodeSourceInfo(const SerumData::SourceInfo &info,
+                             uint8_t *record) {
+  memset(record, 0, CROMC_SOURCE_SIZE);
+  uint64_t values64[2] = {ToLittleEndian64(info.size),
+                          ToLittleEndian64((uint64_t)info.modified)};
+  uint32_t crc = ToLittleEndian32(info.crc32);
+  memcpy(record, values64, sizeof(values64));
+  memcpy(record + 16, &crc, sizeof(uint32_t));
+  record[20] = info.resolutions;
+}
+
+static void DecodeSourceInfo(const uint8_t *record,
+                             SerumData::SourceInfo &info) {
+  uint64_t values64[2];
+  uint32_t crc;
+  memcpy(values64, record, sizeof(values64));
+  memcpy(&crc, record + 16, sizeof(uint32_t));
+  info.size = FromLittleEndian64(values64[0]);
+  info.modified = (int64_t)FromLittleEndian64(values64[1]);
+  info.crc32 = FromLittleEndian32(crc);
+  info.resolutions = record[20];
+}
+
+// Runs task(0) ... task(count - 1) on a few threads, returns false if a task
+// threw an exception
+static bool RunParallel(size_t count, const std::function<void(size_t)> &task) {
+  size_t threads = std::thread::hardware_concurrency();
+  if (threads > CROMC_MAX_THREADS) threads = CROMC_MAX_THREADS;
+  if (threads > count) threads = count;
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> ok{true};
+  auto worker = [&]() {
+    for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+      try {
+        task(i);
+      } catch (...) {
+        ok = false;
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; t++) {
+    try {
+      pool.emplace_back(worker);
+    } catch (...) {
+      break;  // go on with the threads we have
+    }
+  }
+  worker();
+  for (std::thread &thread : pool) thread.join();
+  return ok;
+}
+
 SerumData::SerumData()
     : SerumVersion(0),
       concentrateFileVersion(SERUM_CONCENTRATE_VERSION),
+      fwidth(0),
+      fheight(0),
+      nocolors(0),
       is256x64(false),
       hashcodes(0, true),
       shapecompmode(0),
@@ -28,10 +161,9 @@ SerumData::SerumData()
       spritedescriptionso(0),
       spritedescriptionsc(0),
       isextrasprite(0, true),
-      spriteoriginal(255),    // Do not compress because GetSpriteSize seems to
-                              // have an issue with it.
-      spritemask_extra(255),  // Do not compress because GetSpriteSize seems to
-                              // have an issue with it.
+      spriteoriginal(255),    // Not compressed, the sprite detection reads
+                              // it for every candidate
+      spritemask_extra(255),  // Not compressed, like spriteoriginal
       spritecolored(0, false, true),
       spritecolored_extra(0, false, true),
       activeframes(1),
@@ -59,125 +191,658 @@ SerumData::SerumData()
       dynasprite4cols_extra(0),
       dynaspritemasks(255, false, true),
       dynaspritemasks_extra(255, false, true),
-      sprshapemode(0) {
-  sceneGenerator = new SceneGenerator();
-}
+      sprshapemode(0),
+      spritesizes(0),
+      spritespans(0),
+      spritebounds(0),
+      spritebounds_extra(0),
+      framedynabounds(0xffff),
+      spritesCompact(false) {}
 
 SerumData::~SerumData() {}
 
 void SerumData::Clear() {
-  hashcodes.clear();
-  shapecompmode.clear();
-  compmaskID.clear();
-  compmasks.clear();
-  cpal.clear();
-  isextraframe.clear();
-  cframes_v2.clear();
-  cframes_v2_extra.clear();
-  cframes.clear();
-  dynamasks.clear();
-  dynamasks_extra.clear();
-  dyna4cols.clear();
-  dyna4cols_v2.clear();
-  dyna4cols_v2_extra.clear();
-  framesprites.clear();
-  spritedescriptionso.clear();
-  spritedescriptionsc.clear();
-  isextrasprite.clear();
-  spriteoriginal.clear();
-  spritemask_extra.clear();
-  spritecolored.clear();
-  spritecolored_extra.clear();
-  activeframes.clear();
-  colorrotations.clear();
-  colorrotations_v2.clear();
-  colorrotations_v2_extra.clear();
-  spritedetareas.clear();
-  spritedetdwords.clear();
-  spritedetdwordpos.clear();
-  triggerIDs.clear();
-  framespriteBB.clear();
-  isextrabackground.clear();
-  backgroundframes.clear();
-  backgroundframes_v2.clear();
-  backgroundframes_v2_extra.clear();
-  backgroundIDs.clear();
-  backgroundBB.clear();
-  backgroundmask.clear();
-  backgroundmask_extra.clear();
-  dynashadowsdir.clear();
-  dynashadowscol.clear();
-  dynashadowsdir_extra.clear();
-  dynashadowscol_extra.clear();
-  dynasprite4cols.clear();
-  dynasprite4cols_extra.clear();
-  dynaspritemasks.clear();
-  dynaspritemasks_extra.clear();
-  sprshapemode.clear();
+  ForEachVector([](auto &vector, uint32_t) { vector.clear(); });
+  spritesCompact = false;
+  sceneData.clear();
+  frameLookup.clear();
+  compmaskRuns.clear();
+  spriteDetectors.clear();
+  spriteDetectEntries.clear();
+  spriteDetectPatterns.clear();
+  spriteDetectBuckets.clear();
 }
 
-bool SerumData::SaveToFile(const char *filename) {
-  try {
-    Log("Writing %s", filename);
-    // Serialize to memory buffer first
-    std::ostringstream ss(std::ios::binary);
-    {
-      cereal::PortableBinaryOutputArchive archive(ss);
-      archive(*this);
+void SerumData::PrepareRuntime() {
+  CompactSprites();
+  BuildSpriteExtents();
+  BuildFrameDynaBounds();
+
+  // switch all vectors to their flat storage, the data doesn't change anymore
+  // after loading
+  ForEachVector([](auto &vector, uint32_t) { vector.freeze(); });
+
+  BuildFrameLookup();
+  BuildSpriteDetectors();
+}
+
+SerumData::FrameView SerumData::GetFrameView(uint32_t frameId, bool extra) {
+  FrameView view;
+  if (extra) {
+    view.dynamask = dynamasks_extra[frameId];
+    view.cframe = cframes_v2_extra[frameId];
+    view.dyna4cols = dyna4cols_v2_extra[frameId];
+    view.colorrotations = colorrotations_v2_extra[frameId];
+    view.dynashadowsdir = dynashadowsdir_extra[frameId];
+    view.dynashadowscol = dynashadowscol_extra[frameId];
+  } else {
+    view.dynamask = dynamasks[frameId];
+    view.cframe = cframes_v2[frameId];
+    view.dyna4cols = dyna4cols_v2[frameId];
+    view.colorrotations = colorrotations_v2[frameId];
+    view.dynashadowsdir = dynashadowsdir[frameId];
+    view.dynashadowscol = dynashadowscol[frameId];
+  }
+  view.backgroundmask = NULL;
+  view.backgroundframe = NULL;
+  uint16_t backgroundId = backgroundIDs[frameId][0];
+  if (backgroundId < nbackgrounds) {
+    if (extra) {
+      view.backgroundmask = backgroundmask_extra[frameId];
+      view.backgroundframe = backgroundframes_v2_extra[backgroundId];
+    } else {
+      view.backgroundmask = backgroundmask[frameId];
+      view.backgroundframe = backgroundframes_v2[backgroundId];
     }
-    std::string data = ss.str();
+  }
+  return view;
+}
 
-    // Compress data - use uint32_t for consistent sizes
-    uint32_t srcLen = (uint32_t)data.size();
-    mz_ulong dstLen = compressBound(srcLen);
-    std::vector<unsigned char> compressedData(dstLen);
+void SerumData::BuildFrameLookup() {
+  frameLookup.clear();
 
-    int status = compress2(compressedData.data(), &dstLen,
-                           (const unsigned char *)data.data(), srcLen,
-                           MZ_BEST_COMPRESSION);
+  // 256 masks (255 = no mask) * 256 shape modes
+  std::vector<int32_t> groupIndex(256 * 256, -1);
 
-    if (status != MZ_OK) {
-      Log("Compression error: %d", status);
-      return false;
+  for (uint32_t ti = 0; ti < nframes; ti++) {
+    uint8_t mask = compmaskID[ti][0];
+    uint8_t shape = shapecompmode[ti][0];
+    int32_t &idx = groupIndex[mask * 256 + shape];
+    if (idx < 0) {
+      idx = (int32_t)frameLookup.size();
+      frameLookup.push_back({mask, shape, {}, {}});
+    }
+    FrameLookupGroup &group = frameLookup[idx];
+    group.frames.push_back(ti);
+    group.framesByHash[hashcodes[ti][0]].push_back(ti);
+  }
+
+  compmaskRuns.clear();
+  compmaskRuns.resize(ncompmasks);
+  const uint32_t pixels = is256x64 ? (256 * 64) : (fwidth * fheight);
+  for (uint32_t tm = 0; tm < ncompmasks; tm++) {
+    std::vector<MaskRun> &runs = compmaskRuns[tm];
+    if (!compmasks.hasData(tm)) {
+      // empty mask, nothing is masked
+      runs.push_back({0, pixels});
+      continue;
+    }
+    const uint8_t *pmask = compmasks[tm];
+    uint32_t ti = 0;
+    while (ti < pixels) {
+      while (ti < pixels && pmask[ti] != 0) ti++;
+      uint32_t start = ti;
+      while (ti < pixels && pmask[ti] == 0) ti++;
+      if (ti > start) runs.push_back({start, ti - start});
+    }
+  }
+}
+
+void SerumData::CompactSprites() {
+  spritebounds.reserve(4);
+  spritebounds_extra.reserve(4);
+  if (SerumVersion != SERUM_V2 || spritesCompact) return;
+  spritesCompact = true;
+
+  const uint32_t fullSize = MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT;
+  // the pixels of a sprite are the ones of its mask which are not 255
+  auto findBounds = [&](SparseVector<uint8_t> &masks,
+                        SparseVector<uint16_t> &bounds) {
+    for (uint32_t ti = 0; ti < nsprites; ti++) {
+      if (!masks.hasData(ti) || masks.elementLength(ti) < fullSize) continue;
+      const uint8_t *mask = masks[ti];
+      int minx = MAX_SPRITE_WIDTH, miny = MAX_SPRITE_HEIGHT, maxx = -1,
+          maxy = -1;
+      for (int tj = 0; tj < MAX_SPRITE_HEIGHT; tj++) {
+        for (int tk = 0; tk < MAX_SPRITE_WIDTH; tk++) {
+          if (mask[tj * MAX_SPRITE_WIDTH + tk] == 255) continue;
+          minx = std::min(minx, tk);
+          maxx = std::max(maxx, tk);
+          miny = std::min(miny, tj);
+          maxy = tj;
+        }
+      }
+      if (maxx < 0) continue;
+      const uint16_t box[4] = {(uint16_t)minx, (uint16_t)miny,
+                               (uint16_t)(maxx - minx + 1),
+                               (uint16_t)(maxy - miny + 1)};
+      bounds.set(ti, box, 4);
+    }
+  };
+  // only the rows and columns within the bounds are kept
+  auto crop = [&](auto &vector, SparseVector<uint16_t> &bounds) {
+    auto cropped = vector.emptyCopy();
+    std::vector<std::remove_pointer_t<decltype(vector[0])>> pixels;
+    uint32_t maxSize = 1;
+    for (uint32_t ti = 0; ti < nsprites; ti++) {
+      const uint16_t *box = bounds[ti];
+      maxSize = std::max<uint32_t>(maxSize, box[2] * box[3]);
+      if (box[2] == 0 || !vector.hasData(ti) ||
+          vector.elementLength(ti) < fullSize)
+        continue;
+      const auto *element = vector[ti];
+      pixels.resize(box[2] * box[3]);
+      for (uint32_t tj = 0; tj < box[3]; tj++) {
+        std::copy_n(&element[(box[1] + tj) * MAX_SPRITE_WIDTH + box[0]],
+                    box[2], &pixels[tj * box[2]]);
+      }
+      cropped.set(ti, pixels.data(), pixels.size());
     }
+    // the sprites without data read the noData values
+    cropped.reserve(maxSize);
+    vector = std::move(cropped);
+  };
+
+  findBounds(spriteoriginal, spritebounds);
+  crop(spriteoriginal, spritebounds);
+  crop(spritecolored, spritebounds);
+  crop(dynaspritemasks, spritebounds);
+  findBounds(spritemask_extra, spritebounds_extra);
+  crop(spritemask_extra, spritebounds_extra);
+  crop(spritecolored_extra, spritebounds_extra);
+  crop(dynaspritemasks_extra, spritebounds_extra);
+  // computed again from the cropped sprites by BuildSpriteExtents()
+  spritesizes.clear();
+  spritespans.clear();
+}
+
+bool SerumData::CheckCompactSprites() {
+  if (SerumVersion != SERUM_V2) return true;
+  spritebounds.reserve(4);
+  spritebounds_extra.reserve(4);
+  auto check = [&](SparseVector<uint16_t> &bounds, auto &...vectors) {
+    for (uint32_t ti = 0; ti < nsprites; ti++) {
+      const uint16_t *box = bounds[ti];
+      const uint32_t size = box[2] * box[3];
+      if (box[2] == 0) continue;
+      if (box[0] + box[2] > MAX_SPRITE_WIDTH ||
+          box[1] + box[3] > MAX_SPRITE_HEIGHT ||
+          ((vectors.elementLength(ti) < size) || ...))
+        return false;
+    }
+    return true;
+  };
+  if (!check(spritebounds, spriteoriginal, spritecolored, dynaspritemasks) ||
+      !check(spritebounds_extra, spritemask_extra, spritecolored_extra,
+             dynaspritemasks_extra))
+    return false;
+
+  // the spans of the file are used to read the cropped sprites
+  if (!spritespans.hasData(0)) return true;
+  for (uint32_t ti = 0; ti < nsprites; ti++) {
+    if (spritespans.elementLength(ti) < 2 * MAX_SPRITE_HEIGHT) return false;
+    const uint16_t *box = spritebounds[ti];
+    const uint16_t *spans = spritespans[ti];
+    for (uint32_t tj = 0; tj < MAX_SPRITE_HEIGHT; tj++) {
+      if (spans[tj * 2] >= spans[tj * 2 + 1]) continue;
+      if (tj < box[1] || tj >= box[1] + box[3] || spans[tj * 2] < box[0] ||
+          spans[tj * 2 + 1] > box[0] + box[2])
+        return false;
+    }
+  }
+  return true;
+}
+
+void SerumData::BuildFrameDynaBounds() {
+  framedynabounds.reserve(8);
+  // x is always less than 0xffff, so frame 0 has bounds if the file has them
+  if (SerumVersion != SERUM_V2 || nframes == 0 || framedynabounds.hasData(0))
+    return;
+
+  dynamasks.reserve(fwidth * fheight);
+  backgroundmask.reserve(fwidth * fheight);
+  dynamasks_extra.reserve(fwidth_extra * fheight_extra);
+  backgroundmask_extra.reserve(fwidth_extra * fheight_extra);
+  for (uint32_t ti = 0; ti < nframes; ti++) {
+    uint16_t bounds[8] = {0};
+    for (int extra = 0; extra < 2; extra++) {
+      if (extra && isextraframe[ti][0] == 0) continue;
+      const FrameView view = GetFrameView(ti, extra != 0);
+      const int width = extra ? fwidth_extra : fwidth;
+      const int height = extra ? fheight_extra : fheight;
+      int minx = width, miny = height, maxx = -1, maxy = -1;
+      for (int tj = 0; tj < height; tj++) {
+        for (int tk = 0; tk < width; tk++) {
+          const uint32_t tl = tj * width + tk;
+          if (view.dynamask[tl] == 255 &&
+              !(view.backgroundframe && view.backgroundmask[tl] > 0))
+            continue;
+          minx = std::min(minx, tk);
+          maxx = std::max(maxx, tk);
+          miny = std::min(miny, tj);
+          maxy = tj;
+        }
+      }
+      if (maxx < 0) continue;
+      // the dynamic shadows are drawn around the dynamic pixels
+      minx = std::max(minx - 1, 0);
+      miny = std::max(miny - 1, 0);
+      maxx = std::min(maxx + 1, width - 1);
+      maxy = std::min(maxy + 1, height - 1);
+      uint16_t *box = &bounds[extra * 4];
+      box[0] = (uint16_t)minx;
+      box[1] = (uint16_t)miny;
+      box[2] = (uint16_t)(maxx - minx + 1);
+      box[3] = (uint16_t)(maxy - miny + 1);
+    }
+    framedynabounds.set(ti, bounds, 8);
+  }
+}
+
+void SerumData::BuildSpriteExtents() {
+  const bool v2 = SerumVersion == SERUM_V2;
+  const uint32_t width = v2 ? MAX_SPRITE_WIDTH : MAX_SPRITE_SIZE;
+  const uint32_t height = v2 ? MAX_SPRITE_HEIGHT : MAX_SPRITE_SIZE;
+  SparseVector<uint8_t> &masks = v2 ? spriteoriginal : spritedescriptionso;
+  if (!v2) masks.reserve(width * height);
+  spritesizes.reserve(2);
+  spritespans.reserve(2 * height);
+  // a sprite is at least 1x1, so sprite 0 has a size if the file has them
+  if (nsprites == 0 || spritesizes.hasData(0)) return;
+
+  std::vector<uint16_t> spans(2 * height);
+  for (uint32_t ti = 0; ti < nsprites; ti++) {
+    const uint8_t *mask = masks[ti];
+    // the v2 sprites are cropped, the rows outside of the bounds are empty
+    const uint16_t fullBox[4] = {0, 0, (uint16_t)width, (uint16_t)height};
+    const uint16_t *box = v2 ? spritebounds[ti] : fullBox;
+    uint16_t size[2] = {0, 0};
+    for (uint32_t tj = 0; tj < height; tj++) {
+      uint32_t first = 0, end = 0;
+      if (tj >= box[1] && tj < (uint32_t)box[1] + box[3]) {
+        const uint8_t *row = &mask[(tj - box[1]) * box[2]];
+        end = box[2];
+        while (first < end && row[first] == 255) first++;
+        while (end > first && row[end - 1] == 255) end--;
+      }
+      if (first == end) {
+        first = end = 0;
+      } else {
+        first += box[0];
+        end += box[0];
+      }
+      spans[tj * 2] = (uint16_t)first;
+      spans[tj * 2 + 1] = (uint16_t)end;
+      if (end > 0) {
+        size[0] = std::max(size[0], (uint16_t)(end - 1));
+        size[1] = (uint16_t)tj;
+      }
+    }
+    size[0]++;
+    size[1]++;
+    spritesizes.set(ti, size, 2);
+    spritespans.set(ti, spans.data(), spans.size());
+  }
+}
+
+void SerumData::BuildSpriteDetectors() {
+  spriteDetectors.clear();
+  spriteDetectEntries.clear();
+  spriteDetectPatterns.clear();
+  spriteDetectBuckets.clear();
+  spriteDetectors.resize(nframes);
+
+  for (uint32_t frameId = 0; frameId < nframes; frameId++) {
+    SpriteDetector &detector = spriteDetectors[frameId];
+    detector.firstEntry = (uint32_t)spriteDetectEntries.size();
+    const uint8_t *sprites = framesprites[frameId];
+    const uint16_t *spriteBB = framespriteBB[frameId];
+    for (uint8_t ti = 0; ti < MAX_SPRITES_PER_FRAME && sprites[ti] < 255;
+         ti++) {
+      const uint8_t qspr = sprites[ti];
+      const uint8_t shape = sprshapemode[qspr][0] > 0 ? 1 : 0;
+      bool used = false;
+      for (uint8_t tm = 0; tm < MAX_SPRITE_DETECT_AREAS; tm++) {
+        if (spritedetareas[qspr][tm * 4] == 0xffff) continue;
+        spriteDetectEntries.push_back(
+            {spritedetdwords[qspr][tm], ti, tm, shape});
+        used = true;
+      }
+      if (!used) continue;
+      detector.minx[shape] = std::min(detector.minx[shape], spriteBB[ti * 4]);
+      detector.miny[shape] =
+          std::min(detector.miny[shape], spriteBB[ti * 4 + 1]);
+      detector.maxx[shape] =
+          std::max(detector.maxx[shape], spriteBB[ti * 4 + 2]);
+      detector.maxy[shape] =
+          std::max(detector.maxy[shape], spriteBB[ti * 4 + 3]);
+    }
+    detector.entryCount =
+        (uint32_t)spriteDetectEntries.size() - detector.firstEntry;
+    if (detector.entryCount == 0) continue;
+
+    // equal dwords next to each other, still in the order they are checked
+    SpriteDetectEntry *entries = &spriteDetectEntries[detector.firstEntry];
+    std::stable_sort(
+        entries, entries + detector.entryCount,
+        [](const SpriteDetectEntry &a, const SpriteDetectEntry &b) {
+          return a.dword < b.dword;
+        });
+
+    for (uint8_t shape = 0; shape < 2; shape++) {
+      detector.firstPattern[shape] = (uint32_t)spriteDetectPatterns.size();
+      for (uint32_t ti = 0; ti < detector.entryCount; ti++) {
+        if (entries[ti].shape != shape) continue;
+        if (spriteDetectPatterns.size() > detector.firstPattern[shape] &&
+            spriteDetectPatterns.back() == entries[ti].dword)
+          continue;
+        spriteDetectPatterns.push_back(entries[ti].dword);
+      }
+      detector.patternCount[shape] =
+          (uint32_t)spriteDetectPatterns.size() - detector.firstPattern[shape];
+    }
+
+    // open addressing, at most half of the buckets are used
+    uint32_t buckets = 4;
+    detector.bucketShift = 30;
+    while (buckets < detector.entryCount * 2) {
+      buckets *= 2;
+      detector.bucketShift--;
+    }
+    detector.firstBucket = (uint32_t)spriteDetectBuckets.size();
+    spriteDetectBuckets.resize(spriteDetectBuckets.size() + buckets, 0);
+    uint16_t *table = &spriteDetectBuckets[detector.firstBucket];
+    for (uint32_t ti = 0; ti < detector.entryCount; ti++) {
+      if (ti > 0 && entries[ti].dword == entries[ti - 1].dword) continue;
+      uint32_t bucket =
+          SpriteDetectBucket(entries[ti].dword, detector.bucketShift);
+      while (table[bucket] != 0) bucket = (bucket + 1) & (buckets - 1);
+      table[bucket] = (uint16_t)(ti + 1);
+    }
+  }
+}
+
+bool SerumData::ReadSourceInfo(const char *filename, SourceInfo &info) {
+  std::error_code ec;
+  auto time = std::filesystem::last_write_time(filename, ec);
+  if (ec) return false;
+  std::shared_ptr<MappedFile> file = MappedFile::Open(filename);
+  if (!file) return false;
+  info.size = file->size();
+  info.modified = (int64_t)time.time_since_epoch().count();
+  info.crc32 = ~crc32_update(0xffffffff, file->data(), file->size());
+  return true;
+}
+
+bool SerumData::IsConcentrateUpToDate(const char *concentrate,
+                                      const char *sourcefile,
+                                      const uint8_t flags) {
+  // only the header, the table of contents and the source section are read
+  FILE *fp = fopen(concentrate, "rb");
+  if (!fp) return true;
+  uint64_t recordOffset = 0;
+  uint8_t header[CROMC_HEADER_SIZE];
+  if (fread(header, 1, CROMC_HEADER_SIZE, fp) == CROMC_HEADER_SIZE &&
+      memcmp(header, "CROM", 4) == 0) {
+    uint16_t version;
+    uint32_t count;
+    memcpy(&version, &header[4], sizeof(uint16_t));
+    memcpy(&count, &header[8], sizeof(uint32_t));
+    // older versions have no table of contents
+    if (FromLittleEndian16(version) < 5) count = 0;
+    for (uint32_t i = 0; i < FromLittleEndian32(count); i++) {
+      uint8_t entry[CROMC_TOC_ENTRY_SIZE];
+      uint32_t id;
+      if (fread(entry, 1, CROMC_TOC_ENTRY_SIZE, fp) != CROMC_TOC_ENTRY_SIZE)
+        break;
+      memcpy(&id, entry, sizeof(uint32_t));
+      if (FromLittleEndian32(id) == CROMC_SECTION_SOURCE) {
+        memcpy(&recordOffset, &entry[8], sizeof(uint64_t));
+        recordOffset = FromLittleEndian64(recordOffset);
+        break;
+      }
+    }
+  }
+  uint8_t record[CROMC_SOURCE_SIZE];
+  const bool known =
+      recordOffset > 0 && FileSeek(fp, recordOffset, SEEK_SET) == 0 &&
+      fread(record, 1, CROMC_SOURCE_SIZE, fp) == CROMC_SOURCE_SIZE;
+  fclose(fp);
+  if (!known) return true;
+  SourceInfo stored;
+  DecodeSourceInfo(record, stored);
+
+  const uint8_t requested =
+      flags & (FLAG_REQUEST_32P_FRAMES | FLAG_REQUEST_64P_FRAMES);
+  if ((stored.resolutions & requested) != requested) {
+    Log("%s doesn't contain all requested frame sizes", concentrate);
+    return false;
+  }
+
+  std::error_code sizeError, timeError;
+  const uint64_t size = std::filesystem::file_size(sourcefile, sizeError);
+  const auto time = std::filesystem::last_write_time(sourcefile, timeError);
+  if (!sizeError && !timeError && size == stored.size &&
+      (int64_t)time.time_since_epoch().count() == stored.modified)
+    return true;
 
-    // Write compressed data to file
-    FILE *fp = fopen(filename, "wb");
+  // touched or copied, only a different content needs a new cROMc
+  SourceInfo current;
+  if (!ReadSourceInfo(sourcefile, current)) return true;
+  if (current.size != stored.size || current.crc32 != stored.crc32) {
+    Log("%s has been generated from another version of %s", concentrate,
+        sourcefile);
+    return false;
+  }
+  // The cROMc might be used by a loaded SerumData, so its record isn't
+  // updated in place. The source is read again on the next check, until the
+  // cROMc is written for another reason.
+  Log("%s has been touched since %s was generated", sourcefile, concentrate);
+  return true;
+}
+
+bool SerumData::SaveToFile(const char *filename,
+                           const std::vector<SceneData> &scenes,
+                           const SourceInfo &sourceInfo) {
+  if (!IsLittleEndianHost()) {
+    Log("Writing cROMc files is only supported on little-endian CPUs");
+    return false;
+  }
+
+  // The current file might be used by a loaded SerumData (even this one), so
+  // it must not be overwritten in place but replaced. The temporary file is
+  // unique per process and per write, other processes might generate the
+  // same cROMc.
+  static std::atomic<uint32_t> tempCounter{0};
+  std::string tempname = std::string(filename) + ".tmp" +
+                         std::to_string(getpid()) + "_" +
+                         std::to_string(tempCounter.fetch_add(1));
+  FILE *fp = NULL;
+
+  try {
+    Log("Writing %s", filename);
+
+    // The sections are compressed and written one after the other, so only
+    // one chunk or element is kept in memory. The table of contents in front
+    // of them is written last.
+    struct Section {
+      uint32_t id;
+      uint32_t codec;
+      uint64_t offset;
+      uint64_t storedSize;
+      uint64_t size;
+    };
+    std::vector<Section> sections;
+    uint32_t sectionCount = sourceInfo.size > 0 ? 2 : 1;
+    ForEachVector([&](auto &, uint32_t) { sectionCount++; });
+
+    fp = fopen(tempname.c_str(), "wb");
     if (!fp) {
-      Log("Failed to open %s for writing", filename);
+      Log("Failed to open %s for writing", tempname.c_str());
       return false;
     }
 
-    // Write magic string first
-    const char magic[] = "CROM";
-    fwrite(magic, 1, 4, fp);
+    static const uint8_t padding[CROMC_SECTION_ALIGNMENT] = {0};
+    uint64_t position = 0;
+    bool ok = true;
+    // pads the file up to the next section
+    auto alignFile = [&]() {
+      const uint64_t aligned = (position + CROMC_SECTION_ALIGNMENT - 1) &
+                               ~(uint64_t)(CROMC_SECTION_ALIGNMENT - 1);
+      while (ok && position < aligned) {
+        const size_t size = (size_t)std::min<uint64_t>(aligned - position,
+                                                       sizeof(padding));
+        ok = fwrite(padding, 1, size, fp) == size;
+        position += size;
+      }
+    };
+    // rewinds the file to the start of the section to write it another way
+    auto rewindTo = [&](const Section &section) {
+      ok = ok && FileSeek(fp, section.offset, SEEK_SET) == 0;
+    };
 
-    // Write version
-    uint16_t littleVersion = ToLittleEndian16(concentrateFileVersion);
-    fwrite(&littleVersion, sizeof(uint16_t), 1, fp);
+    position = CROMC_HEADER_SIZE + sectionCount * CROMC_TOC_ENTRY_SIZE;
+    ok = FileSeek(fp, position, SEEK_SET) == 0;
+    alignFile();
 
-    // Write original size
-    uint32_t littleEndianSize =
-        ToLittleEndian32((uint32_t)srcLen);  // Use srcLen directly
-    fwrite(&littleEndianSize, sizeof(uint32_t), 1, fp);
+    {
+      Section section = {CROMC_SECTION_METADATA, CROMC_CODEC_RAW, position, 0,
+                         0};
+      CompressingOStream stream(fp, 0, CROMC_LZ4_CHUNK_SIZE, 0);
+      {
+        cereal::PortableBinaryOutputArchive archive(stream);
+        serializeMetadata(archive);
+        archive(scenes);
+      }
+      ok = ok && stream.finish();
+      section.storedSize = section.size = stream.storedSize();
+      sections.push_back(section);
+      position += section.storedSize;
+    }
 
-    // Write compressed data
-    fwrite(compressedData.data(), 1, dstLen, fp);
-    fclose(fp);
+    if (sourceInfo.size > 0) {
+      alignFile();
+      uint8_t record[CROMC_SOURCE_SIZE];
+      EncodeSourceInfo(sourceInfo, record);
+      sections.push_back({CROMC_SECTION_SOURCE, CROMC_CODEC_RAW, position,
+                          CROMC_SOURCE_SIZE, CROMC_SOURCE_SIZE});
+      ok = ok && fwrite(record, 1, CROMC_SOURCE_SIZE, fp) == CROMC_SOURCE_SIZE;
+      position += CROMC_SOURCE_SIZE;
+    }
 
+    uint32_t id = CROMC_SECTION_METADATA + 1;
+    ForEachVector([&](auto &vector, uint32_t flags) {
+      alignFile();
+      if (!ok) return;
+      vector.freeze();
+      size_t size;
+      const uint8_t *data = vector.flatData(size);
+      Section section = {id++, CROMC_CODEC_RAW, position, size, size};
+      bool stored = false;
+      if (flags & VECTOR_PAYLOAD) {
+        // The colorization data is never compressed as a whole, so it can be
+        // used in place and only the elements of the frames which are shown
+        // get decompressed (or paged in). Vectors which are compressed
+        // already only got a fast compression while parsing.
+        uint64_t compressedSize;
+        if (vector.writeCompressedFlat(fp, LZ4HC_CLEVEL_MAX, compressedSize) &&
+            compressedSize < (vector.isCompressed() ? size : size / 4 * 3)) {
+          section.storedSize = section.size = compressedSize;
+          stored = true;
+        } else {
+          rewindTo(section);
+        }
+      } else if (CROMC_SECTION_CODEC == CROMC_CODEC_LZ4 &&
+                 !vector.isCompressed() &&
+                 size >= CROMC_MIN_LZ4_SECTION_SIZE) {
+        // the other vectors are needed up front anyway
+        CompressingOStream stream(fp, size, CROMC_LZ4_CHUNK_SIZE,
+                                  LZ4HC_CLEVEL_MAX);
+        stream.write((const char *)data, size);
+        if (stream.finish() && stream.storedSize() < size / 4 * 3) {
+          section.codec = CROMC_CODEC_LZ4;
+          section.storedSize = stream.storedSize();
+          stored = true;
+        } else {
+          rewindTo(section);
+        }
+      }
+      if (!stored) ok = ok && fwrite(data, 1, size, fp) == size;
+      sections.push_back(section);
+      position = section.offset + section.storedSize;
+      ok = ok && FileSeek(fp, position, SEEK_SET) == 0;
+    });
+
+    std::vector<uint8_t> header(CROMC_HEADER_SIZE +
+                                sections.size() * CROMC_TOC_ENTRY_SIZE);
+    memcpy(header.data(), "CROM", 4);
+    uint16_t littleVersion = ToLittleEndian16(SERUM_CONCENTRATE_VERSION);
+    memcpy(&header[4], &littleVersion, sizeof(uint16_t));
+    uint32_t littleCount = ToLittleEndian32((uint32_t)sections.size());
+    memcpy(&header[8], &littleCount, sizeof(uint32_t));
+    uint8_t *entry = &header[CROMC_HEADER_SIZE];
+    for (const Section &section : sections) {
+      uint32_t values32[2] = {ToLittleEndian32(section.id),
+                              ToLittleEndian32(section.codec)};
+      uint64_t values64[3] = {ToLittleEndian64(section.offset),
+                              ToLittleEndian64(section.storedSize),
+                              ToLittleEndian64(section.size)};
+      memcpy(entry, values32, sizeof(values32));
+      memcpy(entry + sizeof(values32), values64, sizeof(values64));
+      entry += CROMC_TOC_ENTRY_SIZE;
+    }
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 &&
+         fwrite(header.data(), 1, header.size(), fp) == header.size();
+    ok = fclose(fp) == 0 && ok;
+    fp = NULL;
+
+    // a section written again uncompressed might have been shorter
+    std::error_code ec;
+    if (ok) std::filesystem::resize_file(tempname, position, ec);
+    if (ok && !ec) std::filesystem::rename(tempname, filename, ec);
+    if (!ok || ec) {
+      Log("Failed to write %s", filename);
+      remove(tempname.c_str());
+      return false;
+    }
     Log("Writing %s finished", filename);
     return true;
   } catch (const std::exception &e) {
     Log("Exception when writing %s: %s", filename, e.what());
-    return false;
   } catch (...) {
     Log("Failed to write %s", filename);
-    return false;
   }
+  if (fp) {
+    fclose(fp);
+    remove(tempname.c_str());
+  }
+  return false;
+}
+
+uint16_t SerumData::ReadConcentrateVersion(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) return 0;
+  uint8_t header[6];
+  const bool ok = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+                  memcmp(header, "CROM", 4) == 0;
+  fclose(fp);
+  return ok ? (uint16_t)(header[4] | (header[5] << 8)) : 0;
 }
 
-bool SerumData::LoadFromFile(const char *filename, const uint8_t flags) {
+bool SerumData::LoadFromFile(const char *filename, const uint8_t flags,
+                             bool map) {
   m_loadFlags = flags;
+  const auto start = std::chrono::steady_clock::now();
 
   try {
     FILE *fp = fopen(filename, "rb");
@@ -202,6 +867,17 @@ bool SerumData::LoadFromFile(const char *filename, const uint8_t flags) {
     }
     concentrateFileVersion = FromLittleEndian16(littleEndianVersion);
     Log("cROMc version %d", concentrateFileVersion);
+    if (concentrateFileVersion > SERUM_CONCENTRATE_VERSION) {
+      Log("Unsupported cROMc version in %s", filename);
+      fclose(fp);
+      return false;
+    }
+    if (concentrateFileVersion >= 5) {
+      fclose(fp);
+      if (!LoadSections(filename, map)) return false;
+      Log("cROMc loaded in %.1f ms", MillisecondsSince(start));
+      return true;
+    }
 
     // Read original size
     uint32_t littleEndianSize;
@@ -214,8 +890,8 @@ bool SerumData::LoadFromFile(const char *filename, const uint8_t flags) {
     Log("cROMc size %u", originalSize);
 
     // Get total file size - use portable types
-    fseek(fp, 0, SEEK_END);
-    long totalSizeLong = ftell(fp);
+    FileSeek(fp, 0, SEEK_END);
+    const int64_t totalSizeLong = FileTell(fp);
     if (totalSizeLong < 0) {
       Log("Failed to get file size for %s", filename);
       fclose(fp);
@@ -255,9 +931,14 @@ bool SerumData::LoadFromFile(const char *filename, const uint8_t flags) {
     {
       cereal::PortableBinaryInputArchive archive(decompStream);
       archive(*this);
+      archive(sceneData);
     }
 
     fclose(fp);
+    const double milliseconds = MillisecondsSince(start);
+    Log("cROMc loaded in %.1f ms, deflate: %.1f MB at %.1f MB/s",
+        milliseconds, originalSize / 1048576.0,
+        MegabytesPerSecond(originalSize, milliseconds));
     return true;
   } catch (const std::exception &e) {
     Log("Exception when opening %s: %s", filename, e.what());
@@ -268,6 +949,267 @@ bool SerumData::LoadFromFile(const char *filename, const uint8_t flags) {
   }
 }
 
+bool SerumData::LoadSections(const char *filename, bool map) {
+  if (!IsLittleEndianHost()) {
+    Log("cROMc v5 files are only supported on little-endian CPUs");
+    return false;
+  }
+
+  std::shared_ptr<MappedFile> file = MappedFile::Open(filename, map);
+  if (!file) {
+    Log("Failed to open %s", filename);
+    return false;
+  }
+  const uint8_t *base = file->data();
+  const uint64_t fileSize = file->size();
+  Log("cROMc %s, size %llu", file->isMapped() ? "mapped" : "read",
+      (unsigned long long)fileSize);
+
+  auto read32 = [&](uint64_t offset) {
+    uint32_t value;
+    memcpy(&value, base + offset, sizeof(uint32_t));
+    return FromLittleEndian32(value);
+  };
+  auto read64 = [&](uint64_t offset) {
+    uint64_t value;
+    memcpy(&value, base + offset, sizeof(uint64_t));
+    return FromLittleEndian64(value);
+  };
+
+  struct Section {
+    uint32_t codec;
+    uint64_t offset;
+    uint64_t storedSize;
+    uint64_t size;
+  };
+  std::unordered_map<uint32_t, Section> sections;
+  if (fileSize < CROMC_HEADER_SIZE) {
+    Log("File too small in %s", filename);
+    return false;
+  }
+  const uint32_t sectionCount = read32(8);
+  if ((uint64_t)sectionCount * CROMC_TOC_ENTRY_SIZE >
+      fileSize - CROMC_HEADER_SIZE) {
+    Log("Invalid table of contents in %s", filename);
+    return false;
+  }
+  for (uint32_t i = 0; i < sectionCount; i++) {
+    const uint64_t entry = CROMC_HEADER_SIZE + i * CROMC_TOC_ENTRY_SIZE;
+    Section section = {read32(entry + 4), read64(entry + 8),
+                       read64(entry + 16), read64(entry + 24)};
+    if (section.offset > fileSize ||
+        section.storedSize > fileSize - section.offset ||
+        section.size > SIZE_MAX || section.codec > CROMC_CODEC_LZ4 ||
+        (section.codec == CROMC_CODEC_RAW &&
+         section.storedSize != section.size)) {
+      Log("Invalid section %u in %s", read32(entry), filename);
+      return false;
+    }
+    sections[read32(entry)] = section;
+  }
+
+  // Raw sections are used in place, the mapping is kept alive by the vectors
+  // using it. Compressed ones are unpacked to their own block, chunk by chunk.
+  struct Chunk {
+    const uint8_t *source;
+    uint32_t sourceSize;
+    uint8_t *target;
+    uint32_t targetSize;
+  };
+  auto sectionData = [&](const Section &section, uint8_t *&data,
+                         std::shared_ptr<void> &owner,
+                         std::vector<Chunk> &chunks) {
+    if (section.codec == CROMC_CODEC_RAW) {
+      data = file->data() + section.offset;
+      owner = file;
+      return true;
+    }
+    const uint64_t chunkCount =
+        (section.size + CROMC_LZ4_CHUNK_SIZE - 1) / CROMC_LZ4_CHUNK_SIZE;
+    if (section.storedSize < sizeof(uint32_t) * (1 + chunkCount) ||
+        read32(section.offset) != chunkCount)
+      return false;
+    uint8_t *block = static_cast<uint8_t *>(::operator new(
+        (size_t)section.size, std::align_val_t(SPARSE_VECTOR_FLAT_ALIGNMENT)));
+    owner = std::shared_ptr<uint8_t>(block, [](uint8_t *p) {
+      ::operator delete(p, std::align_val_t(SPARSE_VECTOR_FLAT_ALIGNMENT));
+    });
+    data = block;
+    uint64_t position = sizeof(uint32_t) * (1 + chunkCount);
+    for (uint64_t chunk = 0; chunk < chunkCount; chunk++) {
+      const uint32_t chunkSize =
+          read32(section.offset + sizeof(uint32_t) * (1 + chunk));
+      if (chunkSize > section.storedSize - position) return false;
+      const uint64_t start = chunk * CROMC_LZ4_CHUNK_SIZE;
+      chunks.push_back({base + section.offset + position, chunkSize,
+                        block + start,
+                        (uint32_t)std::min<uint64_t>(CROMC_LZ4_CHUNK_SIZE,
+                                                     section.size - start)});
+      position += chunkSize;
+    }
+    return true;
+  };
+  auto decompressChunk = [](const Chunk &chunk) {
+    return LZ4_decompress_safe((const char *)chunk.source,
+                               (char *)chunk.target, (int)chunk.sourceSize,
+                               (int)chunk.targetSize) == (int)chunk.targetSize;
+  };
+
+  auto metadata = sections.find(CROMC_SECTION_METADATA);
+  uint8_t *data;
+  std::shared_ptr<void> owner;
+  std::vector<Chunk> chunks;
+  if (metadata == sections.end() ||
+      !sectionData(metadata->second, data, owner, chunks) ||
+      !std::all_of(chunks.begin(), chunks.end(), decompressChunk)) {
+    Log("Missing header in %s", filename);
+    return false;
+  }
+  {
+    std::istringstream ss(
+        std::string((const char *)data, metadata->second.size),
+        std::ios::binary);
+    cereal::PortableBinaryInputArchive archive(ss);
+    serializeMetadata(archive);
+    archive(sceneData);
+  }
+  auto sourceSection = sections.find(CROMC_SECTION_SOURCE);
+  if (sourceSection != sections.end() &&
+      sourceSection->second.codec == CROMC_CODEC_RAW &&
+      sourceSection->second.size >= CROMC_SOURCE_SIZE) {
+    DecodeSourceInfo(base + sourceSection->second.offset, source);
+  }
+
+  // Like for older versions, the extra resolution isn't loaded at all if not
+  // requested
+  const bool dropExtra =
+      SERUM_V2 == SerumVersion &&
+      ((fheight == 32 && !(m_loadFlags & FLAG_REQUEST_64P_FRAMES)) ||
+       (fheight == 64 && !(m_loadFlags & FLAG_REQUEST_32P_FRAMES)));
+
+  // Collect the chunks of all vectors first, then decompress them and set
+  // up the vectors on a few threads
+  chunks.clear();
+  std::vector<std::function<bool()>> adoptions;
+  std::vector<uint32_t> adoptionIds;
+  uint32_t id = CROMC_SECTION_METADATA + 1;
+  bool ok = true;
+  ForEachVector([&](auto &vector, uint32_t flags) {
+    const uint32_t sectionId = id++;
+    if (!ok || ((flags & VECTOR_EXTRA) && dropExtra)) return;
+    auto it = sections.find(sectionId);
+    if (it == sections.end()) return;  // no data
+    if (!sectionData(it->second, data, owner, chunks)) {
+      Log("Invalid section %u in %s", sectionId, filename);
+      ok = false;
+      return;
+    }
+    const size_t size = (size_t)it->second.size;
+    adoptions.push_back([&vector, data, size, owner]() {
+      return vector.adoptFlat(data, size, owner);
+    });
+    adoptionIds.push_back(sectionId);
+  });
+  if (!ok) return false;
+
+  uint64_t decodedSize = 0;
+  for (const Chunk &chunk : chunks) decodedSize += chunk.targetSize;
+  const auto decodeStart = std::chrono::steady_clock::now();
+  std::atomic<bool> chunksOk{true};
+  if (!RunParallel(chunks.size(),
+                   [&](size_t i) {
+                     if (!decompressChunk(chunks[i])) chunksOk = false;
+                   }) ||
+      !chunksOk) {
+    Log("Failed to decompress %s", filename);
+    return false;
+  }
+  const double decodeMilliseconds = MillisecondsSince(decodeStart);
+
+  std::vector<uint8_t> adopted(adoptions.size(), 0);
+  RunParallel(adoptions.size(),
+              [&](size_t i) { adopted[i] = adoptions[i](); });
+  for (size_t i = 0; i < adoptions.size(); i++) {
+    if (!adopted[i]) {
+      Log("Invalid section %u in %s", adoptionIds[i], filename);
+      return false;
+    }
+  }
+  // older files are cropped by PrepareRuntime()
+  spritesCompact = concentrateFileVersion >= CROMC_COMPACT_SPRITES_VERSION;
+  if (spritesCompact && !CheckCompactSprites()) {
+    Log("Invalid sprites in %s", filename);
+    return false;
+  }
+
+  uint64_t inPlaceSize = 0;
+  for (const auto &entry : sections) {
+    if (entry.first != CROMC_SECTION_METADATA &&
+        entry.second.codec == CROMC_CODEC_RAW)
+      inPlaceSize += entry.second.size;
+  }
+  Log("cROMc sections: raw %.1f MB, LZ4 %.1f MB decoded at %.1f MB/s",
+      inPlaceSize / 1048576.0, decodedSize / 1048576.0,
+      MegabytesPerSecond(decodedSize, decodeMilliseconds));
+  return true;
+}
+
+std::shared_ptr<SerumData> SerumData::LoadShared(const char *filename,
+                                                 const uint8_t flags,
+                                                 Serum_LogCallback callback,
+                                                 const void *userData,
+                                                 bool map) {
+  // The loaded data depends on the file content and on the requested frame
+  // sizes (the extra frames are dropped if not requested)
+  static std::mutex registryMutex;
+  static std::map<std::string, std::weak_ptr<SerumData>> registry;
+
+  std::string key;
+  std::error_code ec;
+  std::filesystem::path path = std::filesystem::canonical(filename, ec);
+  if (!ec) {
+    auto size = std::filesystem::file_size(path, ec);
+    auto time = std::filesystem::last_write_time(path, ec);
+    if (!ec) {
+      key = path.string() + '|' + std::to_string(size) + '|' +
+            std::to_string(time.time_since_epoch().count()) + '|' +
+            std::to_string(flags & (FLAG_REQUEST_32P_FRAMES |
+                                    FLAG_REQUEST_64P_FRAMES)) +
+            (map ? "|mapped" : "|read");
+    }
+  }
+
+  if (!key.empty()) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto it = registry.find(key);
+    if (it != registry.end()) {
+      if (std::shared_ptr<SerumData> shared = it->second.lock()) return shared;
+    }
+  }
+
+  // not loaded yet, other loads can go on in parallel
+  auto data = std::make_shared<SerumData>();
+  data->SetLogCallback(callback, userData);
+  if (!data->LoadFromFile(filename, flags, map)) return nullptr;
+  data->PrepareRuntime();
+  if (key.empty()) return data;
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  std::weak_ptr<SerumData> &entry = registry[key];
+  if (std::shared_ptr<SerumData> shared = entry.lock()) {
+    return shared;  // loaded by another context in the meantime
+  }
+  entry = data;
+  // forget the files which aren't used anymore
+  for (auto it = registry.begin(); it != registry.end();) {
+    if (it->second.expired())
+      it = registry.erase(it);
+    else
+      ++it;
+  }
+  return data;
+}
+
 void SerumData::Log(const char *format, ...) {
   if (!m_logCallback) {
     return;
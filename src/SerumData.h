@@ -5,8 +5,10 @@
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/vector.hpp>
 #include <cstdint>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "SceneGenerator.h"
@@ -42,6 +44,20 @@ inline uint32_t FromLittleEndian32(uint32_t value) {
          ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
 }
 
+inline uint64_t ToLittleEndian64(uint64_t value) {
+  uint64_t result;
+  uint8_t *data = (uint8_t *)&result;
+  for (int i = 0; i < 8; i++) data[i] = (value >> (8 * i)) & 0xFF;
+  return result;
+}
+
+inline uint64_t FromLittleEndian64(uint64_t value) {
+  const uint8_t *data = (uint8_t *)&value;
+  uint64_t result = 0;
+  for (int i = 0; i < 8; i++) result |= (uint64_t)data[i] << (8 * i);
+  return result;
+}
+
 class SerumData {
  public:
   SerumData();
@@ -50,15 +66,68 @@ class SerumData {
   void SetLogCallback(Serum_LogCallback callback, const void *userData) {
     m_logCallback = callback;
     m_logUserData = userData;
-
-    if (sceneGenerator) {
-      sceneGenerator->SetLogCallback(callback, userData);
-    }
   }
 
+  // Identifies the cROM or cRZ file a cROMc has been generated from
+  struct SourceInfo {
+    uint64_t size = 0;     // 0 if unknown
+    int64_t modified = 0;  // last write time, in ticks of the file clock
+    uint32_t crc32 = 0;    // of the whole file
+    // FLAG_REQUEST_32P_FRAMES / FLAG_REQUEST_64P_FRAMES, the frame sizes the
+    // source has been loaded with
+    uint8_t resolutions = 0;
+  };
+  // Source of the loaded cROMc, size 0 if unknown
+  SourceInfo source;
+
+  // Reads size, time and CRC32 of a cROM or cRZ file
+  static bool ReadSourceInfo(const char *filename, SourceInfo &info);
+  // Returns false if the cROMc has been generated from another version of the
+  // source file or without all the frame sizes requested by flags. If only
+  // the time of the source changed, its content is compared, the cROMc isn't
+  // modified. A cROMc which doesn't know its source is always up to date.
+  bool IsConcentrateUpToDate(const char *concentrate, const char *sourcefile,
+                             const uint8_t flags);
+
   void Clear();
-  bool SaveToFile(const char *filename);
-  bool LoadFromFile(const char *filename, const uint8_t flags);
+  // Once PrepareRuntime() has been called, the data is only read, so the file
+  // can be written on another thread while the data is in use
+  bool SaveToFile(const char *filename, const std::vector<SceneData> &scenes,
+                  const SourceInfo &sourceInfo);
+  // Without map, a cROMc v5 file is read instead of mapped, so it can be
+  // replaced by SaveToFile() while the data is in use
+  bool LoadFromFile(const char *filename, const uint8_t flags,
+                    bool map = true);
+  // The version of a cROMc file, 0 if it can't be read
+  static uint16_t ReadConcentrateVersion(const char *filename);
+  // Must be called once all data is loaded, before colorizing frames
+  void PrepareRuntime();
+
+  // Loads a cROMc file and prepares it for runtime. If the same file is
+  // already loaded with the same frame flags by another context, its data is
+  // shared instead. The data must not be modified once returned. map is
+  // passed to LoadFromFile(), mapped data is only shared with map.
+  static std::shared_ptr<SerumData> LoadShared(const char *filename,
+                                               const uint8_t flags,
+                                               Serum_LogCallback callback,
+                                               const void *userData,
+                                               bool map = true);
+
+  // Plain pointers to the v2 data of one frame in one resolution, resolved
+  // once per frame so the colorization loops don't need SparseVector lookups
+  // per pixel. Compressed vectors only cache a few decompressed elements per
+  // thread, so a view is only valid until the frame is colorized.
+  struct FrameView {
+    const uint8_t *dynamask;
+    const uint16_t *cframe;
+    const uint16_t *dyna4cols;
+    const uint16_t *colorrotations;
+    const uint8_t *dynashadowsdir;
+    const uint16_t *dynashadowscol;
+    const uint8_t *backgroundmask;    // NULL if the frame has no background
+    const uint16_t *backgroundframe;  // NULL if the frame has no background
+  };
+  FrameView GetFrameView(uint32_t frameId, bool extra);
 
   // Header data
   char rname[64];
@@ -124,11 +193,163 @@ class SerumData {
   SparseVector<uint8_t> dynaspritemasks;
   SparseVector<uint8_t> dynaspritemasks_extra;
   SparseVector<uint8_t> sprshapemode;
+  // Computed from the sprite masks (spriteoriginal, spritedescriptionso for
+  // v1) by PrepareRuntime() if the file doesn't have them. Per sprite, the
+  // width and height up to the last opaque pixel:
+  SparseVector<uint16_t> spritesizes;
+  // and per row, the first opaque pixel and the one after the last, 0 and 0
+  // for a transparent row:
+  SparseVector<uint16_t> spritespans;
+  // The v2 sprites are stored cropped to their opaque pixels by
+  // PrepareRuntime(): spriteoriginal, spritecolored and dynaspritemasks have
+  // rows of the width of spritebounds, {x, y, width, height} within the
+  // 256x64 sprite, 0 width for an empty sprite. The spans stay relative to
+  // the full sprite. Same for the extra vectors and spritebounds_extra.
+  SparseVector<uint16_t> spritebounds;
+  SparseVector<uint16_t> spritebounds_extra;
+  // Computed by PrepareRuntime() for v2 if the file doesn't have them. Per
+  // frame, {x, y, width, height} of the pixels whose color depends on the
+  // frame content (dynamic and background pixels and their dynamic shadows),
+  // for the original then the extra resolution, 0 width if there are none.
+  SparseVector<uint16_t> framedynabounds;
+  bool spritesCompact;
 
-  SceneGenerator *sceneGenerator;
+  // Scenes stored in the cROMc, every context plays them with its own
+  // SceneGenerator
+  std::vector<SceneData> sceneData;
+
+  // Lookup structures for Identify_Frame(), built by PrepareRuntime().
+  //
+  // Frames sharing the same comparison mask and shape mode are grouped, so
+  // only one CRC per group needs to be calculated to look up the matching
+  // frame IDs by hash.
+  struct FrameLookupGroup {
+    uint8_t mask;
+    uint8_t shape;
+    std::vector<uint32_t> frames;  // ascending frame IDs
+    std::unordered_map<uint32_t, std::vector<uint32_t>>
+        framesByHash;  // ascending frame IDs per hashcode
+  };
+  std::vector<FrameLookupGroup> frameLookup;
+  // Each comparison mask as the list of its unmasked spans, so the masked CRC
+  // only has to stream these through the CRC kernel.
+  struct MaskRun {
+    uint32_t start;
+    uint32_t length;
+  };
+  std::vector<std::vector<MaskRun>> compmaskRuns;
+
+  // Lookup structures for Check_Sprites*(), built by PrepareRuntime().
+  //
+  // The detection dwords of all the sprites a frame looks for are put in one
+  // small hash table per frame, so the union of their bounding boxes only
+  // needs to be scanned once, whatever the number of sprites and areas.
+  struct SpriteDetectEntry {
+    uint32_t dword;
+    uint8_t slot;   // position of the sprite in framesprites
+    uint8_t area;   // detection area of the sprite
+    uint8_t shape;  // 1 if the sprite is looked for in the shape of the frame
+  };
+  struct SpriteDetector {
+    uint32_t firstEntry = 0;   // in spriteDetectEntries, sorted by dword
+    uint32_t entryCount = 0;   // 0 if the frame has no sprite to look for
+    uint32_t firstBucket = 0;  // in spriteDetectBuckets
+    uint8_t bucketShift = 32;  // the table has 1 << (32 - bucketShift) buckets
+    // union of the bounding boxes of the sprites looked for in the frame
+    // itself [0] and in its shape [1], empty if minx > maxx
+    uint16_t minx[2] = {0xffff, 0xffff}, miny[2] = {0xffff, 0xffff};
+    uint16_t maxx[2] = {0, 0}, maxy[2] = {0, 0};
+    // the distinct dwords looked for in the frame [0] and in its shape [1]
+    uint32_t firstPattern[2] = {0, 0};  // in spriteDetectPatterns
+    uint32_t patternCount[2] = {0, 0};
+  };
+  std::vector<SpriteDetector> spriteDetectors;  // per frame
+  std::vector<SpriteDetectEntry> spriteDetectEntries;
+  std::vector<uint32_t> spriteDetectPatterns;
+  // 1 + index of the first entry with the dword (relative to firstEntry),
+  // 0 for an empty bucket
+  std::vector<uint16_t> spriteDetectBuckets;
+  static uint32_t SpriteDetectBucket(uint32_t dword, uint8_t shift) {
+    return (dword * 2654435761u) >> shift;
+  }
 
  private:
   void Log(const char *format, ...);
+  void BuildFrameLookup();
+  void CompactSprites();
+  bool CheckCompactSprites();
+  void BuildSpriteExtents();
+  void BuildFrameDynaBounds();
+  void BuildSpriteDetectors();
+  bool LoadSections(const char *filename, bool map);
+
+  // Flags passed by ForEachVector()
+  // data of the extra resolution, dropped if not requested
+  static constexpr uint32_t VECTOR_EXTRA = 1;
+  // colorization data, only needed once a frame is shown. Identification and
+  // sprite detection data is always loaded up front.
+  static constexpr uint32_t VECTOR_PAYLOAD = 2;
+
+  // Calls f(vector, flags) for every vector, in the order of their cROMc
+  // sections. Only append new vectors at the end.
+  template <typename F>
+  void ForEachVector(F &&f) {
+    f(hashcodes, 0);
+    f(shapecompmode, 0);
+    f(compmaskID, 0);
+    f(movrctID, 0);
+    f(compmasks, 0);
+    f(movrcts, 0);
+    f(cpal, VECTOR_PAYLOAD);
+    f(isextraframe, VECTOR_EXTRA);
+    f(cframes, VECTOR_PAYLOAD);
+    f(cframes_v2, VECTOR_PAYLOAD);
+    f(cframes_v2_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(dynamasks, VECTOR_PAYLOAD);
+    f(dynamasks_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(dyna4cols, VECTOR_PAYLOAD);
+    f(dyna4cols_v2, VECTOR_PAYLOAD);
+    f(dyna4cols_v2_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(framesprites, 0);
+    f(spritedescriptionso, VECTOR_PAYLOAD);
+    f(spritedescriptionsc, VECTOR_PAYLOAD);
+    f(isextrasprite, VECTOR_EXTRA);
+    f(spriteoriginal, 0);
+    f(spritemask_extra, VECTOR_EXTRA);
+    f(spritecolored, VECTOR_PAYLOAD);
+    f(spritecolored_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(activeframes, 0);
+    f(colorrotations, VECTOR_PAYLOAD);
+    f(colorrotations_v2, VECTOR_PAYLOAD);
+    f(colorrotations_v2_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(spritedetdwords, 0);
+    f(spritedetdwordpos, 0);
+    f(spritedetareas, 0);
+    f(triggerIDs, 0);
+    f(framespriteBB, 0);
+    f(isextrabackground, VECTOR_EXTRA);
+    f(backgroundframes, VECTOR_PAYLOAD);
+    f(backgroundframes_v2, VECTOR_PAYLOAD);
+    f(backgroundframes_v2_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(backgroundIDs, 0);
+    f(backgroundBB, 0);
+    f(backgroundmask, VECTOR_PAYLOAD);
+    f(backgroundmask_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(dynashadowsdir, VECTOR_PAYLOAD);
+    f(dynashadowscol, VECTOR_PAYLOAD);
+    f(dynashadowsdir_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(dynashadowscol_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(dynasprite4cols, VECTOR_PAYLOAD);
+    f(dynasprite4cols_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(dynaspritemasks, VECTOR_PAYLOAD);
+    f(dynaspritemasks_extra, VECTOR_EXTRA | VECTOR_PAYLOAD);
+    f(sprshapemode, 0);
+    f(spritesizes, 0);
+    f(spritespans, 0);
+    f(spritebounds, 0);
+    f(spritebounds_extra, VECTOR_EXTRA);
+    f(framedynabounds, 0);
+  }
 
   Serum_LogCallback m_logCallback = nullptr;
   const void *m_logUserData = nullptr;
@@ -137,29 +358,33 @@ class SerumData {
 
   friend class cereal::access;
 
+  // The header data, stored in the metadata section of cROMc v5
   template <class Archive>
-  void serialize(Archive &ar) {
+  void serializeMetadata(Archive &ar) {
     ar(rname, SerumVersion, fwidth, fheight, fwidth_extra, fheight_extra,
        nframes, nocolors, nccolors, ncompmasks, nmovmasks, nsprites,
-       nbackgrounds, is256x64, hashcodes, shapecompmode, compmaskID, movrctID,
-       compmasks, movrcts, cpal, isextraframe, cframes, cframes_v2,
-       cframes_v2_extra, dynamasks, dynamasks_extra, dyna4cols, dyna4cols_v2,
-       dyna4cols_v2_extra, framesprites, spritedescriptionso,
-       spritedescriptionsc, isextrasprite, spriteoriginal, spritemask_extra,
-       spritecolored, spritecolored_extra, activeframes, colorrotations,
-       colorrotations_v2, colorrotations_v2_extra, spritedetdwords,
-       spritedetdwordpos, spritedetareas, triggerIDs, framespriteBB,
-       isextrabackground, backgroundframes, backgroundframes_v2,
-       backgroundframes_v2_extra, backgroundIDs, backgroundBB, backgroundmask,
-       backgroundmask_extra, dynashadowsdir, dynashadowscol,
-       dynashadowsdir_extra, dynashadowscol_extra, dynasprite4cols,
-       dynasprite4cols_extra, dynaspritemasks, dynaspritemasks_extra,
-       sprshapemode);
-
-    if constexpr (Archive::is_saving::value) {
-      ar(sceneGenerator ? sceneGenerator->getSceneData()
-                        : std::vector<SceneData>{});
-    } else {
+       nbackgrounds, is256x64);
+  }
+
+  // cROMc up to v4
+  template <class Archive>
+  void serialize(Archive &ar) {
+    serializeMetadata(ar);
+    ar(hashcodes, shapecompmode, compmaskID, movrctID, compmasks, movrcts,
+       cpal, isextraframe, cframes, cframes_v2, cframes_v2_extra, dynamasks,
+       dynamasks_extra, dyna4cols, dyna4cols_v2, dyna4cols_v2_extra,
+       framesprites, spritedescriptionso, spritedescriptionsc, isextrasprite,
+       spriteoriginal, spritemask_extra, spritecolored, spritecolored_extra,
+       activeframes, colorrotations, colorrotations_v2,
+       colorrotations_v2_extra, spritedetdwords, spritedetdwordpos,
+       spritedetareas, triggerIDs, framespriteBB, isextrabackground,
+       backgroundframes, backgroundframes_v2, backgroundframes_v2_extra,
+       backgroundIDs, backgroundBB, backgroundmask, backgroundmask_extra,
+       dynashadowsdir, dynashadowscol, dynashadowsdir_extra,
+       dynashadowscol_extra, dynasprite4cols, dynasprite4cols_extra,
+       dynaspritemasks, dynaspritemasks_extra, sprshapemode);
+
+    if constexpr (Archive::is_loading::value) {
       if (SERUM_V2 == SerumVersion &&
           ((fheight == 32 && !(m_loadFlags & FLAG_REQUEST_64P_FRAMES)) ||
            (fheight == 64 && !(m_loadFlags & FLAG_REQUEST_32P_FRAMES)))) {
@@ -183,13 +408,6 @@ class SerumData {
       dynasprite4cols_extra.setParent(&isextraframe);
       dynaspritemasks_extra.setParent(&isextraframe);
       backgroundBB.setParent(&backgroundIDs);
-
-      std::vector<SceneData> loadedScenes;
-      ar(loadedScenes);
-      if (sceneGenerator) {
-        sceneGenerator->setSceneData(std::move(loadedScenes));
-        sceneGenerator->setDepth(nocolors == 16 ? 4 : 2);
-      }
     }
   }
 };
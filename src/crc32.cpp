@@ -0,0 +1,242 @@
+#include "crc32.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#define CRC32_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32_TARGET_PCLMUL
+#else
+#define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32_ARM
+#include <arm_acle.h>
+#if defined(__clang__)
+#define CRC32_TARGET_ARM __attribute__((target("crc")))
+#else
+#define CRC32_TARGET_ARM __attribute__((target("+crc")))
+#endif
+#if defined(__linux__) || defined(__ANDROID__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#endif
+
+typedef uint32_t (*Crc32Kernel)(uint32_t crc, const uint8_t* s, size_t n);
+
+struct Crc32Tables {
+  uint32_t t[8][256];
+};
+
+static constexpr Crc32Tables MakeCrc32Tables() {
+  Crc32Tables tables{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+    tables.t[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int k = 1; k < 8; k++) {
+      uint32_t prev = tables.t[k - 1][i];
+      tables.t[k][i] = (prev >> 8) ^ tables.t[0][prev & 0xFF];
+    }
+  }
+  return tables;
+}
+
+alignas(64) static constexpr Crc32Tables crc32_tables = MakeCrc32Tables();
+
+static inline uint32_t Load32LE(const uint8_t* s) {
+  return (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) |
+         ((uint32_t)s[3] << 24);
+}
+
+static uint32_t Crc32Slice8(uint32_t crc, const uint8_t* s, size_t n) {
+  const auto& t = crc32_tables.t;
+  while (n >= 8) {
+    uint32_t one = crc ^ Load32LE(s);
+    uint32_t two = Load32LE(s + 4);
+    crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+          t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^ t[3][two & 0xFF] ^
+          t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    s += 8;
+    n -= 8;
+  }
+  while (n--) crc = (crc >> 8) ^ t[0][(crc ^ *s++) & 0xFF];
+  return crc;
+}
+
+#ifdef CRC32_X86
+
+// Folding with carry-less multiplications, see Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction". n must be >= 64 and a
+// multiple of 16.
+CRC32_TARGET_PCLMUL static uint32_t Crc32PclmulFold(uint32_t crc,
+                                                    const uint8_t* s,
+                                                    size_t n) {
+  alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+  alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+  alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128((const __m128i*)(s + 0x00));
+  x2 = _mm_loadu_si128((const __m128i*)(s + 0x10));
+  x3 = _mm_loadu_si128((const __m128i*)(s + 0x20));
+  x4 = _mm_loadu_si128((const __m128i*)(s + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  x0 = _mm_load_si128((const __m128i*)k1k2);
+  s += 64;
+  n -= 64;
+
+  // fold 4 blocks of 16 bytes in parallel
+  while (n >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    y5 = _mm_loadu_si128((const __m128i*)(s + 0x00));
+    y6 = _mm_loadu_si128((const __m128i*)(s + 0x10));
+    y7 = _mm_loadu_si128((const __m128i*)(s + 0x20));
+    y8 = _mm_loadu_si128((const __m128i*)(s + 0x30));
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+    s += 64;
+    n -= 64;
+  }
+
+  // fold into 128 bits
+  x0 = _mm_load_si128((const __m128i*)k3k4);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // single blocks of 16 bytes
+  while (n >= 16) {
+    x2 = _mm_loadu_si128((const __m128i*)s);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    s += 16;
+    n -= 16;
+  }
+
+  // fold 128 bits to 64 bits
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x0 = _mm_load_si128((const __m128i*)poly);
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t Crc32Pclmul(uint32_t crc, const uint8_t* s, size_t n) {
+  if (n >= 64) {
+    size_t blocks = n & ~(size_t)15;
+    crc = Crc32PclmulFold(crc, s, blocks);
+    s += blocks;
+    n -= blocks;
+  }
+  return Crc32Slice8(crc, s, n);
+}
+
+static bool Crc32HasPclmul() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 1)) && (info[2] & (1 << 19));
+#else
+  return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+#endif  // CRC32_X86
+
+#ifdef CRC32_ARM
+
+CRC32_TARGET_ARM static uint32_t Crc32Arm(uint32_t crc, const uint8_t* s,
+                                          size_t n) {
+  while (n && ((uintptr_t)s & 7)) {
+    crc = __crc32b(crc, *s++);
+    n--;
+  }
+  while (n >= 8) {
+    uint64_t v;
+    memcpy(&v, s, 8);
+    crc = __crc32d(crc, v);
+    s += 8;
+    n -= 8;
+  }
+  while (n--) crc = __crc32b(crc, *s++);
+  return crc;
+}
+
+static bool Crc32HasArmCrc() {
+#if defined(__ARM_FEATURE_CRC32) || defined(__APPLE__)
+  return true;
+#elif defined(__linux__) || defined(__ANDROID__)
+  return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+  return false;
+#endif
+}
+
+#endif  // CRC32_ARM
+
+struct Crc32Engine {
+  Crc32Kernel kernel;
+  const char* name;
+};
+
+static Crc32Engine SelectCrc32Engine() {
+#ifdef CRC32_X86
+  if (Crc32HasPclmul()) return {Crc32Pclmul, "pclmul"};
+#endif
+#ifdef CRC32_ARM
+  if (Crc32HasArmCrc()) return {Crc32Arm, "armv8-crc32"};
+#endif
+  return {Crc32Slice8, "slicing-by-8"};
+}
+
+static const Crc32Engine& GetCrc32Engine() {
+  static const Crc32Engine engine = SelectCrc32Engine();
+  return engine;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t n) {
+  return GetCrc32Engine().kernel(crc, data, n);
+}
+
+const char* crc32_kernel_name() { return GetCrc32Engine().name; }
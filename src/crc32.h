@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 with the reflected polynomial 0xEDB88320 (same as zlib), used for the
+// frame hashcodes stored in the cROM files.
+//
+// crc32_update() continues a running CRC register: start with 0xffffffff and
+// invert the result once all data has been fed. The fastest kernel available
+// on the running CPU (PCLMULQDQ on x86, the CRC32 instructions on ARMv8,
+// slicing-by-8 tables otherwise) is selected on first use.
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t n);
+
+// Name of the selected kernel, for logging
+const char* crc32_kernel_name();
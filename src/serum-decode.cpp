@@ -2,22 +2,28 @@
 
 #include "serum-decode.h"
 
-#include <miniz/miniz.h>
-
 #include <algorithm>
+#include <bit>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <random>
+#include <thread>
 #include <vector>
 
 #include "SerumData.h"
 #include "TimeUtils.h"
+#include "crc32.h"
 #include "serum-version.h"
+#include "sprite-scan.h"
 
 #if defined(__APPLE__)
 #include <TargetConditionals.h>
@@ -25,28 +31,6 @@
 
 #if defined(_WIN32) || defined(_WIN64)
 #define strcasecmp _stricmp
-#else
-
-#if not defined(__STDC_LIB_EXT1__)
-
-// trivial implementation of the secure string functions if not directly
-// supported by the compiler these do not perform all security checks and can be
-// improved for sure
-int strcpy_s(char* dest, size_t destsz, const char* src) {
-  if ((dest == NULL) || (src == NULL)) return 1;
-  if (strlen(src) >= destsz) return 1;
-  strcpy(dest, src);
-  return 0;
-}
-
-int strcat_s(char* dest, size_t destsz, const char* src) {
-  if ((dest == NULL) || (src == NULL)) return 1;
-  if (strlen(dest) + strlen(src) >= destsz) return 1;
-  strcat(dest, src);
-  return 0;
-}
-
-#endif
 #endif
 
 #define PUP_TRIGGER_REPEAT_TIMEOUT 500  // 500 ms
@@ -67,21 +51,6 @@ void Log(const char* format, ...) {
   va_end(args);
 }
 
-static SerumData g_serumData;
-uint16_t sceneFrameCount = 0;
-uint16_t sceneCurrentFrame = 0;
-uint16_t sceneDurationPerFrame = 0;
-bool sceneInterruptable = false;
-bool sceneStartImmediately = false;
-uint8_t sceneRepeatCount = 0;
-uint8_t sceneEndFrame = 0;
-uint8_t sceneFrame[192 * 64] = {0};
-uint8_t lastFrame[192 * 64] = {0};
-bool monochromeMode = false;
-bool showStatusMessages = false;
-
-const int pathbuflen = 4096;
-
 const uint32_t MAX_NUMBER_FRAMES = 0x7fffffff;
 
 const uint16_t greyscale_4[4] = {
@@ -110,60 +79,249 @@ const uint16_t greyscale_16[16] = {
     0xFFFF   // White (31, 63, 31)
 };
 
-// variables
-bool cromloaded = false;  // is there a crom loaded?
-bool generateCRomC = true;
-uint32_t lastfound = 0;  // last frame ID identified
-uint32_t lastframe_full_crc = 0;
-uint32_t lastframe_found = GetMonotonicTimeMs();
-uint32_t lasttriggerID = 0xffffffff;  // last trigger ID found
-uint32_t lasttriggerTimestamp = 0;
-bool isrotation = true;     // are there rotations to send
-bool crc32_ready = false;   // is the crc32 table filled?
-uint32_t crc32_table[256];  // initial table
-bool* framechecked = NULL;  // are these frames checked?
-uint16_t ignoreUnknownFramesTimeout = 0;
-uint8_t maxFramesToSkip = 0;
-uint8_t framesSkippedCounter = 0;
-uint8_t standardPalette[PALETTE_SIZE];
-uint8_t standardPaletteLength = 0;
-uint32_t colorshifts[MAX_COLOR_ROTATIONS];         // how many color we shifted
-uint32_t colorshiftinittime[MAX_COLOR_ROTATIONS];  // when was the tick for this
-uint32_t colorshifts32[MAX_COLOR_ROTATION_V2];  // how many color we shifted for
-                                                // extra res
-uint32_t colorshiftinittime32[MAX_COLOR_ROTATION_V2];  // when was the tick for
-                                                       // this for extra res
-uint32_t colorshifts64[MAX_COLOR_ROTATION_V2];  // how many color we shifted for
-                                                // extra res
-uint32_t colorshiftinittime64[MAX_COLOR_ROTATION_V2];  // when was the tick for
-                                                       // this for extra res
-uint32_t colorrotseruminit;  // initial time when all the rotations started
-uint32_t
-    colorrotnexttime[MAX_COLOR_ROTATIONS];  // next time of the next rotation
-uint32_t colorrotnexttime32[MAX_COLOR_ROTATION_V2];  // next time of the next
-                                                     // rotation
-uint32_t colorrotnexttime64[MAX_COLOR_ROTATION_V2];  // next time of the next
-                                                     // rotation
-// rotation
-bool enabled = true;  // is colorization enabled?
-
-bool isoriginalrequested =
-    true;  // are the original resolution frames requested by the caller
-bool isextrarequested =
-    false;  // are the extra resolution frames requested by the caller
-
-uint32_t
-    rotationnextabsolutetime[MAX_COLOR_ROTATIONS];  // cumulative time for the
-                                                    // next rotation for each
-                                                    // color rotation
-
-Serum_Frame_Struc mySerum;  // structure to keep communicate colorization data
-
-uint8_t* frameshape = NULL;  // memory for shape mode conversion of ythe frame
+// Inverse of the v2 color rotations of a frame: for every 16-bit color, the
+// first rotation containing it and its position in there. This replaces a
+// search through all the rotations for every pixel and is only rebuilt when
+// another frame gets colorized.
+static_assert(MAX_COLOR_ROTATION_V2 <= 4 && MAX_LENGTH_COLOR_ROTATION <= 64,
+              "color rotation lookup entries are too small");
+struct ColorRotationLookup {
+  uint32_t frameId = 0xffffffff;
+  uint8_t generation = 0;
+  uint16_t entries[65536] = {0};  // generation << 8 | rotation << 6 | position
+};
+
+// The pixels of the current 32P or 64P frame that are part of a v2 color
+// rotation, grouped by rotation (as structure of arrays). They are collected
+// once the frame is colorized, so Serum_Rotate() only has to touch these
+// pixels instead of scanning the whole frame for every rotation.
+struct RotationPixels {
+  uint32_t start[MAX_COLOR_ROTATION_V2 + 1];  // first entry of each rotation
+  uint16_t index[256 * 64];     // pixel index in the frame, ascending
+  uint16_t position[256 * 64];  // position of the pixel color in the rotation
+  bool clearModified;  // modifiedelements needs a full reset on next rotation
+  uint8_t lastRotated;  // bitmask of the rotations applied at last rotation
+  Serum_Dirty_Rect bounds[MAX_COLOR_ROTATION_V2];  // bounding box per rotation
+};
+
+struct Serum_Context;
+
+// A load running on a worker thread, see Serum_LoadAsync(). The file is
+// loaded into a context of its own, which is adopted by the target context
+// once finished.
+struct AsyncLoad {
+  std::thread thread;
+  std::mutex mutex;
+  std::unique_ptr<Serum_Context> context;
+  // guarded by mutex
+  bool finished = false;
+  Serum_Frame_Struc* result = NULL;
+  // frame size, known as soon as the header of the file has been read
+  uint32_t width = 0, height = 0, nocolors = 0;
+};
+
+// Everything a loaded Serum needs at runtime: the crom data, the state of the
+// frame identification, colorization, rotations and scenes, and the options
+// set by the caller. Only the ROM data of a cROMc is shared between the
+// contexts which load the same file (see SerumData::LoadShared()). It isn't
+// modified once loaded, every state and option is kept per context, so
+// different contexts can be used from different threads at the same time.
+struct Serum_Context {
+  Serum_Context();
+  ~Serum_Context();
+
+  Serum_Frame_Struc* Load(const char* const altcolorpath,
+                          const char* const romname, uint8_t flags);
+  Serum_Frame_Struc* LoadAsync(const char* const altcolorpath,
+                               const char* const romname, uint8_t flags,
+                               Serum_LoadProgressCallback callback,
+                               const void* userData);
+  // Adopts the result of a finished asynchronous load, waits for it first if
+  // wait is set. Returns false if the load is still running.
+  bool FinishAsyncLoad(bool wait);
+  void Serum_free(void);
+  uint32_t Colorize(uint8_t* frame);
+  uint32_t Rotate(void);
+
+  // The loaded ROM data, read-only once loaded so it can be shared with other
+  // contexts which load the same cROMc
+  std::shared_ptr<SerumData> serumData;
+  SceneGenerator sceneGenerator;
+  // Triggers which have already been sent, by frame ID. The trigger IDs of the
+  // ROM data can't be cleared as they may be shared.
+  std::vector<bool> triggerCleared;
+  uint16_t sceneFrameCount = 0;
+  uint16_t sceneCurrentFrame = 0;
+  uint16_t sceneDurationPerFrame = 0;
+  bool sceneInterruptable = false;
+  bool sceneStartImmediately = false;
+  uint8_t sceneRepeatCount = 0;
+  uint8_t sceneEndFrame = 0;
+  uint8_t sceneFrame[192 * 64] = {0};
+  uint8_t lastFrame[192 * 64] = {0};
+  bool monochromeMode = false;
+  bool showStatusMessages = false;
+
+  // variables
+  bool cromloaded = false;  // is there a crom loaded?
+  bool generateCRomC = true;
+  // only look again for the sprite candidates in the rows which changed since
+  // the previous frame, see Serum_SetTemporalSpriteDetection()
+  bool temporalSpriteDetection = false;
+  uint32_t lastfound = 0;  // last frame ID identified
+  uint32_t lastframe_full_crc = 0;
+  uint32_t lastframe_found = GetMonotonicTimeMs();
+  uint32_t lasttriggerID = 0xffffffff;  // last trigger ID found
+  uint32_t lasttriggerTimestamp = 0;
+  // Usually the first frame has the ID 0, but lastfound is also initialized
+  // with 0. So we need a helper to be able to detect frame 0 as new.
+  bool first_match = true;
+  uint16_t ignoreUnknownFramesTimeout = 0;
+  uint8_t maxFramesToSkip = 0;
+  uint8_t framesSkippedCounter = 0;
+  uint8_t standardPalette[PALETTE_SIZE] = {0};
+  uint8_t standardPaletteLength = 0;
+  uint32_t colorshifts[MAX_COLOR_ROTATIONS] = {0};  // how many color we shifted
+  uint32_t colorshiftinittime[MAX_COLOR_ROTATIONS] = {
+      0};  // when was the tick for this
+  uint32_t colorshifts32[MAX_COLOR_ROTATION_V2] = {
+      0};  // how many color we shifted for extra res
+  uint32_t colorshiftinittime32[MAX_COLOR_ROTATION_V2] = {
+      0};  // when was the tick for this for extra res
+  uint32_t colorshifts64[MAX_COLOR_ROTATION_V2] = {
+      0};  // how many color we shifted for extra res
+  uint32_t colorshiftinittime64[MAX_COLOR_ROTATION_V2] = {
+      0};  // when was the tick for this for extra res
+  uint32_t colorrotseruminit = 0;  // initial time when all the rotations
+                                   // started
+  uint32_t colorrotnexttime[MAX_COLOR_ROTATIONS] = {
+      0};  // next time of the next rotation
+  uint32_t colorrotnexttime32[MAX_COLOR_ROTATION_V2] = {
+      0};  // next time of the next rotation
+  uint32_t colorrotnexttime64[MAX_COLOR_ROTATION_V2] = {
+      0};  // next time of the next rotation
+  bool enabled = true;  // is colorization enabled?
+
+  bool isoriginalrequested =
+      true;  // are the original resolution frames requested by the caller
+  bool isextrarequested =
+      false;  // are the extra resolution frames requested by the caller
+
+  Serum_Frame_Struc mySerum = {};  // structure to keep communicate
+                                   // colorization data
+
+  uint8_t* frameshape = NULL;  // memory for shape mode conversion of ythe frame
+  // (distance from lastfound, group index), reused by Identify_Frame()
+  std::vector<std::pair<uint32_t, uint32_t>> groupOrder;
+  // the frame converted for shapemode (every color > 0 becomes 1)
+  std::vector<uint8_t> shapeFrame;
+  // detection dwords found by FindSpriteCandidates(), as (slot << 48) |
+  // (area << 32) | (y << 16) | x, so sorting them gives the order in which
+  // the sprites and their detection areas are checked
+  std::vector<uint64_t> spriteCandidates;
+  // with temporalSpriteDetection, the frame spriteCandidates have been found
+  // in for the frame ID spriteScanFrameId, and its rows which are different
+  // from the current frame
+  std::vector<uint8_t> spriteScanFrame;
+  uint32_t spriteScanFrameId = 0xffffffff;
+  std::vector<uint8_t> spriteScanRows;
+
+  ColorRotationLookup
+      colorRotationLookup[2];  // for the original and the extra resolution
+  RotationPixels rotationPixels32, rotationPixels64;
+  // the frame ID of the v2 frame in the output buffers and its sprites, in
+  // the original resolution, for the dirty rectangles of the next frame.
+  // 0xffffffff once the whole frames have been written otherwise.
+  uint32_t dirtyRectsFrameId = 0xffffffff;
+  Serum_Dirty_Rect dirtySprites[MAX_SPRITES_PER_FRAME];
+  uint8_t ndirtySprites = 0;
+
+  // the load running on a worker thread, if any
+  std::shared_ptr<AsyncLoad> asyncLoad;
+  // called by Load() with the phase and its percentage done
+  std::function<void(uint8_t, uint8_t)> loadProgress;
+  // the cROMc being written in the background, if any
+  std::shared_ptr<std::thread> concentrateWriter;
+
+ private:
+  // The buffers of mySerum and frameshape are owned by the context
+  Serum_Context(const Serum_Context&) = delete;
+  Serum_Context& operator=(const Serum_Context&) = delete;
+  void CopyOptions(const Serum_Context& from);
+  // Takes over the loaded data and the runtime state of loaded, which is left
+  // empty. The options of this context are kept.
+  void AdoptLoad(Serum_Context& loaded);
+  void ReportLoadProgress(uint8_t phase, uint8_t percent) {
+    if (loadProgress) loadProgress(phase, percent);
+  }
+  uint32_t Colorize_WhileLoading(uint8_t* frame);
+  uint32_t Colorize_Monochrome(uint8_t* frame);
+  uint32_t calc_crc32(uint8_t* source, uint8_t mask, uint32_t n);
+  void Full_Reset_ColorRotations(void);
+  // Writes the cROMc next to filename in the background. If filename is the
+  // cROM or cRZ which has just been parsed with flags, it is recorded as the
+  // source of the cROMc, otherwise the source of the loaded cROMc is kept.
+  bool Serum_SaveConcentrate(const char* filename, bool parsed, uint8_t flags);
+  void WaitForConcentrate(void);
+  Serum_Frame_Struc* Serum_LoadConcentrate(const char* filename,
+                                           const uint8_t flags,
+                                           bool map = true);
+  Serum_Frame_Struc* Serum_LoadFilev2(CRomReader& reader, const uint8_t flags,
+                                      uint32_t sizeheader);
+  Serum_Frame_Struc* Serum_LoadFilev1(const char* const filename,
+                                      const uint8_t flags);
+  uint32_t GetTriggerID(uint32_t frameId);
+  uint32_t Identify_Frame(uint8_t* frame);
+  void FindSpriteCandidates(const uint8_t* Frame, uint32_t quelleframe,
+                            uint8_t shape, const uint8_t* rows = nullptr);
+  bool Check_Spritesv1(uint8_t* Frame, uint32_t quelleframe,
+                       uint8_t* pquelsprites, uint8_t* nspr, uint16_t* pfrx,
+                       uint16_t* pfry, uint16_t* pspx, uint16_t* pspy,
+                       uint16_t* pwid, uint16_t* phei);
+  bool Check_Spritesv2(uint8_t* recframe, uint32_t quelleframe,
+                       uint8_t* pquelsprites, uint8_t* nspr, uint16_t* pfrx,
+                       uint16_t* pfry, uint16_t* pspx, uint16_t* pspy,
+                       uint16_t* pwid, uint16_t* phei);
+  void Colorize_Framev1(uint8_t* frame, uint32_t IDfound);
+  bool CheckExtraFrameAvailable(uint32_t frID);
+  const ColorRotationLookup& GetColorRotationLookup(uint32_t IDfound,
+                                                    const uint16_t* pcol,
+                                                    bool isextra);
+  void Colorize_Framev2(uint8_t* frame, uint32_t IDfound);
+  void Colorize_Spritev1(uint8_t nosprite, uint16_t frx, uint16_t fry,
+                         uint16_t spx, uint16_t spy, uint16_t wid,
+                         uint16_t hei);
+  void Colorize_Spritev2(uint8_t* oframe, uint8_t nosprite, uint16_t frx,
+                         uint16_t fry, uint16_t spx, uint16_t spy,
+                         uint16_t wid, uint16_t hei, uint32_t IDfound);
+  void Copy_Frame_Palette(uint32_t nofr);
+  uint32_t Calc_Next_Rotationv1(uint32_t now);
+  uint32_t Serum_ColorizeWithMetadatav1(uint8_t* frame);
+  uint32_t Calc_Next_Rotationv2(uint32_t now);
+  void Build_RotationPixelLists(void);
+  void Set_FullFrameDirtyRects(void);
+  void Set_FrameDirtyRects(uint32_t IDfound, uint8_t nspr, const uint16_t* frx,
+                           const uint16_t* fry, const uint16_t* wid,
+                           const uint16_t* hei);
+  uint32_t Serum_ApplyRotationsv1(void);
+  uint32_t Serum_ApplyRotationsv2(void);
+
+ public:
+  uint32_t Serum_ColorizeWithMetadatav2(uint8_t* frame,
+                                        bool sceneFrameRequested = false);
+};
+
+// The context used by the single instance API (Serum_Load(), Serum_Colorize()
+// ...)
+static Serum_Context g_defaultContext;
 
 SERUM_API void Serum_SetLogCallback(Serum_LogCallback callback,
                                     const void* userData) {
-  g_serumData.SetLogCallback(callback, userData);
+  // loaded data might be shared with other contexts or be read by the cROMc
+  // writer, it keeps the callback it has been loaded with
+  if (!g_defaultContext.cromloaded)
+    g_defaultContext.serumData->SetLogCallback(callback, userData);
+  g_defaultContext.sceneGenerator.SetLogCallback(callback, userData);
   logCallback = callback;
   logUserData = userData;
 }
@@ -186,19 +344,18 @@ bool is_real_machine() { return false; }
 // As a simpliefied approach, we assume that a Raspberry Pi running Linux is
 // used to handle Serum on a real pinball machine. If there is other hardware,
 // it needs to be added here.
-bool is_real_machine() {
-  static std::optional<bool> cached;
-  if (cached.has_value()) return *cached;
-
+static bool detect_real_machine() {
   std::ifstream model_file("/proc/device-tree/model");
-  if (model_file.is_open()) {
-    std::string model;
-    std::getline(model_file, model);
-    cached = (model.find("Raspberry") != std::string::npos);
-  } else {
-    cached = false;
-  }
-  return *cached;
+  if (!model_file.is_open()) return false;
+  std::string model;
+  std::getline(model_file, model);
+  return (model.find("Raspberry") != std::string::npos);
+}
+
+bool is_real_machine() {
+  // initialized once, even if several contexts are used on different threads
+  static const bool cached = detect_real_machine();
+  return cached;
 }
 #endif
 
@@ -243,11 +400,64 @@ void Free_element(void** ppElement) {
   }
 }
 
-void Serum_free(void) {
-  // Free the memory for a full Serum whatever the format version
-  g_serumData.Clear();
+void Build_RotationPixels(RotationPixels& rp, const uint16_t* prot,
+                          uint32_t width, uint32_t height) {
+  const uint32_t sizeframe = width * height;
+  // counting sort of the pixels by rotation, keeping them in ascending order
+  uint32_t count[MAX_COLOR_ROTATION_V2] = {0};
+  if (prot) {
+    for (uint32_t tj = 0; tj < sizeframe; tj++) {
+      uint16_t norot = prot[tj * 2];
+      if (norot < MAX_COLOR_ROTATION_V2) count[norot]++;
+    }
+  }
+  rp.start[0] = 0;
+  for (uint32_t ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++)
+    rp.start[ti + 1] = rp.start[ti] + count[ti];
+  uint16_t minx[MAX_COLOR_ROTATION_V2], miny[MAX_COLOR_ROTATION_V2];
+  uint16_t maxx[MAX_COLOR_ROTATION_V2] = {0}, maxy[MAX_COLOR_ROTATION_V2] = {0};
+  for (uint32_t ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++)
+    minx[ti] = miny[ti] = 0xffff;
+  if (prot) {
+    uint32_t next[MAX_COLOR_ROTATION_V2];
+    memcpy(next, rp.start, sizeof(next));
+    uint32_t tj = 0;
+    for (uint16_t y = 0; y < height; y++) {
+      for (uint16_t x = 0; x < width; x++, tj++) {
+        uint16_t norot = prot[tj * 2];
+        if (norot < MAX_COLOR_ROTATION_V2) {
+          rp.index[next[norot]] = (uint16_t)tj;
+          rp.position[next[norot]++] = prot[tj * 2 + 1];
+          if (x < minx[norot]) minx[norot] = x;
+          if (x > maxx[norot]) maxx[norot] = x;
+          if (y < miny[norot]) miny[norot] = y;
+          maxy[norot] = y;
+        }
+      }
+    }
+  }
+  for (uint32_t ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
+    if (count[ti] == 0) {
+      rp.bounds[ti] = {0, 0, 0, 0};
+      continue;
+    }
+    rp.bounds[ti] = {minx[ti], miny[ti], (uint16_t)(maxx[ti] - minx[ti] + 1),
+                     (uint16_t)(maxy[ti] - miny[ti] + 1)};
+  }
+  rp.clearModified = true;
+  rp.lastRotated = 0;
+}
+
+void Serum_Context::Serum_free(void) {
+  if (asyncLoad) FinishAsyncLoad(true);
+  WaitForConcentrate();
+
+  // Free the memory for a full Serum whatever the format version. The ROM data
+  // is only released once no other context shares it anymore.
+  serumData = std::make_shared<SerumData>();
+  serumData->SetLogCallback(logCallback, logUserData);
+  triggerCleared.clear();
 
-  Free_element((void**)&framechecked);
   Free_element((void**)&mySerum.frame);
   Free_element((void**)&mySerum.frame32);
   Free_element((void**)&mySerum.frame64);
@@ -259,136 +469,61 @@ void Serum_free(void) {
   Free_element((void**)&mySerum.rotationsinframe64);
   Free_element((void**)&mySerum.modifiedelements32);
   Free_element((void**)&mySerum.modifiedelements64);
+  Free_element((void**)&mySerum.dirtyrects32);
+  Free_element((void**)&mySerum.dirtyrects64);
+  mySerum.ndirtyrects32 = mySerum.ndirtyrects64 = 0;
   Free_element((void**)&frameshape);
+  spriteScanFrameId = 0xffffffff;
+  colorRotationLookup[0].frameId = colorRotationLookup[1].frameId = 0xffffffff;
+  dirtyRectsFrameId = 0xffffffff;
+  Build_RotationPixels(rotationPixels32, NULL, 0, 0);
+  Build_RotationPixels(rotationPixels64, NULL, 0, 0);
   cromloaded = false;
 
-  g_serumData.sceneGenerator->Reset();
+  sceneGenerator.Reset();
 }
 
+Serum_Context::Serum_Context() {
+  serumData = std::make_shared<SerumData>();
+  serumData->SetLogCallback(logCallback, logUserData);
+  sceneGenerator.SetLogCallback(logCallback, logUserData);
+  Build_RotationPixels(rotationPixels32, NULL, 0, 0);
+  Build_RotationPixels(rotationPixels64, NULL, 0, 0);
+}
+
+Serum_Context::~Serum_Context() { Serum_free(); }
+
 SERUM_API const char* Serum_GetVersion() { return SERUM_VERSION; }
 
 SERUM_API const char* Serum_GetMinorVersion() { return SERUM_MINOR_VERSION; }
 
-void CRC32encode(void)  // initiating the CRC table, must be called at startup
-{
-  for (int i = 0; i < 256; i++) {
-    uint32_t ch = i;
-    uint32_t crc = 0;
-    for (int j = 0; j < 8; j++) {
-      uint32_t b = (ch ^ crc) & 1;
-      crc >>= 1;
-      if (b != 0) crc = crc ^ 0xEDB88320;
-      ch >>= 1;
-    }
-    crc32_table[i] = crc;
-  }
-  crc32_ready = true;
-}
-
 uint32_t crc32_fast(uint8_t* s, uint32_t n)
-// computing a buffer CRC32, "CRC32encode()" must have been called before the
-// first use version with no mask nor shapemode
+// computing a buffer CRC32
+// version with no mask nor shapemode
 {
-  uint32_t crc = 0xffffffff;
-  for (int i = 0; i < (int)n; i++)
-    crc = (crc >> 8) ^ crc32_table[(s[i] ^ crc) & 0xFF];
-  return ~crc;
+  return ~crc32_update(0xffffffff, s, n);
 }
 
-uint32_t crc32_fast_shape(uint8_t* s, uint32_t n)
-// computing a buffer CRC32, "CRC32encode()" must have been called before the
-// first use version with shapemode and no mask
+uint32_t crc32_fast_runs(const uint8_t* s,
+                         const std::vector<SerumData::MaskRun>& runs)
+// computing a buffer CRC32 on the non-masked area, given as the list of the
+// unmasked runs of a comparison mask
 {
   uint32_t crc = 0xffffffff;
-  for (int i = 0; i < (int)n; i++) {
-    uint8_t val = s[i];
-    if (val > 1) val = 1;
-    crc = (crc >> 8) ^ crc32_table[(val ^ crc) & 0xFF];
-  }
+  for (const auto& run : runs)
+    crc = crc32_update(crc, s + run.start, run.length);
   return ~crc;
 }
 
-uint32_t crc32_fast_mask(uint8_t* source, uint8_t* mask, uint32_t n)
-// computing a buffer CRC32 on the non-masked area, "CRC32encode()" must have
-// been called before the first use version with a mask and no shape mode
-{
-  uint32_t crc = 0xffffffff;
-  for (uint32_t i = 0; i < n; i++) {
-    if (mask[i] == 0) crc = (crc >> 8) ^ crc32_table[(source[i] ^ crc) & 0xFF];
-  }
-  return ~crc;
-}
-
-uint32_t crc32_fast_mask_shape(uint8_t* source, uint8_t* mask, uint32_t n)
-// computing a buffer CRC32 on the non-masked area, "CRC32encode()" must have
-// been called before the first use version with a mask and shape mode
-{
-  uint32_t crc = 0xffffffff;
-  for (uint32_t i = 0; i < n; i++) {
-    if (mask[i] == 0) {
-      uint8_t val = source[i];
-      if (val > 1) val = 1;
-      crc = (crc >> 8) ^ crc32_table[(val ^ crc) & 0xFF];
-    }
-  }
-  return ~crc;
-}
-
-uint32_t calc_crc32(uint8_t* source, uint8_t mask, uint32_t n, uint8_t Shape) {
-  const uint32_t pixels = g_serumData.is256x64
-                              ? (256 * 64)
-                              : (g_serumData.fwidth * g_serumData.fheight);
-  if (mask < 255) {
-    uint8_t* pmask = g_serumData.compmasks[mask];
-    if (Shape == 1)
-      return crc32_fast_mask_shape(source, pmask, pixels);
-    else
-      return crc32_fast_mask(source, pmask, pixels);
-  } else if (Shape == 1)
-    return crc32_fast_shape(source, pixels);
-  return crc32_fast(source, pixels);
+uint32_t Serum_Context::calc_crc32(uint8_t* source, uint8_t mask,
+                                   uint32_t n) {
+  // source is expected to be converted already if shapemode is used
+  if (mask < 255 && mask < serumData->compmaskRuns.size())
+    return crc32_fast_runs(source, serumData->compmaskRuns[mask]);
+  return crc32_fast(source, n);
 }
 
-bool unzip_crz(const char* const filename, const char* const extractpath,
-               char* cromname, int cromsize) {
-  bool ok = true;
-  mz_zip_archive zip_archive = {0};
-
-  if (!mz_zip_reader_init_file(&zip_archive, filename, 0)) {
-    return false;
-  }
-
-  int num_files = mz_zip_reader_get_num_files(&zip_archive);
-
-  if (num_files == 0 ||
-      !mz_zip_reader_get_filename(&zip_archive, 0, cromname, cromsize)) {
-    mz_zip_reader_end(&zip_archive);
-    return false;
-  }
-
-  for (int i = 0; i < num_files; i++) {
-    mz_zip_archive_file_stat file_stat;
-    if (!mz_zip_reader_file_stat(&zip_archive, i, &file_stat)) continue;
-
-    char dstPath[pathbuflen];
-    if (strcpy_s(dstPath, pathbuflen, extractpath)) goto fail;
-    if (strcat_s(dstPath, pathbuflen, file_stat.m_filename)) goto fail;
-
-    mz_zip_reader_extract_file_to_file(&zip_archive, file_stat.m_filename,
-                                       dstPath, 0);
-  }
-
-  goto nofail;
-fail:
-  ok = false;
-nofail:
-
-  mz_zip_reader_end(&zip_archive);
-
-  return ok;
-}
-
-void Full_Reset_ColorRotations(void) {
+void Serum_Context::Full_Reset_ColorRotations(void) {
   memset(colorshifts, 0, MAX_COLOR_ROTATIONS * sizeof(uint32_t));
   colorrotseruminit = GetMonotonicTimeMs();
   for (int ti = 0; ti < MAX_COLOR_ROTATIONS; ti++)
@@ -413,8 +548,10 @@ uint32_t min(uint32_t v1, uint32_t v2) {
 
 long serum_file_length;
 
-bool Serum_SaveConcentrate(const char* filename) {
+bool Serum_Context::Serum_SaveConcentrate(const char* filename, bool parsed,
+                                          uint8_t flags) {
   if (!cromloaded || is_real_machine()) return false;
+  ReportLoadProgress(SERUM_LOAD_SAVE, 0);
 
   std::string concentratePath;
 
@@ -425,22 +562,54 @@ bool Serum_SaveConcentrate(const char* filename) {
 
   concentratePath += ".cROMc";
 
-  return g_serumData.SaveToFile(concentratePath.c_str());
+  // The loaded data doesn't change anymore, so the file is written from it
+  // in the background and the load doesn't have to wait for it. Only the
+  // scenes are copied, they might be changed by the next load.
+  WaitForConcentrate();
+  std::shared_ptr<SerumData> data = serumData;
+  std::vector<SceneData> scenes = sceneGenerator.getSceneData();
+  std::string sourcefile = parsed ? filename : "";
+  const uint8_t resolutions =
+      flags & (FLAG_REQUEST_32P_FRAMES | FLAG_REQUEST_64P_FRAMES);
+  auto save = [data, scenes = std::move(scenes), concentratePath, sourcefile,
+               resolutions]() {
+    SerumData::SourceInfo source = data->source;
+    if (!sourcefile.empty()) {
+      // hashing the source is left to the background as well
+      if (!SerumData::ReadSourceInfo(sourcefile.c_str(), source))
+        source = SerumData::SourceInfo();
+      source.resolutions = resolutions;
+    }
+    return data->SaveToFile(concentratePath.c_str(), scenes, source);
+  };
+  try {
+    concentrateWriter = std::make_shared<std::thread>(save);
+  } catch (...) {
+    return save();
+  }
+  return true;
 }
 
-Serum_Frame_Struc* Serum_LoadConcentrate(const char* filename,
-                                         const uint8_t flags) {
-  if (!crc32_ready) CRC32encode();
-
-  if (!g_serumData.LoadFromFile(filename, flags)) return NULL;
+void Serum_Context::WaitForConcentrate(void) {
+  if (!concentrateWriter) return;
+  concentrateWriter->join();
+  concentrateWriter.reset();
+}
 
-  FILE* pfile = fopen(filename, "rb");
-  if (!pfile) return NULL;
+Serum_Frame_Struc* Serum_Context::Serum_LoadConcentrate(const char* filename,
+                                                        const uint8_t flags,
+                                                        bool map) {
+  std::shared_ptr<SerumData> data =
+      SerumData::LoadShared(filename, flags, logCallback, logUserData, map);
+  if (!data) return NULL;
+  serumData = data;
+  sceneGenerator.setSceneData(serumData->sceneData);
+  sceneGenerator.setDepth(serumData->nocolors == 16 ? 4 : 2);
 
   // Update mySerum structure
-  mySerum.SerumVersion = g_serumData.SerumVersion;
+  mySerum.SerumVersion = serumData->SerumVersion;
   mySerum.flags = flags;
-  mySerum.nocolors = g_serumData.nocolors;
+  mySerum.nocolors = serumData->nocolors;
 
   // Set requested frame types
   isoriginalrequested = false;
@@ -448,100 +617,97 @@ Serum_Frame_Struc* Serum_LoadConcentrate(const char* filename,
   mySerum.width32 = 0;
   mySerum.width64 = 0;
 
-  if (SERUM_V2 == g_serumData.SerumVersion) {
-    if (g_serumData.fheight == 32) {
+  if (SERUM_V2 == serumData->SerumVersion) {
+    if (serumData->fheight == 32) {
       if (flags & FLAG_REQUEST_32P_FRAMES) {
         isoriginalrequested = true;
-        mySerum.width32 = g_serumData.fwidth;
+        mySerum.width32 = serumData->fwidth;
       }
       if (flags & FLAG_REQUEST_64P_FRAMES) {
         isextrarequested = true;
-        mySerum.width64 = g_serumData.fwidth_extra;
+        mySerum.width64 = serumData->fwidth_extra;
       }
     } else {
       if (flags & FLAG_REQUEST_64P_FRAMES) {
         isoriginalrequested = true;
-        mySerum.width64 = g_serumData.fwidth;
+        mySerum.width64 = serumData->fwidth;
       }
       if (flags & FLAG_REQUEST_32P_FRAMES) {
         isextrarequested = true;
-        mySerum.width32 = g_serumData.fwidth_extra;
+        mySerum.width32 = serumData->fwidth_extra;
       }
     }
 
     if (flags & FLAG_REQUEST_32P_FRAMES) {
       mySerum.frame32 =
-          (uint16_t*)malloc(32 * g_serumData.fwidth * sizeof(uint16_t));
+          (uint16_t*)malloc(32 * serumData->fwidth * sizeof(uint16_t));
       mySerum.rotations32 = (uint16_t*)malloc(
           MAX_COLOR_ROTATION_V2 * MAX_LENGTH_COLOR_ROTATION * sizeof(uint16_t));
       mySerum.rotationsinframe32 =
-          (uint16_t*)malloc(2 * 32 * g_serumData.fwidth * sizeof(uint16_t));
+          (uint16_t*)malloc(2 * 32 * serumData->fwidth * sizeof(uint16_t));
       if (flags & FLAG_REQUEST_FILL_MODIFIED_ELEMENTS)
-        mySerum.modifiedelements32 = (uint8_t*)malloc(32 * g_serumData.fwidth);
+        mySerum.modifiedelements32 = (uint8_t*)malloc(32 * serumData->fwidth);
+      if (flags & FLAG_REQUEST_DIRTY_RECTS)
+        mySerum.dirtyrects32 = (Serum_Dirty_Rect*)malloc(
+            MAX_DIRTY_RECTS * sizeof(Serum_Dirty_Rect));
     }
 
     if (flags & FLAG_REQUEST_64P_FRAMES) {
       mySerum.frame64 =
-          (uint16_t*)malloc(64 * g_serumData.fwidth_extra * sizeof(uint16_t));
+          (uint16_t*)malloc(64 * serumData->fwidth_extra * sizeof(uint16_t));
       mySerum.rotations64 = (uint16_t*)malloc(
           MAX_COLOR_ROTATION_V2 * MAX_LENGTH_COLOR_ROTATION * sizeof(uint16_t));
       mySerum.rotationsinframe64 = (uint16_t*)malloc(
-          2 * 64 * g_serumData.fwidth_extra * sizeof(uint16_t));
+          2 * 64 * serumData->fwidth_extra * sizeof(uint16_t));
       if (flags & FLAG_REQUEST_FILL_MODIFIED_ELEMENTS)
         mySerum.modifiedelements64 =
-            (uint8_t*)malloc(64 * g_serumData.fwidth_extra);
+            (uint8_t*)malloc(64 * serumData->fwidth_extra);
+      if (flags & FLAG_REQUEST_DIRTY_RECTS)
+        mySerum.dirtyrects64 = (Serum_Dirty_Rect*)malloc(
+            MAX_DIRTY_RECTS * sizeof(Serum_Dirty_Rect));
     }
 
     if (isextrarequested) {
-      for (uint32_t ti = 0; ti < g_serumData.nframes; ti++) {
-        if (g_serumData.isextraframe[ti][0] > 0) {
+      for (uint32_t ti = 0; ti < serumData->nframes; ti++) {
+        if (serumData->isextraframe[ti][0] > 0) {
           mySerum.flags |= FLAG_RETURNED_EXTRA_AVAILABLE;
           break;
         }
       }
     }
 
-    frameshape = (uint8_t*)malloc(g_serumData.fwidth * g_serumData.fheight);
+    frameshape = (uint8_t*)malloc(serumData->fwidth * serumData->fheight);
     if (!frameshape) {
       Serum_free();
       enabled = false;
       return NULL;
     }
-  } else if (SERUM_V1 == g_serumData.SerumVersion) {
-    if (g_serumData.fheight == 64) {
-      mySerum.width64 = g_serumData.fwidth;
+  } else if (SERUM_V1 == serumData->SerumVersion) {
+    if (serumData->fheight == 64) {
+      mySerum.width64 = serumData->fwidth;
       mySerum.width32 = 0;
     } else {
-      mySerum.width32 = g_serumData.fwidth;
+      mySerum.width32 = serumData->fwidth;
       mySerum.width64 = 0;
     }
 
-    mySerum.frame = (uint8_t*)malloc(g_serumData.fwidth * g_serumData.fheight);
+    mySerum.frame = (uint8_t*)malloc(serumData->fwidth * serumData->fheight);
     mySerum.palette = (uint8_t*)malloc(3 * 64);
     mySerum.rotations = (uint8_t*)malloc(MAX_COLOR_ROTATIONS * 3);
     if (!mySerum.frame || !mySerum.palette || !mySerum.rotations) {
       Serum_free();
-      fclose(pfile);
       enabled = false;
       return NULL;
     }
   }
 
   mySerum.ntriggers = 0;
-  for (uint32_t ti = 0; ti < g_serumData.nframes; ti++) {
-    if (g_serumData.triggerIDs[ti][0] != 0xffffffff) {
+  for (uint32_t ti = 0; ti < serumData->nframes; ti++) {
+    if (serumData->triggerIDs[ti][0] != 0xffffffff) {
       mySerum.ntriggers++;
     }
   }
 
-  // Allocate framechecked array
-  framechecked = (bool*)malloc(sizeof(bool) * g_serumData.nframes);
-  if (!framechecked) {
-    Serum_free();
-    enabled = false;
-    return NULL;
-  }
-
   Full_Reset_ColorRotations();
   cromloaded = true;
   enabled = true;
@@ -549,58 +715,57 @@ Serum_Frame_Struc* Serum_LoadConcentrate(const char* filename,
   return &mySerum;
 }
 
-Serum_Frame_Struc* Serum_LoadFilev2(FILE* pfile, const uint8_t flags,
-                                    bool uncompressedCROM, char* pathbuf,
-                                    uint32_t sizeheader) {
-  fread(&g_serumData.fwidth, 4, 1, pfile);
-  fread(&g_serumData.fheight, 4, 1, pfile);
-  fread(&g_serumData.fwidth_extra, 4, 1, pfile);
-  fread(&g_serumData.fheight_extra, 4, 1, pfile);
+Serum_Frame_Struc* Serum_Context::Serum_LoadFilev2(CRomReader& reader,
+                                                   const uint8_t flags,
+                                                   uint32_t sizeheader) {
+  reader.readValue(serumData->fwidth);
+  reader.readValue(serumData->fheight);
+  reader.readValue(serumData->fwidth_extra);
+  reader.readValue(serumData->fheight_extra);
   isoriginalrequested = false;
   isextrarequested = false;
   mySerum.width32 = 0;
   mySerum.width64 = 0;
-  if (g_serumData.fheight == 32) {
+  if (serumData->fheight == 32) {
     if (flags & FLAG_REQUEST_32P_FRAMES) {
       isoriginalrequested = true;
-      mySerum.width32 = g_serumData.fwidth;
+      mySerum.width32 = serumData->fwidth;
     }
     if (flags & FLAG_REQUEST_64P_FRAMES) {
       isextrarequested = true;
-      mySerum.width64 = g_serumData.fwidth_extra;
+      mySerum.width64 = serumData->fwidth_extra;
     }
 
   } else {
     if (flags & FLAG_REQUEST_64P_FRAMES) {
       isoriginalrequested = true;
-      mySerum.width64 = g_serumData.fwidth;
+      mySerum.width64 = serumData->fwidth;
     }
     if (flags & FLAG_REQUEST_32P_FRAMES) {
       isextrarequested = true;
-      mySerum.width32 = g_serumData.fwidth_extra;
+      mySerum.width32 = serumData->fwidth_extra;
     }
   }
-  fread(&g_serumData.nframes, 4, 1, pfile);
-  fread(&g_serumData.nocolors, 4, 1, pfile);
-  mySerum.nocolors = g_serumData.nocolors;
-  if ((g_serumData.fwidth == 0) || (g_serumData.fheight == 0) ||
-      (g_serumData.nframes == 0) || (g_serumData.nocolors == 0)) {
+  reader.readValue(serumData->nframes);
+  reader.readValue(serumData->nocolors);
+  mySerum.nocolors = serumData->nocolors;
+  if (reader.failed() || (serumData->fwidth == 0) ||
+      (serumData->fheight == 0) || (serumData->nframes == 0) ||
+      (serumData->nocolors == 0)) {
     // incorrect file format
-    fclose(pfile);
     enabled = false;
     return NULL;
   }
-  fread(&g_serumData.ncompmasks, 4, 1, pfile);
-  fread(&g_serumData.nsprites, 4, 1, pfile);
-  fread(&g_serumData.nbackgrounds, 2, 1,
-        pfile);  // g_serumData.nbackgrounds is a uint16_t
+  reader.readValue(serumData->ncompmasks);
+  reader.readValue(serumData->nsprites);
+  reader.readValue(serumData->nbackgrounds);
   if (sizeheader >= 20 * sizeof(uint32_t)) {
     int is256x64;
-    fread(&is256x64, sizeof(int), 1, pfile);
-    g_serumData.is256x64 = (is256x64 != 0);
+    reader.readValue(is256x64);
+    serumData->is256x64 = (is256x64 != 0);
   }
 
-  frameshape = (uint8_t*)malloc(g_serumData.fwidth * g_serumData.fheight);
+  frameshape = (uint8_t*)malloc(serumData->fwidth * serumData->fheight);
 
   if (flags & FLAG_REQUEST_32P_FRAMES) {
     mySerum.frame32 =
@@ -611,12 +776,15 @@ Serum_Frame_Struc* Serum_LoadFilev2(FILE* pfile, const uint8_t flags,
         (uint16_t*)malloc(2 * 32 * mySerum.width32 * sizeof(uint16_t));
     if (flags & FLAG_REQUEST_FILL_MODIFIED_ELEMENTS)
       mySerum.modifiedelements32 = (uint8_t*)malloc(32 * mySerum.width32);
+    if (flags & FLAG_REQUEST_DIRTY_RECTS)
+      mySerum.dirtyrects32 = (Serum_Dirty_Rect*)malloc(
+          MAX_DIRTY_RECTS * sizeof(Serum_Dirty_Rect));
     if (!mySerum.frame32 || !mySerum.rotations32 ||
         !mySerum.rotationsinframe32 ||
         (flags & FLAG_REQUEST_FILL_MODIFIED_ELEMENTS &&
-         !mySerum.modifiedelements32)) {
+         !mySerum.modifiedelements32) ||
+        (flags & FLAG_REQUEST_DIRTY_RECTS && !mySerum.dirtyrects32)) {
       Serum_free();
-      fclose(pfile);
       enabled = false;
       return NULL;
     }
@@ -630,177 +798,185 @@ Serum_Frame_Struc* Serum_LoadFilev2(FILE* pfile, const uint8_t flags,
         (uint16_t*)malloc(2 * 64 * mySerum.width64 * sizeof(uint16_t));
     if (flags & FLAG_REQUEST_FILL_MODIFIED_ELEMENTS)
       mySerum.modifiedelements64 = (uint8_t*)malloc(64 * mySerum.width64);
+    if (flags & FLAG_REQUEST_DIRTY_RECTS)
+      mySerum.dirtyrects64 = (Serum_Dirty_Rect*)malloc(
+          MAX_DIRTY_RECTS * sizeof(Serum_Dirty_Rect));
     if (!mySerum.frame64 || !mySerum.rotations64 ||
         !mySerum.rotationsinframe64 ||
         (flags & FLAG_REQUEST_FILL_MODIFIED_ELEMENTS &&
-         !mySerum.modifiedelements64)) {
+         !mySerum.modifiedelements64) ||
+        (flags & FLAG_REQUEST_DIRTY_RECTS && !mySerum.dirtyrects64)) {
       Serum_free();
-      fclose(pfile);
       enabled = false;
       return NULL;
     }
   }
 
-  g_serumData.hashcodes.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.shapecompmode.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.compmaskID.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.compmasks.readFromCRomFile(
-      g_serumData.is256x64 ? (256 * 64)
-                           : (g_serumData.fwidth * g_serumData.fheight),
-      g_serumData.ncompmasks, pfile);
-  g_serumData.isextraframe.readFromCRomFile(1, g_serumData.nframes, pfile);
+  serumData->hashcodes.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->shapecompmode.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->compmaskID.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->compmasks.readFromCRomFile(
+      serumData->is256x64 ? (256 * 64)
+                           : (serumData->fwidth * serumData->fheight),
+      serumData->ncompmasks, reader);
+  serumData->isextraframe.readFromCRomFile(1, serumData->nframes, reader);
   if (isextrarequested) {
-    for (uint32_t ti = 0; ti < g_serumData.nframes; ti++) {
-      if (g_serumData.isextraframe[ti][0] > 0) {
+    for (uint32_t ti = 0; ti < serumData->nframes; ti++) {
+      if (serumData->isextraframe[ti][0] > 0) {
         mySerum.flags |= FLAG_RETURNED_EXTRA_AVAILABLE;
         break;
       }
     }
   } else
-    g_serumData.isextraframe.clearIndex();
-  g_serumData.cframes_v2.readFromCRomFile(
-      g_serumData.fwidth * g_serumData.fheight, g_serumData.nframes, pfile);
-  g_serumData.cframes_v2_extra.readFromCRomFile(
-      g_serumData.fwidth_extra * g_serumData.fheight_extra, g_serumData.nframes,
-      pfile, &g_serumData.isextraframe);
-  g_serumData.dynamasks.readFromCRomFile(
-      g_serumData.fwidth * g_serumData.fheight, g_serumData.nframes, pfile);
-  g_serumData.dynamasks_extra.readFromCRomFile(
-      g_serumData.fwidth_extra * g_serumData.fheight_extra, g_serumData.nframes,
-      pfile, &g_serumData.isextraframe);
-  g_serumData.dyna4cols_v2.readFromCRomFile(
-      MAX_DYNA_SETS_PER_FRAME_V2 * g_serumData.nocolors, g_serumData.nframes,
-      pfile);
-  g_serumData.dyna4cols_v2_extra.readFromCRomFile(
-      MAX_DYNA_SETS_PER_FRAME_V2 * g_serumData.nocolors, g_serumData.nframes,
-      pfile, &g_serumData.isextraframe);
-  g_serumData.isextrasprite.readFromCRomFile(1, g_serumData.nsprites, pfile);
-  if (!isextrarequested) g_serumData.isextrasprite.clearIndex();
-  g_serumData.framesprites.readFromCRomFile(MAX_SPRITES_PER_FRAME,
-                                            g_serumData.nframes, pfile);
-  g_serumData.spriteoriginal.readFromCRomFile(
-      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, g_serumData.nsprites, pfile);
-  g_serumData.spritecolored.readFromCRomFile(
-      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, g_serumData.nsprites, pfile);
-  g_serumData.spritemask_extra.readFromCRomFile(
-      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, g_serumData.nsprites, pfile,
-      &g_serumData.isextrasprite);
-  g_serumData.spritecolored_extra.readFromCRomFile(
-      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, g_serumData.nsprites, pfile,
-      &g_serumData.isextrasprite);
-  g_serumData.activeframes.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.colorrotations_v2.readFromCRomFile(
-      MAX_LENGTH_COLOR_ROTATION * MAX_COLOR_ROTATION_V2, g_serumData.nframes,
-      pfile);
-  g_serumData.colorrotations_v2_extra.readFromCRomFile(
-      MAX_LENGTH_COLOR_ROTATION * MAX_COLOR_ROTATION_V2, g_serumData.nframes,
-      pfile, &g_serumData.isextraframe);
-  g_serumData.spritedetdwords.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
-                                               g_serumData.nsprites, pfile);
-  g_serumData.spritedetdwordpos.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
-                                                 g_serumData.nsprites, pfile);
-  g_serumData.spritedetareas.readFromCRomFile(4 * MAX_SPRITE_DETECT_AREAS,
-                                              g_serumData.nsprites, pfile);
-  g_serumData.triggerIDs.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.framespriteBB.readFromCRomFile(MAX_SPRITES_PER_FRAME * 4,
-                                             g_serumData.nframes, pfile,
-                                             &g_serumData.framesprites);
-  g_serumData.isextrabackground.readFromCRomFile(1, g_serumData.nbackgrounds,
-                                                 pfile);
-  if (!isextrarequested) g_serumData.isextrabackground.clearIndex();
-  g_serumData.backgroundframes_v2.readFromCRomFile(
-      g_serumData.fwidth * g_serumData.fheight, g_serumData.nbackgrounds,
-      pfile);
-  g_serumData.backgroundframes_v2_extra.readFromCRomFile(
-      g_serumData.fwidth_extra * g_serumData.fheight_extra,
-      g_serumData.nbackgrounds, pfile, &g_serumData.isextrabackground);
-  g_serumData.backgroundIDs.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.backgroundmask.readFromCRomFile(
-      g_serumData.fwidth * g_serumData.fheight, g_serumData.nframes, pfile,
-      &g_serumData.backgroundIDs);
-  g_serumData.backgroundmask_extra.readFromCRomFile(
-      g_serumData.fwidth_extra * g_serumData.fheight_extra, g_serumData.nframes,
-      pfile, &g_serumData.backgroundIDs);
+    serumData->isextraframe.clearIndex();
+  serumData->cframes_v2.readFromCRomFile(
+      serumData->fwidth * serumData->fheight, serumData->nframes, reader);
+  serumData->cframes_v2_extra.readFromCRomFile(
+      serumData->fwidth_extra * serumData->fheight_extra, serumData->nframes,
+      reader, &serumData->isextraframe);
+  serumData->dynamasks.readFromCRomFile(
+      serumData->fwidth * serumData->fheight, serumData->nframes, reader);
+  serumData->dynamasks_extra.readFromCRomFile(
+      serumData->fwidth_extra * serumData->fheight_extra, serumData->nframes,
+      reader, &serumData->isextraframe);
+  serumData->dyna4cols_v2.readFromCRomFile(
+      MAX_DYNA_SETS_PER_FRAME_V2 * serumData->nocolors, serumData->nframes,
+      reader);
+  serumData->dyna4cols_v2_extra.readFromCRomFile(
+      MAX_DYNA_SETS_PER_FRAME_V2 * serumData->nocolors, serumData->nframes,
+      reader, &serumData->isextraframe);
+  serumData->isextrasprite.readFromCRomFile(1, serumData->nsprites, reader);
+  if (!isextrarequested) serumData->isextrasprite.clearIndex();
+  serumData->framesprites.readFromCRomFile(MAX_SPRITES_PER_FRAME,
+                                            serumData->nframes, reader);
+  serumData->spriteoriginal.readFromCRomFile(
+      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, serumData->nsprites, reader);
+  serumData->spritecolored.readFromCRomFile(
+      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, serumData->nsprites, reader);
+  serumData->spritemask_extra.readFromCRomFile(
+      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, serumData->nsprites, reader,
+      &serumData->isextrasprite);
+  serumData->spritecolored_extra.readFromCRomFile(
+      MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, serumData->nsprites, reader,
+      &serumData->isextrasprite);
+  serumData->activeframes.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->colorrotations_v2.readFromCRomFile(
+      MAX_LENGTH_COLOR_ROTATION * MAX_COLOR_ROTATION_V2, serumData->nframes,
+      reader);
+  serumData->colorrotations_v2_extra.readFromCRomFile(
+      MAX_LENGTH_COLOR_ROTATION * MAX_COLOR_ROTATION_V2, serumData->nframes,
+      reader, &serumData->isextraframe);
+  serumData->spritedetdwords.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
+                                               serumData->nsprites, reader);
+  serumData->spritedetdwordpos.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
+                                                 serumData->nsprites, reader);
+  serumData->spritedetareas.readFromCRomFile(4 * MAX_SPRITE_DETECT_AREAS,
+                                              serumData->nsprites, reader);
+  serumData->triggerIDs.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->framespriteBB.readFromCRomFile(MAX_SPRITES_PER_FRAME * 4,
+                                             serumData->nframes, reader,
+                                             &serumData->framesprites);
+  serumData->isextrabackground.readFromCRomFile(1, serumData->nbackgrounds,
+                                                 reader);
+  if (!isextrarequested) serumData->isextrabackground.clearIndex();
+  serumData->backgroundframes_v2.readFromCRomFile(
+      serumData->fwidth * serumData->fheight, serumData->nbackgrounds,
+      reader);
+  serumData->backgroundframes_v2_extra.readFromCRomFile(
+      serumData->fwidth_extra * serumData->fheight_extra,
+      serumData->nbackgrounds, reader, &serumData->isextrabackground);
+  serumData->backgroundIDs.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->backgroundmask.readFromCRomFile(
+      serumData->fwidth * serumData->fheight, serumData->nframes, reader,
+      &serumData->backgroundIDs);
+  serumData->backgroundmask_extra.readFromCRomFile(
+      serumData->fwidth_extra * serumData->fheight_extra, serumData->nframes,
+      reader, &serumData->backgroundIDs);
 
   if (sizeheader >= 15 * sizeof(uint32_t)) {
-    g_serumData.dynashadowsdir.readFromCRomFile(MAX_DYNA_SETS_PER_FRAME_V2,
-                                                g_serumData.nframes, pfile);
-    g_serumData.dynashadowscol.readFromCRomFile(MAX_DYNA_SETS_PER_FRAME_V2,
-                                                g_serumData.nframes, pfile);
-    g_serumData.dynashadowsdir_extra.readFromCRomFile(
-        MAX_DYNA_SETS_PER_FRAME_V2, g_serumData.nframes, pfile,
-        &g_serumData.isextraframe);
-    g_serumData.dynashadowscol_extra.readFromCRomFile(
-        MAX_DYNA_SETS_PER_FRAME_V2, g_serumData.nframes, pfile,
-        &g_serumData.isextraframe);
+    serumData->dynashadowsdir.readFromCRomFile(MAX_DYNA_SETS_PER_FRAME_V2,
+                                                serumData->nframes, reader);
+    serumData->dynashadowscol.readFromCRomFile(MAX_DYNA_SETS_PER_FRAME_V2,
+                                                serumData->nframes, reader);
+    serumData->dynashadowsdir_extra.readFromCRomFile(
+        MAX_DYNA_SETS_PER_FRAME_V2, serumData->nframes, reader,
+        &serumData->isextraframe);
+    serumData->dynashadowscol_extra.readFromCRomFile(
+        MAX_DYNA_SETS_PER_FRAME_V2, serumData->nframes, reader,
+        &serumData->isextraframe);
   } else {
-    g_serumData.dynashadowsdir.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
-    g_serumData.dynashadowscol.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
-    g_serumData.dynashadowsdir_extra.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
-    g_serumData.dynashadowscol_extra.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
+    serumData->dynashadowsdir.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
+    serumData->dynashadowscol.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
+    serumData->dynashadowsdir_extra.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
+    serumData->dynashadowscol_extra.reserve(MAX_DYNA_SETS_PER_FRAME_V2);
   }
 
   if (sizeheader >= 18 * sizeof(uint32_t)) {
-    g_serumData.dynasprite4cols.readFromCRomFile(
-        MAX_DYNA_SETS_PER_SPRITE * g_serumData.nocolors, g_serumData.nsprites,
-        pfile);
-    g_serumData.dynasprite4cols_extra.readFromCRomFile(
-        MAX_DYNA_SETS_PER_SPRITE * g_serumData.nocolors, g_serumData.nsprites,
-        pfile, &g_serumData.isextraframe);
-    g_serumData.dynaspritemasks.readFromCRomFile(
-        MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, g_serumData.nsprites, pfile);
-    g_serumData.dynaspritemasks_extra.readFromCRomFile(
-        MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, g_serumData.nsprites, pfile,
-        &g_serumData.isextraframe);
+    serumData->dynasprite4cols.readFromCRomFile(
+        MAX_DYNA_SETS_PER_SPRITE * serumData->nocolors, serumData->nsprites,
+        reader);
+    serumData->dynasprite4cols_extra.readFromCRomFile(
+        MAX_DYNA_SETS_PER_SPRITE * serumData->nocolors, serumData->nsprites,
+        reader, &serumData->isextraframe);
+    serumData->dynaspritemasks.readFromCRomFile(
+        MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, serumData->nsprites, reader);
+    serumData->dynaspritemasks_extra.readFromCRomFile(
+        MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT, serumData->nsprites, reader,
+        &serumData->isextraframe);
   } else {
-    g_serumData.dynasprite4cols.reserve(MAX_DYNA_SETS_PER_SPRITE *
-                                        g_serumData.nocolors);
-    g_serumData.dynasprite4cols_extra.reserve(MAX_DYNA_SETS_PER_SPRITE *
-                                              g_serumData.nocolors);
-    g_serumData.dynaspritemasks.reserve(MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT);
-    g_serumData.dynaspritemasks_extra.reserve(MAX_SPRITE_WIDTH *
+    serumData->dynasprite4cols.reserve(MAX_DYNA_SETS_PER_SPRITE *
+                                        serumData->nocolors);
+    serumData->dynasprite4cols_extra.reserve(MAX_DYNA_SETS_PER_SPRITE *
+                                              serumData->nocolors);
+    serumData->dynaspritemasks.reserve(MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT);
+    serumData->dynaspritemasks_extra.reserve(MAX_SPRITE_WIDTH *
                                               MAX_SPRITE_HEIGHT);
   }
 
-  if (sizeheader >= 19 * sizeof(uint32_t)) {
-    g_serumData.sprshapemode.readFromCRomFile(1, g_serumData.nsprites, pfile);
-    for (uint32_t i = 0; i < g_serumData.nsprites; i++) {
-      if (g_serumData.sprshapemode[i][0] > 0) {
-        for (uint32_t j = 0; j < MAX_SPRITE_DETECT_AREAS; j++) {
-          uint32_t detdwords = g_serumData.spritedetdwords[i][j];
-          if ((detdwords & 0xFF000000) > 0)
-            detdwords = (detdwords & 0x00FFFFFF) | 0x01000000;
-          if ((detdwords & 0x00FF0000) > 0)
-            detdwords = (detdwords & 0xFF00FFFF) | 0x00010000;
-          if ((detdwords & 0x0000FF00) > 0)
-            detdwords = (detdwords & 0xFFFF00FF) | 0x00000100;
-          if ((detdwords & 0x000000FF) > 0)
-            detdwords = (detdwords & 0xFFFFFF00) | 0x00000001;
-          g_serumData.spritedetdwords[i][j] = detdwords;
-        }
-        for (uint32_t j = 0; j < MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT; j++) {
-          if (g_serumData.spriteoriginal[i][j] > 0 &&
-              g_serumData.spriteoriginal[i][j] != 255)
-            g_serumData.spriteoriginal[i][j] = 1;
-        }
+  if (sizeheader >= 19 * sizeof(uint32_t))
+    serumData->sprshapemode.readFromCRomFile(1, serumData->nsprites, reader);
+  else
+    serumData->sprshapemode.reserve(serumData->nsprites);
+
+  if (reader.failed()) {
+    // truncated file
+    Serum_free();
+    enabled = false;
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < serumData->nsprites; i++) {
+    if (serumData->sprshapemode[i][0] > 0) {
+      for (uint32_t j = 0; j < MAX_SPRITE_DETECT_AREAS; j++) {
+        uint32_t detdwords = serumData->spritedetdwords[i][j];
+        if ((detdwords & 0xFF000000) > 0)
+          detdwords = (detdwords & 0x00FFFFFF) | 0x01000000;
+        if ((detdwords & 0x00FF0000) > 0)
+          detdwords = (detdwords & 0xFF00FFFF) | 0x00010000;
+        if ((detdwords & 0x0000FF00) > 0)
+          detdwords = (detdwords & 0xFFFF00FF) | 0x00000100;
+        if ((detdwords & 0x000000FF) > 0)
+          detdwords = (detdwords & 0xFFFFFF00) | 0x00000001;
+        serumData->spritedetdwords[i][j] = detdwords;
+      }
+      for (uint32_t j = 0; j < MAX_SPRITE_WIDTH * MAX_SPRITE_HEIGHT; j++) {
+        if (serumData->spriteoriginal[i][j] > 0 &&
+            serumData->spriteoriginal[i][j] != 255)
+          serumData->spriteoriginal[i][j] = 1;
       }
     }
-  } else {
-    g_serumData.sprshapemode.reserve(g_serumData.nsprites);
   }
 
-  fclose(pfile);
-
   mySerum.ntriggers = 0;
-  uint32_t framespos = g_serumData.nframes / 2;
-  uint32_t framesspace = g_serumData.nframes - framespos;
+  uint32_t framespos = serumData->nframes / 2;
+  uint32_t framesspace = serumData->nframes - framespos;
   uint32_t framescount = (framesspace + 9) / 10;
 
   if (framescount > 0) {
     std::vector<uint32_t> candidates;
     candidates.reserve(framesspace);
-    for (uint32_t ti = framespos; ti < g_serumData.nframes; ++ti) {
-      if (g_serumData.triggerIDs[ti][0] == 0xffffffff) {
+    for (uint32_t ti = framespos; ti < serumData->nframes; ++ti) {
+      if (serumData->triggerIDs[ti][0] == 0xffffffff) {
         candidates.push_back(ti);
       }
     }
@@ -813,212 +989,166 @@ Serum_Frame_Struc* Serum_LoadFilev2(FILE* pfile, const uint8_t flags,
       uint32_t toAssign = std::min<uint32_t>(framescount, candidates.size());
       for (uint32_t i = 0; i < toAssign; ++i) {
         uint32_t triggerValue = triggerDist(rng);
-        g_serumData.triggerIDs.set(candidates[i], &triggerValue, 1);
+        serumData->triggerIDs.set(candidates[i], &triggerValue, 1);
       }
 
-      for (uint32_t offset = 0; (framespos + offset) < g_serumData.nframes;
+      for (uint32_t offset = 0; (framespos + offset) < serumData->nframes;
            ++offset) {
         uint32_t idx = framespos + offset;
-        if (g_serumData.triggerIDs[idx][0] == 0xffffffff) {
+        if (serumData->triggerIDs[idx][0] == 0xffffffff) {
           uint32_t triggerValue = triggerDist(rng);
-          g_serumData.triggerIDs.set(idx, &triggerValue, 1);
+          serumData->triggerIDs.set(idx, &triggerValue, 1);
           break;
         }
       }
     }
   }
-  for (uint32_t ti = 0; ti < g_serumData.nframes; ti++) {
-    if (g_serumData.triggerIDs[ti][0] != 0xffffffff) mySerum.ntriggers++;
-  }
-  framechecked = (bool*)malloc(sizeof(bool) * g_serumData.nframes);
-  if (!framechecked) {
-    Serum_free();
-    enabled = false;
-    return NULL;
+  for (uint32_t ti = 0; ti < serumData->nframes; ti++) {
+    if (serumData->triggerIDs[ti][0] != 0xffffffff) mySerum.ntriggers++;
   }
+  // PrepareRuntime() depends on the version
+  serumData->SerumVersion = SERUM_V2;
+  serumData->PrepareRuntime();
   if (flags & FLAG_REQUEST_32P_FRAMES) {
-    if (g_serumData.fheight == 32)
-      mySerum.width32 = g_serumData.fwidth;
+    if (serumData->fheight == 32)
+      mySerum.width32 = serumData->fwidth;
     else
-      mySerum.width32 = g_serumData.fwidth_extra;
+      mySerum.width32 = serumData->fwidth_extra;
   } else
     mySerum.width32 = 0;
   if (flags & FLAG_REQUEST_64P_FRAMES) {
-    if (g_serumData.fheight == 32)
-      mySerum.width64 = g_serumData.fwidth_extra;
+    if (serumData->fheight == 32)
+      mySerum.width64 = serumData->fwidth_extra;
     else
-      mySerum.width64 = g_serumData.fwidth;
+      mySerum.width64 = serumData->fwidth;
   } else
     mySerum.width64 = 0;
 
-  mySerum.SerumVersion = g_serumData.SerumVersion = SERUM_V2;
+  mySerum.SerumVersion = SERUM_V2;
 
   Full_Reset_ColorRotations();
   cromloaded = true;
 
-  if (!uncompressedCROM) {
-    // remove temporary file that had been extracted from compressed CRZ file
-    remove(pathbuf);
-  }
-
   enabled = true;
   return &mySerum;
 }
 
-Serum_Frame_Struc* Serum_LoadFilev1(const char* const filename,
-                                    const uint8_t flags) {
-  char pathbuf[pathbuflen];
-  if (!crc32_ready) CRC32encode();
-
-  // check if we're using an uncompressed cROM file
-  const char* ext;
-  bool uncompressedCROM = false;
-  if ((ext = strrchr(filename, '.')) != NULL) {
-    if (strcasecmp(ext, ".cROM") == 0) {
-      uncompressedCROM = true;
-      if (strcpy_s(pathbuf, pathbuflen, filename)) return NULL;
-    }
-  }
-
-  // extract file if it is compressed
-  if (!uncompressedCROM) {
-    char cromname[pathbuflen];
-    if (getenv("TMPDIR") != NULL) {
-      if (strcpy_s(pathbuf, pathbuflen, getenv("TMPDIR"))) return NULL;
-      size_t len = strlen(pathbuf);
-      if (len > 0 && pathbuf[len - 1] != '/') {
-        if (strcat_s(pathbuf, pathbuflen, "/")) return NULL;
-      }
-    } else if (strcpy_s(pathbuf, pathbuflen, filename))
-      return NULL;
-
-    if (!unzip_crz(filename, pathbuf, cromname, pathbuflen)) return NULL;
-    if (strcat_s(pathbuf, pathbuflen, cromname)) return NULL;
-  }
-
-  // Open cRom
-  FILE* pfile;
-  pfile = fopen(pathbuf, "rb");
-  if (!pfile) {
+Serum_Frame_Struc* Serum_Context::Serum_LoadFilev1(const char* const filename,
+                                                   const uint8_t flags) {
+  // cRZ files are decompressed while parsing
+  CRomReader reader;
+  const char* ext = strrchr(filename, '.');
+  bool opened = (ext && strcasecmp(ext, ".cROM") == 0)
+                    ? reader.openFile(filename)
+                    : reader.openZip(filename);
+  if (!opened) {
     enabled = false;
     return NULL;
   }
+  reader.setProgressCallback([this](uint8_t percent) {
+    ReportLoadProgress(SERUM_LOAD_PARSE, percent);
+  });
 
   // read the header to know how much memory is needed
-  fread(g_serumData.rname, 1, 64, pfile);
+  reader.readArray(serumData->rname, 64);
   uint32_t sizeheader;
-  fread(&sizeheader, 4, 1, pfile);
+  reader.readValue(sizeheader);
   // if this is a new format file, we load with Serum_LoadNewFile()
   if (sizeheader >= 14 * sizeof(uint32_t))
-    return Serum_LoadFilev2(pfile, flags, uncompressedCROM, pathbuf,
-                            sizeheader);
-  mySerum.SerumVersion = g_serumData.SerumVersion = SERUM_V1;
-  fread(&g_serumData.fwidth, 4, 1, pfile);
-  fread(&g_serumData.fheight, 4, 1, pfile);
+    return Serum_LoadFilev2(reader, flags, sizeheader);
+  mySerum.SerumVersion = serumData->SerumVersion = SERUM_V1;
+  reader.readValue(serumData->fwidth);
+  reader.readValue(serumData->fheight);
   // The serum file stored the number of frames as uint32_t, but in fact, the
   // number of frames will never exceed the size of uint16_t (65535)
   uint32_t nframes32;
-  fread(&nframes32, 4, 1, pfile);
-  g_serumData.nframes = (uint16_t)nframes32;
-  fread(&g_serumData.nocolors, 4, 1, pfile);
-  mySerum.nocolors = g_serumData.nocolors;
-  fread(&g_serumData.nccolors, 4, 1, pfile);
-  if ((g_serumData.fwidth == 0) || (g_serumData.fheight == 0) ||
-      (g_serumData.nframes == 0) || (g_serumData.nocolors == 0) ||
-      (g_serumData.nccolors == 0)) {
+  reader.readValue(nframes32);
+  serumData->nframes = (uint16_t)nframes32;
+  reader.readValue(serumData->nocolors);
+  mySerum.nocolors = serumData->nocolors;
+  reader.readValue(serumData->nccolors);
+  if (reader.failed() || (serumData->fwidth == 0) ||
+      (serumData->fheight == 0) || (serumData->nframes == 0) ||
+      (serumData->nocolors == 0) || (serumData->nccolors == 0)) {
     // incorrect file format
-    fclose(pfile);
     enabled = false;
     return NULL;
   }
-  fread(&g_serumData.ncompmasks, 4, 1, pfile);
-  fread(&g_serumData.nmovmasks, 4, 1, pfile);
-  fread(&g_serumData.nsprites, 4, 1, pfile);
+  reader.readValue(serumData->ncompmasks);
+  reader.readValue(serumData->nmovmasks);
+  reader.readValue(serumData->nsprites);
   if (sizeheader >= 13 * sizeof(uint32_t))
-    fread(&g_serumData.nbackgrounds, 2, 1, pfile);
+    reader.readValue(serumData->nbackgrounds);
   else
-    g_serumData.nbackgrounds = 0;
+    serumData->nbackgrounds = 0;
   // allocate memory for the serum format
-  uint8_t* spritedescriptionso = (uint8_t*)malloc(
-      g_serumData.nsprites * MAX_SPRITE_SIZE * MAX_SPRITE_SIZE);
-  uint8_t* spritedescriptionsc = (uint8_t*)malloc(
-      g_serumData.nsprites * MAX_SPRITE_SIZE * MAX_SPRITE_SIZE);
-
-  mySerum.frame = (uint8_t*)malloc(g_serumData.fwidth * g_serumData.fheight);
+  mySerum.frame = (uint8_t*)malloc(serumData->fwidth * serumData->fheight);
   mySerum.palette = (uint8_t*)malloc(3 * 64);
   mySerum.rotations = (uint8_t*)malloc(MAX_COLOR_ROTATIONS * 3);
-  if (((g_serumData.nsprites > 0) &&
-       (!spritedescriptionso || !spritedescriptionsc)) ||
-      !mySerum.frame || !mySerum.palette || !mySerum.rotations) {
+  if (!mySerum.frame || !mySerum.palette || !mySerum.rotations) {
     Serum_free();
-    fclose(pfile);
     enabled = false;
     return NULL;
   }
   // read the cRom file
-  g_serumData.hashcodes.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.shapecompmode.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.compmaskID.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.movrctID.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.movrctID.clear();  // we don't need this anymore, but we need to
-                                 // read it to skip the data in the file
-  g_serumData.compmasks.readFromCRomFile(
-      g_serumData.fwidth * g_serumData.fheight, g_serumData.ncompmasks, pfile);
-  g_serumData.movrcts.readFromCRomFile(g_serumData.fwidth * g_serumData.fheight,
-                                       g_serumData.nmovmasks, pfile);
-  g_serumData.movrcts.clear();  // we don't need this anymore, but we need to
-                                // read it to skip the data in the file
-  g_serumData.cpal.readFromCRomFile(3 * g_serumData.nccolors,
-                                    g_serumData.nframes, pfile);
-  g_serumData.cframes.readFromCRomFile(g_serumData.fwidth * g_serumData.fheight,
-                                       g_serumData.nframes, pfile);
-  g_serumData.dynamasks.readFromCRomFile(
-      g_serumData.fwidth * g_serumData.fheight, g_serumData.nframes, pfile);
-  g_serumData.dyna4cols.readFromCRomFile(
-      MAX_DYNA_4COLS_PER_FRAME * g_serumData.nocolors, g_serumData.nframes,
-      pfile);
-  g_serumData.framesprites.readFromCRomFile(MAX_SPRITES_PER_FRAME,
-                                            g_serumData.nframes, pfile);
-
-  for (int ti = 0;
-       ti < (int)g_serumData.nsprites * MAX_SPRITE_SIZE * MAX_SPRITE_SIZE;
-       ti++) {
-    fread(&spritedescriptionsc[ti], 1, 1, pfile);
-    fread(&spritedescriptionso[ti], 1, 1, pfile);
-  }
-  for (uint32_t i = 0; i < g_serumData.nsprites; i++) {
-    g_serumData.spritedescriptionsc.set(
-        i, &spritedescriptionsc[i * MAX_SPRITE_SIZE * MAX_SPRITE_SIZE],
-        MAX_SPRITE_SIZE * MAX_SPRITE_SIZE);
-    g_serumData.spritedescriptionso.set(
-        i, &spritedescriptionso[i * MAX_SPRITE_SIZE * MAX_SPRITE_SIZE],
-        MAX_SPRITE_SIZE * MAX_SPRITE_SIZE);
-  }
-  Free_element((void**)&spritedescriptionso);
-  Free_element((void**)&spritedescriptionsc);
-
-  g_serumData.activeframes.readFromCRomFile(1, g_serumData.nframes, pfile);
-  g_serumData.colorrotations.readFromCRomFile(3 * MAX_COLOR_ROTATIONS,
-                                              g_serumData.nframes, pfile);
-  g_serumData.spritedetdwords.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
-                                               g_serumData.nsprites, pfile);
-  g_serumData.spritedetdwordpos.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
-                                                 g_serumData.nsprites, pfile);
-  g_serumData.spritedetareas.readFromCRomFile(4 * MAX_SPRITE_DETECT_AREAS,
-                                              g_serumData.nsprites, pfile);
+  serumData->hashcodes.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->shapecompmode.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->compmaskID.readFromCRomFile(1, serumData->nframes, reader);
+  reader.skip(serumData->nframes);  // movrctID, not needed anymore
+  serumData->compmasks.readFromCRomFile(
+      serumData->fwidth * serumData->fheight, serumData->ncompmasks, reader);
+  reader.skip((uint64_t)serumData->fwidth * serumData->fheight *
+              serumData->nmovmasks);  // movrcts, not needed anymore
+  serumData->cpal.readFromCRomFile(3 * serumData->nccolors,
+                                    serumData->nframes, reader);
+  serumData->cframes.readFromCRomFile(serumData->fwidth * serumData->fheight,
+                                       serumData->nframes, reader);
+  serumData->dynamasks.readFromCRomFile(
+      serumData->fwidth * serumData->fheight, serumData->nframes, reader);
+  serumData->dyna4cols.readFromCRomFile(
+      MAX_DYNA_4COLS_PER_FRAME * serumData->nocolors, serumData->nframes,
+      reader);
+  serumData->framesprites.readFromCRomFile(MAX_SPRITES_PER_FRAME,
+                                            serumData->nframes, reader);
+
+  // the sprites are stored as pairs of colored and original pixels
+  {
+    const size_t spritePixels = MAX_SPRITE_SIZE * MAX_SPRITE_SIZE;
+    std::vector<uint8_t> pixels(2 * spritePixels);
+    std::vector<uint8_t> spritec(spritePixels), spriteo(spritePixels);
+    for (uint32_t i = 0; i < serumData->nsprites; i++) {
+      if (!reader.readArray(pixels.data(), pixels.size())) break;
+      for (size_t ti = 0; ti < spritePixels; ti++) {
+        spritec[ti] = pixels[2 * ti];
+        spriteo[ti] = pixels[2 * ti + 1];
+      }
+      serumData->spritedescriptionsc.set(i, spritec.data(), spritePixels);
+      serumData->spritedescriptionso.set(i, spriteo.data(), spritePixels);
+    }
+  }
+
+  serumData->activeframes.readFromCRomFile(1, serumData->nframes, reader);
+  serumData->colorrotations.readFromCRomFile(3 * MAX_COLOR_ROTATIONS,
+                                              serumData->nframes, reader);
+  serumData->spritedetdwords.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
+                                               serumData->nsprites, reader);
+  serumData->spritedetdwordpos.readFromCRomFile(MAX_SPRITE_DETECT_AREAS,
+                                                 serumData->nsprites, reader);
+  serumData->spritedetareas.readFromCRomFile(4 * MAX_SPRITE_DETECT_AREAS,
+                                              serumData->nsprites, reader);
   mySerum.ntriggers = 0;
   if (sizeheader >= 11 * sizeof(uint32_t)) {
-    g_serumData.triggerIDs.readFromCRomFile(1, g_serumData.nframes, pfile);
+    serumData->triggerIDs.readFromCRomFile(1, serumData->nframes, reader);
   }
-  uint32_t framespos = g_serumData.nframes / 2;
-  uint32_t framesspace = g_serumData.nframes - framespos;
+  uint32_t framespos = serumData->nframes / 2;
+  uint32_t framesspace = serumData->nframes - framespos;
   uint32_t framescount = (framesspace + 9) / 10;
 
   if (framescount > 0) {
     std::vector<uint32_t> candidates;
     candidates.reserve(framesspace);
-    for (uint32_t ti = framespos; ti < g_serumData.nframes; ++ti) {
-      if (g_serumData.triggerIDs[ti][0] == 0xffffffff) {
+    for (uint32_t ti = framespos; ti < serumData->nframes; ++ti) {
+      if (serumData->triggerIDs[ti][0] == 0xffffffff) {
         candidates.push_back(ti);
       }
     }
@@ -1031,82 +1161,77 @@ Serum_Frame_Struc* Serum_LoadFilev1(const char* const filename,
       uint32_t toAssign = std::min<uint32_t>(framescount, candidates.size());
       for (uint32_t i = 0; i < toAssign; ++i) {
         uint32_t triggerValue = triggerDist(rng);
-        g_serumData.triggerIDs.set(candidates[i], &triggerValue, 1);
+        serumData->triggerIDs.set(candidates[i], &triggerValue, 1);
       }
 
-      for (uint32_t offset = 0; (framespos + offset) < g_serumData.nframes;
+      for (uint32_t offset = 0; (framespos + offset) < serumData->nframes;
            ++offset) {
         uint32_t idx = framespos + offset;
-        if (g_serumData.triggerIDs[idx][0] == 0xffffffff) {
+        if (serumData->triggerIDs[idx][0] == 0xffffffff) {
           uint32_t triggerValue = triggerDist(rng);
-          g_serumData.triggerIDs.set(idx, &triggerValue, 1);
+          serumData->triggerIDs.set(idx, &triggerValue, 1);
           break;
         }
       }
     }
   }
-  for (uint32_t ti = 0; ti < g_serumData.nframes; ti++) {
-    if (g_serumData.triggerIDs[ti][0] != 0xffffffff) mySerum.ntriggers++;
+  for (uint32_t ti = 0; ti < serumData->nframes; ti++) {
+    if (serumData->triggerIDs[ti][0] != 0xffffffff) mySerum.ntriggers++;
   }
   if (sizeheader >= 12 * sizeof(uint32_t))
-    g_serumData.framespriteBB.readFromCRomFile(MAX_SPRITES_PER_FRAME * 4,
-                                               g_serumData.nframes, pfile,
-                                               &g_serumData.framesprites);
+    serumData->framespriteBB.readFromCRomFile(MAX_SPRITES_PER_FRAME * 4,
+                                               serumData->nframes, reader,
+                                               &serumData->framesprites);
   else {
-    for (uint32_t tj = 0; tj < g_serumData.nframes; tj++) {
+    for (uint32_t tj = 0; tj < serumData->nframes; tj++) {
       uint16_t tmp_framespriteBB[4 * MAX_SPRITES_PER_FRAME];
       for (uint32_t ti = 0; ti < MAX_SPRITES_PER_FRAME; ti++) {
         tmp_framespriteBB[ti * 4] = 0;
         tmp_framespriteBB[ti * 4 + 1] = 0;
-        tmp_framespriteBB[ti * 4 + 2] = g_serumData.fwidth - 1;
-        tmp_framespriteBB[ti * 4 + 3] = g_serumData.fheight - 1;
+        tmp_framespriteBB[ti * 4 + 2] = serumData->fwidth - 1;
+        tmp_framespriteBB[ti * 4 + 3] = serumData->fheight - 1;
       }
-      g_serumData.framespriteBB.set(tj, tmp_framespriteBB,
+      serumData->framespriteBB.set(tj, tmp_framespriteBB,
                                     MAX_SPRITES_PER_FRAME * 4);
     }
   }
   if (sizeheader >= 13 * sizeof(uint32_t)) {
-    g_serumData.backgroundframes.readFromCRomFile(
-        g_serumData.fwidth * g_serumData.fheight, g_serumData.nbackgrounds,
-        pfile);
-    g_serumData.backgroundIDs.readFromCRomFile(1, g_serumData.nframes, pfile);
-    g_serumData.backgroundBB.readFromCRomFile(4, g_serumData.nframes, pfile,
-                                              &g_serumData.backgroundIDs);
-  }
-  fclose(pfile);
-
-  // allocate memory for previous detected frame
-  framechecked = (bool*)malloc(sizeof(bool) * g_serumData.nframes);
-  if (!framechecked) {
+    serumData->backgroundframes.readFromCRomFile(
+        serumData->fwidth * serumData->fheight, serumData->nbackgrounds,
+        reader);
+    serumData->backgroundIDs.readFromCRomFile(1, serumData->nframes, reader);
+    serumData->backgroundBB.readFromCRomFile(4, serumData->nframes, reader,
+                                              &serumData->backgroundIDs);
+  }
+  if (reader.failed()) {
+    // truncated file
     Serum_free();
     enabled = false;
     return NULL;
   }
-  if (g_serumData.fheight == 64) {
-    mySerum.width64 = g_serumData.fwidth;
+
+  serumData->PrepareRuntime();
+  if (serumData->fheight == 64) {
+    mySerum.width64 = serumData->fwidth;
     mySerum.width32 = 0;
   } else {
-    mySerum.width32 = g_serumData.fwidth;
+    mySerum.width32 = serumData->fwidth;
     mySerum.width64 = 0;
   }
   Full_Reset_ColorRotations();
   cromloaded = true;
 
-  if (!uncompressedCROM) {
-    // remove temporary file that had been extracted from compressed CRZ file
-    remove(pathbuf);
-  }
-
   enabled = true;
   return &mySerum;
 }
 
-SERUM_API Serum_Frame_Struc* Serum_Load(const char* const altcolorpath,
-                                        const char* const romname,
-                                        uint8_t flags) {
+Serum_Frame_Struc* Serum_Context::Load(const char* const altcolorpath,
+                                       const char* const romname,
+                                       uint8_t flags) {
   Serum_free();
+  ReportLoadProgress(SERUM_LOAD_FIND, 0);
 
-  mySerum.SerumVersion = g_serumData.SerumVersion = 0;
+  mySerum.SerumVersion = 0;
   mySerum.flags = 0;
   mySerum.frame = NULL;
   mySerum.frame32 = NULL;
@@ -1119,6 +1244,8 @@ SERUM_API Serum_Frame_Struc* Serum_Load(const char* const altcolorpath,
   mySerum.rotationsinframe64 = NULL;
   mySerum.modifiedelements32 = NULL;
   mySerum.modifiedelements64 = NULL;
+  mySerum.dirtyrects32 = NULL;
+  mySerum.dirtyrects64 = NULL;
 
   std::string pathbuf = std::string(altcolorpath);
   if (pathbuf.empty() || (pathbuf.back() != '\\' && pathbuf.back() != '/'))
@@ -1142,14 +1269,49 @@ SERUM_API Serum_Frame_Struc* Serum_Load(const char* const altcolorpath,
 
   if (pFoundFile) {
     Log("Found %s", pFoundFile->c_str());
-    result = Serum_LoadConcentrate(pFoundFile->c_str(), flags);
+    // a cROMc which is outdated is generated again from its source
+    std::optional<std::string> sourceFile =
+        find_case_insensitive_file(pathbuf, std::string(romname) + ".cROM");
+    if (!sourceFile)
+      sourceFile =
+          find_case_insensitive_file(pathbuf, std::string(romname) + ".cRZ");
+    if (sourceFile && !serumData->IsConcentrateUpToDate(
+                          pFoundFile->c_str(), sourceFile->c_str(), flags))
+      pFoundFile.reset();
+  }
+
+  if (pFoundFile) {
+    // A file which is rewritten below must not be mapped, a mapped file
+    // can't be replaced on Windows
+    bool map = true;
+#ifdef WRITE_CROMC
+    if (generateCRomC &&
+        (csvFoundFile ||
+         SerumData::ReadConcentrateVersion(pFoundFile->c_str()) <
+             SERUM_CONCENTRATE_VERSION))
+      map = false;
+#endif
+    ReportLoadProgress(SERUM_LOAD_PARSE, 0);
+    result = Serum_LoadConcentrate(pFoundFile->c_str(), flags, map);
     if (result) {
       Log("Loaded %s", pFoundFile->c_str());
-      if (csvFoundFile && g_serumData.SerumVersion == SERUM_V2 &&
-          g_serumData.sceneGenerator->parseCSV(csvFoundFile->c_str())) {
+      ReportLoadProgress(SERUM_LOAD_PARSE, 100);
+      if (csvFoundFile && serumData->SerumVersion == SERUM_V2 &&
+          sceneGenerator.parseCSV(csvFoundFile->c_str())) {
 #ifdef WRITE_CROMC
         // Update the concentrate file with new PUP data
-        if (generateCRomC) Serum_SaveConcentrate(pFoundFile->c_str());
+        if (generateCRomC)
+          Serum_SaveConcentrate(pFoundFile->c_str(), false, flags);
+#endif
+      } else if (serumData->concentrateFileVersion <
+                     SERUM_CONCENTRATE_VERSION &&
+                 (flags & FLAG_REQUEST_32P_FRAMES) &&
+                 (flags & FLAG_REQUEST_64P_FRAMES)) {
+#ifdef WRITE_CROMC
+        // Rewrite older concentrate files in the current format, which can
+        // be loaded on demand. Only if no data was dropped while loading.
+        if (generateCRomC)
+          Serum_SaveConcentrate(pFoundFile->c_str(), false, flags);
 #endif
       }
     } else {
@@ -1173,20 +1335,26 @@ SERUM_API Serum_Frame_Struc* Serum_Load(const char* const altcolorpath,
       return NULL;
     }
     Log("Found %s", pFoundFile->c_str());
+    ReportLoadProgress(SERUM_LOAD_PARSE, 0);
     result = Serum_LoadFilev1(pFoundFile->c_str(), flags);
     if (result) {
       Log("Loaded %s", pFoundFile->c_str());
-      if (csvFoundFile && g_serumData.SerumVersion == SERUM_V2)
-        g_serumData.sceneGenerator->parseCSV(csvFoundFile->c_str());
+      if (csvFoundFile && serumData->SerumVersion == SERUM_V2)
+        sceneGenerator.parseCSV(csvFoundFile->c_str());
 #ifdef WRITE_CROMC
-      if (generateCRomC) Serum_SaveConcentrate(pFoundFile->c_str());
+      if (generateCRomC)
+        Serum_SaveConcentrate(pFoundFile->c_str(), true, flags);
 #endif
     } else {
       Log("Failed to load %s", pFoundFile->c_str());
     }
   }
-  if (result && g_serumData.sceneGenerator->isActive())
-    g_serumData.sceneGenerator->setDepth(result->nocolors == 16 ? 4 : 2);
+  if (result && sceneGenerator.isActive())
+    sceneGenerator.setDepth(result->nocolors == 16 ? 4 : 2);
+  if (result) {
+    Log("Using %s CRC32", crc32_kernel_name());
+    Log("Using %s sprite detection", sprite_scan_kernel_name());
+  }
   if (is_real_machine()) {
     monochromeMode = true;
   }
@@ -1194,434 +1362,676 @@ SERUM_API Serum_Frame_Struc* Serum_Load(const char* const altcolorpath,
   return result;
 }
 
-SERUM_API void Serum_Dispose(void) { Serum_free(); }
+void Serum_Context::CopyOptions(const Serum_Context& from) {
+  generateCRomC = from.generateCRomC;
+  temporalSpriteDetection = from.temporalSpriteDetection;
+  ignoreUnknownFramesTimeout = from.ignoreUnknownFramesTimeout;
+  maxFramesToSkip = from.maxFramesToSkip;
+  memcpy(standardPalette, from.standardPalette, sizeof(standardPalette));
+  standardPaletteLength = from.standardPaletteLength;
+}
 
-uint32_t Identify_Frame(uint8_t* frame) {
-  // Usually the first frame has the ID 0, but lastfound is also initialized
-  // with 0. So we need a helper to be able to detect frame 0 as new.
-  static bool first_match = true;
+void Serum_Context::AdoptLoad(Serum_Context& loaded) {
+  serumData = std::move(loaded.serumData);
+  sceneGenerator = std::move(loaded.sceneGenerator);
+  triggerCleared = std::move(loaded.triggerCleared);
+  sceneFrameCount = loaded.sceneFrameCount;
+  sceneCurrentFrame = loaded.sceneCurrentFrame;
+  sceneDurationPerFrame = loaded.sceneDurationPerFrame;
+  sceneInterruptable = loaded.sceneInterruptable;
+  sceneStartImmediately = loaded.sceneStartImmediately;
+  sceneRepeatCount = loaded.sceneRepeatCount;
+  sceneEndFrame = loaded.sceneEndFrame;
+  memcpy(sceneFrame, loaded.sceneFrame, sizeof(sceneFrame));
+  memcpy(lastFrame, loaded.lastFrame, sizeof(lastFrame));
+  monochromeMode = loaded.monochromeMode;
+  showStatusMessages = loaded.showStatusMessages;
+
+  cromloaded = loaded.cromloaded;
+  lastfound = loaded.lastfound;
+  lastframe_full_crc = loaded.lastframe_full_crc;
+  lastframe_found = loaded.lastframe_found;
+  lasttriggerID = loaded.lasttriggerID;
+  lasttriggerTimestamp = loaded.lasttriggerTimestamp;
+  first_match = loaded.first_match;
+  framesSkippedCounter = loaded.framesSkippedCounter;
+  memcpy(colorshifts, loaded.colorshifts, sizeof(colorshifts));
+  memcpy(colorshiftinittime, loaded.colorshiftinittime,
+         sizeof(colorshiftinittime));
+  memcpy(colorshifts32, loaded.colorshifts32, sizeof(colorshifts32));
+  memcpy(colorshiftinittime32, loaded.colorshiftinittime32,
+         sizeof(colorshiftinittime32));
+  memcpy(colorshifts64, loaded.colorshifts64, sizeof(colorshifts64));
+  memcpy(colorshiftinittime64, loaded.colorshiftinittime64,
+         sizeof(colorshiftinittime64));
+  colorrotseruminit = loaded.colorrotseruminit;
+  memcpy(colorrotnexttime, loaded.colorrotnexttime, sizeof(colorrotnexttime));
+  memcpy(colorrotnexttime32, loaded.colorrotnexttime32,
+         sizeof(colorrotnexttime32));
+  memcpy(colorrotnexttime64, loaded.colorrotnexttime64,
+         sizeof(colorrotnexttime64));
+  enabled = loaded.enabled;
+  isoriginalrequested = loaded.isoriginalrequested;
+  isextrarequested = loaded.isextrarequested;
+
+  // the buffers are swapped, so loaded frees the empty ones of this context
+  std::swap(mySerum, loaded.mySerum);
+  std::swap(frameshape, loaded.frameshape);
+  groupOrder = std::move(loaded.groupOrder);
+  shapeFrame = std::move(loaded.shapeFrame);
+  spriteCandidates = std::move(loaded.spriteCandidates);
+  spriteScanFrame = std::move(loaded.spriteScanFrame);
+  spriteScanFrameId = loaded.spriteScanFrameId;
+  spriteScanRows = std::move(loaded.spriteScanRows);
+  colorRotationLookup[0] = loaded.colorRotationLookup[0];
+  colorRotationLookup[1] = loaded.colorRotationLookup[1];
+  rotationPixels32 = loaded.rotationPixels32;
+  rotationPixels64 = loaded.rotationPixels64;
+  dirtyRectsFrameId = loaded.dirtyRectsFrameId;
+  memcpy(dirtySprites, loaded.dirtySprites, sizeof(dirtySprites));
+  ndirtySprites = loaded.ndirtySprites;
+  concentrateWriter = std::move(loaded.concentrateWriter);
+}
+
+Serum_Frame_Struc* Serum_Context::LoadAsync(const char* const altcolorpath,
+                                            const char* const romname,
+                                            uint8_t flags,
+                                            Serum_LoadProgressCallback callback,
+                                            const void* userData) {
+  Serum_free();
+  mySerum.SerumVersion = 0;
+  mySerum.flags = 0;
+  // no frame buffers until the first frame is colorized while loading
+  mySerum.width32 = mySerum.width64 = 0;
+  mySerum.nocolors = 0;
+
+  std::shared_ptr<AsyncLoad> async = std::make_shared<AsyncLoad>();
+  async->context.reset(new (std::nothrow) Serum_Context());
+  if (!async->context) return NULL;
+  Serum_Context* loading = async->context.get();
+  loading->CopyOptions(*this);
+  // the worker only keeps a raw pointer, the AsyncLoad owns the context
+  AsyncLoad* state = async.get();
+  loading->loadProgress = [state, loading, callback, userData](
+                              uint8_t phase, uint8_t percent) {
+    if (!state->width && loading->serumData->nocolors > 0) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->width = loading->serumData->fwidth;
+      state->height = loading->serumData->fheight;
+      state->nocolors = loading->serumData->nocolors;
+    }
+    if (callback) callback(phase, percent, userData);
+  };
+
+  std::string path(altcolorpath), rom(romname);
+  try {
+    async->thread = std::thread([state, loading, path, rom, flags, callback,
+                                 userData]() {
+      Serum_Frame_Struc* result = loading->Load(path.c_str(), rom.c_str(),
+                                                flags);
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->result = result;
+        state->finished = true;
+      }
+      if (callback)
+        callback(result ? SERUM_LOAD_DONE : SERUM_LOAD_FAILED, 100, userData);
+    });
+  } catch (...) {
+    return NULL;
+  }
+  asyncLoad = async;
+  return &mySerum;
+}
+
+bool Serum_Context::FinishAsyncLoad(bool wait) {
+  if (!asyncLoad) return true;
+  if (!wait) {
+    std::lock_guard<std::mutex> lock(asyncLoad->mutex);
+    if (!asyncLoad->finished) return false;
+  }
+  std::shared_ptr<AsyncLoad> async = std::move(asyncLoad);
+  async->thread.join();
+
+  Serum_Context& loaded = *async->context;
+  loaded.loadProgress = nullptr;
+  Serum_free();
+  if (async->result) {
+    AdoptLoad(loaded);
+  } else {
+    enabled = false;
+  }
+  return true;
+}
+
+SERUM_API Serum_Frame_Struc* Serum_Load(const char* const altcolorpath,
+                                        const char* const romname,
+                                        uint8_t flags) {
+  return g_defaultContext.Load(altcolorpath, romname, flags);
+}
+
+SERUM_API void Serum_Dispose(void) { g_defaultContext.Serum_free(); }
+
+SERUM_API Serum_Context* Serum_CreateContext(void) {
+  return new (std::nothrow) Serum_Context();
+}
+
+SERUM_API void Serum_DestroyContext(Serum_Context* context) {
+  delete context;
+}
+
+SERUM_API Serum_Frame_Struc* Serum_ContextLoad(Serum_Context* context,
+                                               const char* const altcolorpath,
+                                               const char* const romname,
+                                               uint8_t flags) {
+  if (!context) return NULL;
+  return context->Load(altcolorpath, romname, flags);
+}
+
+SERUM_API Serum_Frame_Struc* Serum_LoadAsync(
+    const char* const altcolorpath, const char* const romname, uint8_t flags,
+    Serum_LoadProgressCallback callback, const void* userData) {
+  return g_defaultContext.LoadAsync(altcolorpath, romname, flags, callback,
+                                    userData);
+}
+
+SERUM_API Serum_Frame_Struc* Serum_ContextLoadAsync(
+    Serum_Context* context, const char* const altcolorpath,
+    const char* const romname, uint8_t flags,
+    Serum_LoadProgressCallback callback, const void* userData) {
+  if (!context) return NULL;
+  return context->LoadAsync(altcolorpath, romname, flags, callback, userData);
+}
+
+uint32_t Serum_Context::GetTriggerID(uint32_t frameId) {
+  if (frameId < triggerCleared.size() && triggerCleared[frameId])
+    return 0xffffffff;
+  return serumData->triggerIDs[frameId][0];
+}
 
+uint32_t Serum_Context::Identify_Frame(uint8_t* frame) {
   if (!cromloaded) return IDENTIFY_NO_FRAME;
-  memset(framechecked, false, g_serumData.nframes);
-  uint16_t tj = lastfound;  // we start from the frame we last found
-  const uint32_t pixels = g_serumData.is256x64
+  const uint32_t nframes = serumData->nframes;
+  if (nframes == 0) return IDENTIFY_NO_FRAME;
+  const uint32_t start = (lastfound < nframes) ? lastfound : 0;
+  const uint32_t pixels = serumData->is256x64
                               ? (256 * 64)
-                              : (g_serumData.fwidth * g_serumData.fheight);
-  do {
-    if (!framechecked[tj]) {
-      // calculate the hashcode for the generated frame with the mask and
-      // shapemode of the current crom frame
-      uint8_t mask = g_serumData.compmaskID[tj][0];
-      uint8_t Shape = g_serumData.shapecompmode[tj][0];
-      uint32_t Hashc = calc_crc32(frame, mask, pixels, Shape);
-      // now we can compare with all the crom frames that share these same mask
-      // and shapemode
-      uint16_t ti = tj;
-      do {
-        if (!framechecked[ti]) {
-          if ((g_serumData.compmaskID[ti][0] == mask) &&
-              (g_serumData.shapecompmode[ti][0] == Shape)) {
-            if (Hashc == g_serumData.hashcodes[ti][0]) {
-              if (first_match || ti != lastfound || mask < 255) {
-                // Reset_ColorRotations();
-                lastfound = ti;
-                lastframe_full_crc = crc32_fast(frame, pixels);
-                first_match = false;
-                return ti;  // we found the frame, we return it
-              }
+                              : (serumData->fwidth * serumData->fheight);
+
+  // We start from the frame we last found: visit the groups of frames sharing
+  // the same mask and shapemode in the order their first frame appears when
+  // walking the crom frames from there
+  groupOrder.clear();
+  for (uint32_t tg = 0; tg < serumData->frameLookup.size(); tg++) {
+    const auto& frames = serumData->frameLookup[tg].frames;
+    auto it = std::lower_bound(frames.begin(), frames.end(), start);
+    uint32_t distance =
+        (it != frames.end()) ? (*it - start) : (frames[0] + nframes - start);
+    groupOrder.push_back({distance, tg});
+  }
+  std::sort(groupOrder.begin(), groupOrder.end());
+
+  bool shapeFrameReady = false;
+  for (const auto& order : groupOrder) {
+    const SerumData::FrameLookupGroup& group =
+        serumData->frameLookup[order.second];
+    uint8_t* source = frame;
+    if (group.shape == 1) {
+      if (!shapeFrameReady) {
+        shapeFrame.resize(pixels);
+        for (uint32_t ti = 0; ti < pixels; ti++)
+          shapeFrame[ti] = (uint8_t)(frame[ti] != 0);
+        shapeFrameReady = true;
+      }
+      source = shapeFrame.data();
+    }
+    // calculate the hashcode for the generated frame with the mask and
+    // shapemode of this group, then look up all the crom frames that share
+    // this same mask, shapemode and hashcode
+    uint32_t Hashc = calc_crc32(source, group.mask, pixels);
+    auto found = group.framesByHash.find(Hashc);
+    if (found == group.framesByHash.end()) continue;
+    const auto& candidates = found->second;
+    auto it = std::lower_bound(candidates.begin(), candidates.end(), start);
+    uint32_t ti = (it != candidates.end()) ? *it : candidates[0];
+
+    if (first_match || ti != lastfound || group.mask < 255) {
+      // Reset_ColorRotations();
+      lastfound = ti;
+      lastframe_full_crc = crc32_fast(frame, pixels);
+      first_match = false;
+      return ti;  // we found the frame, we return it
+    }
 
-              uint32_t full_crc = crc32_fast(frame, pixels);
-              if (full_crc != lastframe_full_crc) {
-                lastframe_full_crc = full_crc;
-                return ti;  // we found the same frame with shape as before, but
-                            // the full frame is different
-              }
-              return IDENTIFY_SAME_FRAME;  // we found the frame, but it is the
-                                           // same full frame as before (no
-                                           // mask)
-            }
-            framechecked[ti] = true;
-          }
-        }
-        if (++ti >= g_serumData.nframes) ti = 0;
-      } while (ti != tj);
+    uint32_t full_crc = crc32_fast(frame, pixels);
+    if (full_crc != lastframe_full_crc) {
+      lastframe_full_crc = full_crc;
+      return ti;  // we found the same frame with shape as before, but
+                  // the full frame is different
     }
-    if (++tj >= g_serumData.nframes) tj = 0;
-  } while (tj != lastfound);
+    return IDENTIFY_SAME_FRAME;  // we found the frame, but it is the
+                                 // same full frame as before (no
+                                 // mask)
+  }
 
   return IDENTIFY_NO_FRAME;  // we found no corresponding frame
 }
 
-void GetSpriteSize(uint8_t nospr, int* pswid, int* pshei, uint8_t* spriteData,
-                   int sswid, int sshei) {
-  *pswid = *pshei = 0;
-  if (nospr >= g_serumData.nsprites) return;
-  if (!spriteData) return;
-  for (int tj = 0; tj < sshei; tj++) {
-    for (int ti = 0; ti < sswid; ti++) {
-      if (spriteData[tj * sswid + ti] < 255) {
-        if (tj > *pshei) *pshei = tj;
-        if (ti > *pswid) *pswid = ti;
+// If rows is given, only the rows for which it is not 0 are searched
+void Serum_Context::FindSpriteCandidates(const uint8_t* Frame,
+                                         uint32_t quelleframe, uint8_t shape,
+                                         const uint8_t* rows) {
+  const SerumData::SpriteDetector& detector =
+      serumData->spriteDetectors[quelleframe];
+  const int minx = detector.minx[shape];
+  const int lastx = detector.maxx[shape] - 3;  // last position of a dword
+  if (detector.entryCount == 0 || lastx < minx) return;
+  const SerumData::SpriteDetectEntry* entries =
+      &serumData->spriteDetectEntries[detector.firstEntry];
+  const SerumData::SpriteDetectEntry* lastEntry =
+      entries + detector.entryCount;
+  const uint16_t* buckets =
+      &serumData->spriteDetectBuckets[detector.firstBucket];
+  const uint32_t bucketMask = 0xffffffffu >> detector.bucketShift;
+  // with few dwords, the SIMD kernel finds their positions, otherwise every
+  // position is looked up in the table
+  const uint32_t* patterns =
+      &serumData->spriteDetectPatterns[detector.firstPattern[shape]];
+  const uint32_t npatterns = detector.patternCount[shape];
+  const bool findPatterns = npatterns <= SPRITE_SCAN_MAX_PATTERNS;
+  const uint16_t* spriteBB = serumData->framespriteBB[quelleframe];
+  for (int ty = detector.miny[shape]; ty <= detector.maxy[shape]; ty++) {
+    if (rows && !rows[ty]) continue;
+    const uint8_t* row = &Frame[ty * serumData->fwidth];
+    for (int blockx = minx; blockx <= lastx; blockx += 64) {
+      const int count = std::min(64, lastx - blockx + 1);
+      uint64_t found =
+          findPatterns
+              ? sprite_find_dwords(row + blockx, count, patterns, npatterns)
+              : (~(uint64_t)0 >> (64 - count));
+      while (found) {
+        const int tx = blockx + std::countr_zero(found);
+        found &= found - 1;
+        const uint32_t mdword =
+            (uint32_t)row[tx] | ((uint32_t)row[tx + 1] << 8) |
+            ((uint32_t)row[tx + 2] << 16) | ((uint32_t)row[tx + 3] << 24);
+        uint32_t bucket =
+            SerumData::SpriteDetectBucket(mdword, detector.bucketShift);
+        while (buckets[bucket] != 0 &&
+               entries[buckets[bucket] - 1].dword != mdword)
+          bucket = (bucket + 1) & bucketMask;
+        if (buckets[bucket] == 0) continue;
+        for (const SerumData::SpriteDetectEntry* entry =
+                 &entries[buckets[bucket] - 1];
+             entry < lastEntry && entry->dword == mdword; entry++) {
+          if (entry->shape != shape) continue;
+          // only inside the bounding box of this sprite
+          const uint16_t* bb = &spriteBB[entry->slot * 4];
+          if (tx < bb[0] || ty < bb[1] || tx > bb[2] - 3 || ty > bb[3])
+            continue;
+          spriteCandidates.push_back(((uint64_t)entry->slot << 48) |
+                                     ((uint64_t)entry->area << 32) |
+                                     ((uint64_t)ty << 16) | (uint64_t)tx);
+        }
       }
     }
   }
-  (*pshei)++;
-  (*pswid)++;
 }
 
-bool Check_Spritesv1(uint8_t* Frame, uint32_t quelleframe,
-                     uint8_t* pquelsprites, uint8_t* nspr, uint16_t* pfrx,
-                     uint16_t* pfry, uint16_t* pspx, uint16_t* pspy,
-                     uint16_t* pwid, uint16_t* phei) {
-  uint8_t ti = 0;
-  uint32_t mdword;
+bool Serum_Context::Check_Spritesv1(uint8_t* Frame, uint32_t quelleframe,
+                                    uint8_t* pquelsprites, uint8_t* nspr,
+                                    uint16_t* pfrx, uint16_t* pfry,
+                                    uint16_t* pspx, uint16_t* pspy,
+                                    uint16_t* pwid, uint16_t* phei) {
   *nspr = 0;
-  while ((ti < MAX_SPRITES_PER_FRAME) &&
-         (g_serumData.framesprites[quelleframe][ti] < 255)) {
-    uint8_t qspr = g_serumData.framesprites[quelleframe][ti];
-    int spw, sph;
-    GetSpriteSize(qspr, &spw, &sph, g_serumData.spritedescriptionso[qspr],
-                  MAX_SPRITE_SIZE, MAX_SPRITE_SIZE);
-    short minxBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4]);
-    short minyBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4 + 1]);
-    short maxxBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4 + 2]);
-    short maxyBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4 + 3]);
-    for (uint32_t tm = 0; tm < MAX_SPRITE_DETECT_AREAS; tm++) {
-      if (g_serumData.spritedetareas[qspr][tm * 4] == 0xffff) continue;
-      // we look for the sprite in the frame sent
-      for (short ty = minyBB; ty <= maxyBB; ty++) {
-        mdword = (uint32_t)(Frame[ty * g_serumData.fwidth + minxBB] << 8) |
-                 (uint32_t)(Frame[ty * g_serumData.fwidth + minxBB + 1] << 16) |
-                 (uint32_t)(Frame[ty * g_serumData.fwidth + minxBB + 2] << 24);
-        for (short tx = minxBB; tx <= maxxBB - 3; tx++) {
-          uint32_t tj = ty * g_serumData.fwidth + tx;
-          mdword = (mdword >> 8) | (uint32_t)(Frame[tj + 3] << 24);
-          // we look for the magic dword first:
-          uint16_t sddp = g_serumData.spritedetdwordpos[qspr][tm];
-          if (mdword == g_serumData.spritedetdwords[qspr][tm]) {
-            short frax =
-                (short)tx;  // position in the frame of the detection dword
-            short fray = (short)ty;
-            short sprx =
-                (short)(sddp % MAX_SPRITE_SIZE);  // position in the sprite of
-                                                  // the detection dword
-            short spry = (short)(sddp / MAX_SPRITE_SIZE);
-            // details of the det area:
-            short detx =
-                (short)g_serumData
-                    .spritedetareas[qspr][tm * 4];  // position of the detection
-                                                    // area in the sprite
-            short dety = (short)g_serumData.spritedetareas[qspr][tm * 4 + 1];
-            short detw =
-                (short)g_serumData
-                    .spritedetareas[qspr]
-                                   [tm * 4 + 2];  // size of the detection area
-            short deth = (short)g_serumData.spritedetareas[qspr][tm * 4 + 3];
-            // if the detection area starts before the frame (left or top),
-            // continue:
-            if ((frax - minxBB < sprx - detx) || (fray - minyBB < spry - dety))
-              continue;
-            // position of the detection area in the frame
-            int offsx = frax - sprx + detx;
-            int offsy = fray - spry + dety;
-            // if the detection area extends beyond the bounding box (right or
-            // bottom), continue:
-            if ((offsx + detw > (int)maxxBB + 1) ||
-                (offsy + deth > (int)maxyBB + 1))
-              continue;
-            // we can now check if the full detection area is around the found
-            // detection dword
-            bool notthere = false;
-            for (uint16_t tk = 0; tk < deth; tk++) {
-              for (uint16_t tl = 0; tl < detw; tl++) {
-                uint8_t val =
-                    g_serumData.spritedescriptionso[qspr][(tk + dety) *
-                                                              MAX_SPRITE_SIZE +
-                                                          tl + detx];
-                if (val == 255) continue;
-                if (val !=
-                    Frame[(tk + offsy) * g_serumData.fwidth + tl + offsx]) {
-                  notthere = true;
-                  break;
-                }
-              }
-              if (notthere == true) break;
-            }
-            if (!notthere) {
-              pquelsprites[*nspr] = qspr;
-              if (frax - minxBB < sprx) {
-                pspx[*nspr] =
-                    (uint16_t)(sprx -
-                               (frax - minxBB));  // display sprite from point
-                pfrx[*nspr] = (uint16_t)minxBB;
-                pwid[*nspr] = MIN((uint16_t)(spw - pspx[*nspr]),
-                                  (uint16_t)(maxxBB - minxBB + 1));
-              } else {
-                pspx[*nspr] = 0;
-                pfrx[*nspr] = (uint16_t)(frax - sprx);
-                pwid[*nspr] =
-                    MIN((uint16_t)(maxxBB - pfrx[*nspr] + 1), (uint16_t)spw);
-              }
-              if (fray - minyBB < spry) {
-                pspy[*nspr] = (uint16_t)(spry - (fray - minyBB));
-                pfry[*nspr] = (uint16_t)minyBB;
-                phei[*nspr] = MIN((uint16_t)(sph - pspy[*nspr]),
-                                  (uint16_t)(maxyBB - minyBB + 1));
-              } else {
-                pspy[*nspr] = 0;
-                pfry[*nspr] = (uint16_t)(fray - spry);
-                phei[*nspr] =
-                    MIN((uint16_t)(maxyBB - pfry[*nspr] + 1), (uint16_t)sph);
-              }
-              // we check the identical sprites as there may be duplicate due to
-              // the multi detection zones
-              bool identicalfound = false;
-              for (uint8_t tk = 0; tk < *nspr; tk++) {
-                if ((pquelsprites[*nspr] == pquelsprites[tk]) &&
-                    (pfrx[*nspr] == pfrx[tk]) && (pfry[*nspr] == pfry[tk]) &&
-                    (pwid[*nspr] == pwid[tk]) && (phei[*nspr] == phei[tk]))
-                  identicalfound = true;
-              }
-              if (!identicalfound) {
-                (*nspr)++;
-                if (*nspr == MAX_SPRITES_PER_FRAME) return true;
-              }
-            }
-          }
-        }
+  if (quelleframe >= serumData->spriteDetectors.size()) return false;
+  // we look for the sprites in the frame sent
+  spriteCandidates.clear();
+  FindSpriteCandidates(Frame, quelleframe, 0);
+  FindSpriteCandidates(Frame, quelleframe, 1);
+  std::sort(spriteCandidates.begin(), spriteCandidates.end());
+  for (const uint64_t candidate : spriteCandidates) {
+    const uint8_t ti = (uint8_t)(candidate >> 48);
+    const uint32_t tm = (uint32_t)(candidate >> 32) & 0xff;
+    uint8_t qspr = serumData->framesprites[quelleframe][ti];
+    const int spw = serumData->spritesizes[qspr][0];
+    const int sph = serumData->spritesizes[qspr][1];
+    short minxBB = (short)(serumData->framespriteBB[quelleframe][ti * 4]);
+    short minyBB = (short)(serumData->framespriteBB[quelleframe][ti * 4 + 1]);
+    short maxxBB = (short)(serumData->framespriteBB[quelleframe][ti * 4 + 2]);
+    short maxyBB = (short)(serumData->framespriteBB[quelleframe][ti * 4 + 3]);
+    // position in the frame of the detection dword
+    short frax = (short)(candidate & 0xffff);
+    short fray = (short)((candidate >> 16) & 0xffff);
+    uint16_t sddp = serumData->spritedetdwordpos[qspr][tm];
+    short sprx = (short)(sddp % MAX_SPRITE_SIZE);  // position in the sprite of
+                                                   // the detection dword
+    short spry = (short)(sddp / MAX_SPRITE_SIZE);
+    // details of the det area:
+    // position of the detection area in the sprite
+    short detx = (short)serumData->spritedetareas[qspr][tm * 4];
+    short dety = (short)serumData->spritedetareas[qspr][tm * 4 + 1];
+    // size of the detection area
+    short detw = (short)serumData->spritedetareas[qspr][tm * 4 + 2];
+    short deth = (short)serumData->spritedetareas[qspr][tm * 4 + 3];
+    // if the detection area starts before the frame (left or top),
+    // continue:
+    if ((frax - minxBB < sprx - detx) || (fray - minyBB < spry - dety))
+      continue;
+    // position of the detection area in the frame
+    int offsx = frax - sprx + detx;
+    int offsy = fray - spry + dety;
+    // if the detection area extends beyond the bounding box (right or
+    // bottom), continue:
+    if ((offsx + detw > (int)maxxBB + 1) || (offsy + deth > (int)maxyBB + 1))
+      continue;
+    // we can now check if the full detection area is around the found
+    // detection dword, the 255 values of the sprite are not checked
+    const uint8_t* sprite = serumData->spritedescriptionso[qspr];
+    const uint16_t* spans = serumData->spritespans[qspr];
+    bool notthere = false;
+    for (uint16_t tk = 0; tk < deth; tk++) {
+      // only the opaque part of the sprite row
+      const int start = std::max<int>(detx, spans[(tk + dety) * 2]);
+      const int end = std::min<int>(detx + detw, spans[(tk + dety) * 2 + 1]);
+      if (start < end &&
+          !sprite_row_matches(
+              &sprite[(tk + dety) * MAX_SPRITE_SIZE + start],
+              &Frame[(tk + offsy) * serumData->fwidth + offsx + start - detx],
+              end - start)) {
+        notthere = true;
+        break;
       }
     }
-    ti++;
+    if (notthere) continue;
+    pquelsprites[*nspr] = qspr;
+    if (frax - minxBB < sprx) {
+      pspx[*nspr] = (uint16_t)(sprx - (frax - minxBB));  // display sprite
+                                                         // from point
+      pfrx[*nspr] = (uint16_t)minxBB;
+      pwid[*nspr] = MIN((uint16_t)(spw - pspx[*nspr]),
+                        (uint16_t)(maxxBB - minxBB + 1));
+    } else {
+      pspx[*nspr] = 0;
+      pfrx[*nspr] = (uint16_t)(frax - sprx);
+      pwid[*nspr] = MIN((uint16_t)(maxxBB - pfrx[*nspr] + 1), (uint16_t)spw);
+    }
+    if (fray - minyBB < spry) {
+      pspy[*nspr] = (uint16_t)(spry - (fray - minyBB));
+      pfry[*nspr] = (uint16_t)minyBB;
+      phei[*nspr] = MIN((uint16_t)(sph - pspy[*nspr]),
+                        (uint16_t)(maxyBB - minyBB + 1));
+    } else {
+      pspy[*nspr] = 0;
+      pfry[*nspr] = (uint16_t)(fray - spry);
+      phei[*nspr] = MIN((uint16_t)(maxyBB - pfry[*nspr] + 1), (uint16_t)sph);
+    }
+    // we check the identical sprites as there may be duplicate due to
+    // the multi detection zones
+    bool identicalfound = false;
+    for (uint8_t tk = 0; tk < *nspr; tk++) {
+      if ((pquelsprites[*nspr] == pquelsprites[tk]) &&
+          (pfrx[*nspr] == pfrx[tk]) && (pfry[*nspr] == pfry[tk]) &&
+          (pwid[*nspr] == pwid[tk]) && (phei[*nspr] == phei[tk]))
+        identicalfound = true;
+    }
+    if (!identicalfound) {
+      (*nspr)++;
+      if (*nspr == MAX_SPRITES_PER_FRAME) return true;
+    }
   }
   if (*nspr > 0) return true;
   return false;
 }
 
-bool Check_Spritesv2(uint8_t* recframe, uint32_t quelleframe,
-                     uint8_t* pquelsprites, uint8_t* nspr, uint16_t* pfrx,
-                     uint16_t* pfry, uint16_t* pspx, uint16_t* pspy,
-                     uint16_t* pwid, uint16_t* phei) {
-  uint8_t ti = 0;
-  uint32_t mdword;
+bool Serum_Context::Check_Spritesv2(uint8_t* recframe, uint32_t quelleframe,
+                                    uint8_t* pquelsprites, uint8_t* nspr,
+                                    uint16_t* pfrx, uint16_t* pfry,
+                                    uint16_t* pspx, uint16_t* pspy,
+                                    uint16_t* pwid, uint16_t* phei) {
   *nspr = 0;
-  bool isshapedframe = false;
-  while ((ti < MAX_SPRITES_PER_FRAME) &&
-         (g_serumData.framesprites[quelleframe][ti] < 255)) {
-    uint8_t qspr = g_serumData.framesprites[quelleframe][ti];
-    uint8_t* Frame = recframe;
-    bool isshapecheck = false;
-    if (g_serumData.sprshapemode[qspr][0] > 0) {
-      isshapecheck = true;
-      if (!isshapedframe) {
-        for (int i = 0; i < g_serumData.fwidth * g_serumData.fheight; i++) {
-          if (Frame[i] > 0)
-            frameshape[i] = 1;
-          else
-            frameshape[i] = 0;
-        }
-        isshapedframe = true;
+  if (quelleframe >= serumData->spriteDetectors.size()) return false;
+  const SerumData::SpriteDetector& detector =
+      serumData->spriteDetectors[quelleframe];
+  const uint32_t pixels = serumData->fwidth * serumData->fheight;
+  // a candidate only depends on the 4 pixels of its detection dword, so for
+  // the same frame ID, the candidates of the rows which haven't changed since
+  // the previous frame are kept and only the other rows are searched again.
+  // The candidates are then all checked as usual.
+  const uint8_t* changedRows = nullptr;
+  if (temporalSpriteDetection && quelleframe == spriteScanFrameId &&
+      spriteScanFrame.size() == pixels) {
+    spriteScanRows.resize(serumData->fheight);
+    for (uint32_t ty = 0; ty < serumData->fheight; ty++) {
+      spriteScanRows[ty] =
+          memcmp(&recframe[ty * serumData->fwidth],
+                 &spriteScanFrame[ty * serumData->fwidth],
+                 serumData->fwidth) != 0;
+    }
+    changedRows = spriteScanRows.data();
+    spriteCandidates.erase(
+        std::remove_if(spriteCandidates.begin(), spriteCandidates.end(),
+                       [changedRows](uint64_t candidate) {
+                         return changedRows[(candidate >> 16) & 0xffff] != 0;
+                       }),
+        spriteCandidates.end());
+  } else {
+    spriteCandidates.clear();
+  }
+  if (temporalSpriteDetection) {
+    spriteScanFrame.assign(recframe, recframe + pixels);
+    spriteScanFrameId = quelleframe;
+  } else {
+    spriteScanFrameId = 0xffffffff;
+  }
+  // we look for the sprites in the frame sent, or in its shape for the
+  // sprites in shape mode
+  FindSpriteCandidates(recframe, quelleframe, 0, changedRows);
+  if (detector.entryCount > 0 && detector.minx[1] <= detector.maxx[1]) {
+    for (uint32_t ty = 0; ty < serumData->fheight; ty++) {
+      if (changedRows && !changedRows[ty]) continue;
+      for (uint32_t i = ty * serumData->fwidth;
+           i < (ty + 1) * serumData->fwidth; i++) {
+        if (recframe[i] > 0)
+          frameshape[i] = 1;
+        else
+          frameshape[i] = 0;
       }
-      Frame = frameshape;
-    }
-    int spw, sph;
-    GetSpriteSize(qspr, &spw, &sph, g_serumData.spriteoriginal[qspr],
-                  MAX_SPRITE_WIDTH, MAX_SPRITE_HEIGHT);
-    short minxBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4]);
-    short minyBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4 + 1]);
-    short maxxBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4 + 2]);
-    short maxyBB = (short)(g_serumData.framespriteBB[quelleframe][ti * 4 + 3]);
-    for (uint32_t tm = 0; tm < MAX_SPRITE_DETECT_AREAS; tm++) {
-      if (g_serumData.spritedetareas[qspr][tm * 4] == 0xffff) continue;
-      // we look for the sprite in the frame sent
-      for (short ty = minyBB; ty <= maxyBB; ty++) {
-        mdword = (uint32_t)(Frame[ty * g_serumData.fwidth + minxBB] << 8) |
-                 (uint32_t)(Frame[ty * g_serumData.fwidth + minxBB + 1] << 16) |
-                 (uint32_t)(Frame[ty * g_serumData.fwidth + minxBB + 2] << 24);
-        for (short tx = minxBB; tx <= maxxBB - 3; tx++) {
-          uint32_t tj = ty * g_serumData.fwidth + tx;
-          mdword = (mdword >> 8) | (uint32_t)(Frame[tj + 3] << 24);
-          // we look for the magic dword first:
-          uint16_t sddp = g_serumData.spritedetdwordpos[qspr][tm];
-          if (mdword == g_serumData.spritedetdwords[qspr][tm]) {
-            short frax =
-                (short)tx;  // position in the frame of the detection dword
-            short fray = (short)ty;
-            short sprx =
-                (short)(sddp % MAX_SPRITE_WIDTH);  // position in the sprite of
-                                                   // the detection dword
-            short spry = (short)(sddp / MAX_SPRITE_WIDTH);
-            // details of the det area:
-            short detx =
-                (short)g_serumData
-                    .spritedetareas[qspr][tm * 4];  // position of the detection
-                                                    // area in the sprite
-            short dety = (short)g_serumData.spritedetareas[qspr][tm * 4 + 1];
-            short detw =
-                (short)g_serumData
-                    .spritedetareas[qspr]
-                                   [tm * 4 + 2];  // size of the detection area
-            short deth = (short)g_serumData.spritedetareas[qspr][tm * 4 + 3];
-            // if the detection area starts before the frame (left or top),
-            // continue:
-            if ((frax - minxBB < sprx - detx) || (fray - minyBB < spry - dety))
-              continue;
-            // position of the detection area in the frame
-            int offsx = frax - sprx + detx;
-            int offsy = fray - spry + dety;
-            // if the detection area extends beyond the bounding box (right or
-            // bottom), continue:
-            if ((offsx + detw > (int)maxxBB + 1) ||
-                (offsy + deth > (int)maxyBB + 1))
-              continue;
-            // we can now check if the full detection area is around the found
-            // detection dword
-            bool notthere = false;
-            for (uint16_t tk = 0; tk < deth; tk++) {
-              for (uint16_t tl = 0; tl < detw; tl++) {
-                uint8_t val =
-                    g_serumData
-                        .spriteoriginal[qspr][(tk + dety) * MAX_SPRITE_WIDTH +
-                                              tl + detx];
-                if (val == 255) continue;
-                if (val !=
-                    Frame[(tk + offsy) * g_serumData.fwidth + tl + offsx]) {
-                  notthere = true;
-                  break;
-                }
-              }
-              if (notthere == true) break;
-            }
-            if (!notthere) {
-              pquelsprites[*nspr] = qspr;
-              if (frax - minxBB < sprx) {
-                pspx[*nspr] =
-                    (uint16_t)(sprx -
-                               (frax - minxBB));  // display sprite from point
-                pfrx[*nspr] = (uint16_t)minxBB;
-                pwid[*nspr] = MIN((uint16_t)(spw - pspx[*nspr]),
-                                  (uint16_t)(maxxBB - minxBB + 1));
-              } else {
-                pspx[*nspr] = 0;
-                pfrx[*nspr] = (uint16_t)(frax - sprx);
-                pwid[*nspr] =
-                    MIN((uint16_t)(maxxBB - pfrx[*nspr] + 1), (uint16_t)spw);
-              }
-              if (fray - minyBB < spry) {
-                pspy[*nspr] = (uint16_t)(spry - (fray - minyBB));
-                pfry[*nspr] = (uint16_t)minyBB;
-                phei[*nspr] = MIN((uint16_t)(sph - pspy[*nspr]),
-                                  (uint16_t)(maxyBB - minyBB + 1));
-              } else {
-                pspy[*nspr] = 0;
-                pfry[*nspr] = (uint16_t)(fray - spry);
-                phei[*nspr] =
-                    MIN((uint16_t)(maxyBB - pfry[*nspr] + 1), (uint16_t)sph);
-              }
-              // we check the identical sprites as there may be duplicate due to
-              // the multi detection zones
-              bool identicalfound = false;
-              for (uint8_t tk = 0; tk < *nspr; tk++) {
-                if ((pquelsprites[*nspr] == pquelsprites[tk]) &&
-                    (pfrx[*nspr] == pfrx[tk]) && (pfry[*nspr] == pfry[tk]) &&
-                    (pwid[*nspr] == pwid[tk]) && (phei[*nspr] == phei[tk]))
-                  identicalfound = true;
-              }
-              if (!identicalfound) {
-                (*nspr)++;
-                if (*nspr == MAX_SPRITES_PER_FRAME) return true;
-              }
-            }
-          }
-        }
+    }
+    FindSpriteCandidates(frameshape, quelleframe, 1, changedRows);
+  }
+  std::sort(spriteCandidates.begin(), spriteCandidates.end());
+  for (const uint64_t candidate : spriteCandidates) {
+    const uint8_t ti = (uint8_t)(candidate >> 48);
+    const uint32_t tm = (uint32_t)(candidate >> 32) & 0xff;
+    uint8_t qspr = serumData->framesprites[quelleframe][ti];
+    uint8_t* Frame =
+        (serumData->sprshapemode[qspr][0] > 0) ? frameshape : recframe;
+    const int spw = serumData->spritesizes[qspr][0];
+    const int sph = serumData->spritesizes[qspr][1];
+    short minxBB = (short)(serumData->framespriteBB[quelleframe][ti * 4]);
+    short minyBB = (short)(serumData->framespriteBB[quelleframe][ti * 4 + 1]);
+    short maxxBB = (short)(serumData->framespriteBB[quelleframe][ti * 4 + 2]);
+    short maxyBB = (short)(serumData->framespriteBB[quelleframe][ti * 4 + 3]);
+    // position in the frame of the detection dword
+    short frax = (short)(candidate & 0xffff);
+    short fray = (short)((candidate >> 16) & 0xffff);
+    uint16_t sddp = serumData->spritedetdwordpos[qspr][tm];
+    short sprx = (short)(sddp % MAX_SPRITE_WIDTH);  // position in the sprite of
+                                                    // the detection dword
+    short spry = (short)(sddp / MAX_SPRITE_WIDTH);
+    // details of the det area:
+    // position of the detection area in the sprite
+    short detx = (short)serumData->spritedetareas[qspr][tm * 4];
+    short dety = (short)serumData->spritedetareas[qspr][tm * 4 + 1];
+    // size of the detection area
+    short detw = (short)serumData->spritedetareas[qspr][tm * 4 + 2];
+    short deth = (short)serumData->spritedetareas[qspr][tm * 4 + 3];
+    // if the detection area starts before the frame (left or top),
+    // continue:
+    if ((frax - minxBB < sprx - detx) || (fray - minyBB < spry - dety))
+      continue;
+    // position of the detection area in the frame
+    int offsx = frax - sprx + detx;
+    int offsy = fray - spry + dety;
+    // if the detection area extends beyond the bounding box (right or
+    // bottom), continue:
+    if ((offsx + detw > (int)maxxBB + 1) || (offsy + deth > (int)maxyBB + 1))
+      continue;
+    // we can now check if the full detection area is around the found
+    // detection dword, the 255 values of the sprite are not checked
+    const uint8_t* sprite = serumData->spriteoriginal[qspr];
+    const uint16_t* spans = serumData->spritespans[qspr];
+    const uint16_t* bounds = serumData->spritebounds[qspr];
+    bool notthere = false;
+    for (uint16_t tk = 0; tk < deth; tk++) {
+      // only the opaque part of the sprite row, which is within the bounds
+      const int start = std::max<int>(detx, spans[(tk + dety) * 2]);
+      const int end = std::min<int>(detx + detw, spans[(tk + dety) * 2 + 1]);
+      if (start < end &&
+          !sprite_row_matches(
+              &sprite[(tk + dety - bounds[1]) * bounds[2] + start - bounds[0]],
+              &Frame[(tk + offsy) * serumData->fwidth + offsx + start - detx],
+              end - start)) {
+        notthere = true;
+        break;
       }
     }
-    ti++;
+    if (notthere) continue;
+    pquelsprites[*nspr] = qspr;
+    if (frax - minxBB < sprx) {
+      pspx[*nspr] = (uint16_t)(sprx - (frax - minxBB));  // display sprite
+                                                         // from point
+      pfrx[*nspr] = (uint16_t)minxBB;
+      pwid[*nspr] = MIN((uint16_t)(spw - pspx[*nspr]),
+                        (uint16_t)(maxxBB - minxBB + 1));
+    } else {
+      pspx[*nspr] = 0;
+      pfrx[*nspr] = (uint16_t)(frax - sprx);
+      pwid[*nspr] = MIN((uint16_t)(maxxBB - pfrx[*nspr] + 1), (uint16_t)spw);
+    }
+    if (fray - minyBB < spry) {
+      pspy[*nspr] = (uint16_t)(spry - (fray - minyBB));
+      pfry[*nspr] = (uint16_t)minyBB;
+      phei[*nspr] = MIN((uint16_t)(sph - pspy[*nspr]),
+                        (uint16_t)(maxyBB - minyBB + 1));
+    } else {
+      pspy[*nspr] = 0;
+      pfry[*nspr] = (uint16_t)(fray - spry);
+      phei[*nspr] = MIN((uint16_t)(maxyBB - pfry[*nspr] + 1), (uint16_t)sph);
+    }
+    // we check the identical sprites as there may be duplicate due to
+    // the multi detection zones
+    bool identicalfound = false;
+    for (uint8_t tk = 0; tk < *nspr; tk++) {
+      if ((pquelsprites[*nspr] == pquelsprites[tk]) &&
+          (pfrx[*nspr] == pfrx[tk]) && (pfry[*nspr] == pfry[tk]) &&
+          (pwid[*nspr] == pwid[tk]) && (phei[*nspr] == phei[tk]))
+        identicalfound = true;
+    }
+    if (!identicalfound) {
+      (*nspr)++;
+      if (*nspr == MAX_SPRITES_PER_FRAME) return true;
+    }
   }
   if (*nspr > 0) return true;
   return false;
 }
 
-void Colorize_Framev1(uint8_t* frame, uint32_t IDfound) {
+void Serum_Context::Colorize_Framev1(uint8_t* frame, uint32_t IDfound) {
   uint16_t tj, ti;
   // Generate the colorized version of a frame once identified in the crom
   // frames
-  for (tj = 0; tj < g_serumData.fheight; tj++) {
-    for (ti = 0; ti < g_serumData.fwidth; ti++) {
-      uint16_t tk = tj * g_serumData.fwidth + ti;
-
-      if ((g_serumData.backgroundIDs[IDfound][0] < g_serumData.nbackgrounds) &&
-          (frame[tk] == 0) && (ti >= g_serumData.backgroundBB[IDfound][0]) &&
-          (tj >= g_serumData.backgroundBB[IDfound][1]) &&
-          (ti <= g_serumData.backgroundBB[IDfound][2]) &&
-          (tj <= g_serumData.backgroundBB[IDfound][3]))
-        mySerum.frame[tk] =
-            g_serumData
-                .backgroundframes[g_serumData.backgroundIDs[IDfound][0]][tk];
+  const uint16_t backgroundID = serumData->backgroundIDs[IDfound][0];
+  const uint16_t* backgroundBB = serumData->backgroundBB[IDfound];
+  const uint8_t* backgroundframe =
+      (backgroundID < serumData->nbackgrounds)
+          ? serumData->backgroundframes[backgroundID]
+          : NULL;
+  const uint8_t* dynamask = serumData->dynamasks[IDfound];
+  const uint8_t* cframe = serumData->cframes[IDfound];
+  const uint8_t* dyna4cols = serumData->dyna4cols[IDfound];
+  for (tj = 0; tj < serumData->fheight; tj++) {
+    for (ti = 0; ti < serumData->fwidth; ti++) {
+      uint16_t tk = tj * serumData->fwidth + ti;
+
+      if (backgroundframe && (frame[tk] == 0) && (ti >= backgroundBB[0]) &&
+          (tj >= backgroundBB[1]) && (ti <= backgroundBB[2]) &&
+          (tj <= backgroundBB[3]))
+        mySerum.frame[tk] = backgroundframe[tk];
       else {
-        uint8_t dynacouche = g_serumData.dynamasks[IDfound][tk];
+        uint8_t dynacouche = dynamask[tk];
         if (dynacouche == 255)
-          mySerum.frame[tk] = g_serumData.cframes[IDfound][tk];
+          mySerum.frame[tk] = cframe[tk];
         else
           mySerum.frame[tk] =
-              g_serumData.dyna4cols[IDfound][dynacouche * g_serumData.nocolors +
-                                             frame[tk]];
+              dyna4cols[dynacouche * serumData->nocolors + frame[tk]];
       }
     }
   }
 }
 
-bool CheckExtraFrameAvailable(uint32_t frID) {
+bool Serum_Context::CheckExtraFrameAvailable(uint32_t frID) {
   // Check if there is an extra frame for this frame
   // (and if all the sprites and background involved are available)
-  if (g_serumData.isextraframe[frID][0] == 0) return false;
-  if (g_serumData.backgroundIDs[frID][0] < 0xffff &&
-      g_serumData.isextrabackground[g_serumData.backgroundIDs[frID][0]][0] == 0)
+  if (serumData->isextraframe[frID][0] == 0) return false;
+  if (serumData->backgroundIDs[frID][0] < 0xffff &&
+      serumData->isextrabackground[serumData->backgroundIDs[frID][0]][0] == 0)
     return false;
   for (uint32_t ti = 0; ti < MAX_SPRITES_PER_FRAME; ti++) {
-    if (g_serumData.framesprites[frID][ti] < 255 &&
-        g_serumData.isextrasprite[g_serumData.framesprites[frID][ti]][0] == 0)
+    if (serumData->framesprites[frID][ti] < 255 &&
+        serumData->isextrasprite[serumData->framesprites[frID][ti]][0] == 0)
       return false;
   }
   return true;
 }
 
-bool ColorInRotation(uint32_t IDfound, uint16_t col, uint16_t* norot,
-                     uint16_t* posinrot, bool isextra) {
-  uint16_t* pcol = NULL;
-  if (isextra)
-    pcol = g_serumData.colorrotations_v2_extra[IDfound];
-  else
-    pcol = g_serumData.colorrotations_v2[IDfound];
-  *norot = 0xffff;
+const ColorRotationLookup& Serum_Context::GetColorRotationLookup(
+    uint32_t IDfound, const uint16_t* pcol, bool isextra) {
+  ColorRotationLookup& lookup = colorRotationLookup[isextra ? 1 : 0];
+  if (lookup.frameId == IDfound) return lookup;
+
+  // a new generation invalidates all the entries at once
+  if (++lookup.generation == 0) {
+    memset(lookup.entries, 0, sizeof(lookup.entries));
+    lookup.generation = 1;
+  }
+  lookup.frameId = IDfound;
+  const uint16_t stamp = (uint16_t)(lookup.generation << 8);
   for (uint32_t ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
-    for (uint32_t tj = 2; tj < 2u + pcol[ti * MAX_LENGTH_COLOR_ROTATION];
-         tj++)  // val [0] is for length and val [1] is for duration in ms
-    {
-      if (col == pcol[ti * MAX_LENGTH_COLOR_ROTATION + tj]) {
-        *norot = ti;
-        *posinrot =
-            tj - 2;  // val [0] is for length and val [1] is for duration in ms
-        return true;
-      }
+    // val [0] is for length and val [1] is for duration in ms
+    uint32_t length = pcol[ti * MAX_LENGTH_COLOR_ROTATION];
+    if (length > MAX_LENGTH_COLOR_ROTATION - 2)
+      length = MAX_LENGTH_COLOR_ROTATION - 2;
+    for (uint32_t tj = 0; tj < length; tj++) {
+      uint16_t col = pcol[ti * MAX_LENGTH_COLOR_ROTATION + 2 + tj];
+      // the first rotation and position containing the color wins
+      if ((lookup.entries[col] >> 8) != lookup.generation)
+        lookup.entries[col] = stamp | (uint16_t)(ti << 6) | (uint16_t)tj;
     }
   }
-  return false;
+  return lookup;
 }
 
-void CheckDynaShadow(uint16_t* pfr, uint32_t nofr, uint8_t dynacouche,
+inline bool ColorInRotation(const ColorRotationLookup& lookup, uint16_t col,
+                            uint16_t* norot, uint16_t* posinrot) {
+  uint16_t entry = lookup.entries[col];
+  if ((entry >> 8) != lookup.generation) {
+    *norot = 0xffff;
+    return false;
+  }
+  *norot = (entry >> 6) & 0x3;
+  *posinrot = entry & 0x3f;
+  return true;
+}
+
+void CheckDynaShadow(uint16_t* pfr, const uint8_t* dsdirs,
+                     const uint16_t* dscols, uint8_t dynacouche,
                      uint8_t* isdynapix, uint16_t fx, uint16_t fy, uint32_t fw,
-                     uint32_t fh, bool isextra) {
-  uint8_t dsdir;
-  if (isextra)
-    dsdir = g_serumData.dynashadowsdir_extra[nofr][dynacouche];
-  else
-    dsdir = g_serumData.dynashadowsdir[nofr][dynacouche];
+                     uint32_t fh) {
+  uint8_t dsdir = dsdirs[dynacouche];
   if (dsdir == 0) return;
-  uint16_t tcol;
-  if (isextra)
-    tcol = g_serumData.dynashadowscol_extra[nofr][dynacouche];
-  else
-    tcol = g_serumData.dynashadowscol[nofr][dynacouche];
+  uint16_t tcol = dscols[dynacouche];
   if ((dsdir & 0b1) > 0 && fx > 0 && fy > 0 &&
       isdynapix[(fy - 1) * fw + fx - 1] == 0)  // dyna shadow top left
   {
@@ -1672,7 +2082,7 @@ void CheckDynaShadow(uint16_t* pfr, uint32_t nofr, uint8_t dynacouche,
   }
 }
 
-void Colorize_Framev2(uint8_t* frame, uint32_t IDfound) {
+void Serum_Context::Colorize_Framev2(uint8_t* frame, uint32_t IDfound) {
   uint16_t tj, ti;
   // Generate the colorized version of a frame once identified in the crom
   // frames
@@ -1680,55 +2090,53 @@ void Colorize_Framev2(uint8_t* frame, uint32_t IDfound) {
   mySerum.flags &= 0b11111100;
   uint16_t* pfr;
   uint16_t* prot;
-  uint16_t* prt;
+  const uint16_t* prt;
   uint32_t* cshft;
   if (mySerum.frame32) mySerum.width32 = 0;
   if (mySerum.frame64) mySerum.width64 = 0;
   uint8_t isdynapix[256 * 64];
-  if (((mySerum.frame32 && g_serumData.fheight == 32) ||
-       (mySerum.frame64 && g_serumData.fheight == 64)) &&
+  if (((mySerum.frame32 && serumData->fheight == 32) ||
+       (mySerum.frame64 && serumData->fheight == 64)) &&
       isoriginalrequested) {
     // create the original res frame
-    if (g_serumData.fheight == 32) {
+    const SerumData::FrameView view = serumData->GetFrameView(IDfound, false);
+    if (serumData->fheight == 32) {
       pfr = mySerum.frame32;
       mySerum.flags |= FLAG_RETURNED_32P_FRAME_OK;
       prot = mySerum.rotationsinframe32;
-      mySerum.width32 = g_serumData.fwidth;
-      prt = g_serumData.colorrotations_v2[IDfound];
+      mySerum.width32 = serumData->fwidth;
       cshft = colorshifts32;
     } else {
       pfr = mySerum.frame64;
       mySerum.flags |= FLAG_RETURNED_64P_FRAME_OK;
       prot = mySerum.rotationsinframe64;
-      mySerum.width64 = g_serumData.fwidth;
-      prt = g_serumData.colorrotations_v2[IDfound];
+      mySerum.width64 = serumData->fwidth;
       cshft = colorshifts64;
     }
-    memset(isdynapix, 0, g_serumData.fheight * g_serumData.fwidth);
-    for (tj = 0; tj < g_serumData.fheight; tj++) {
-      for (ti = 0; ti < g_serumData.fwidth; ti++) {
-        uint16_t tk = tj * g_serumData.fwidth + ti;
-        if ((g_serumData.backgroundIDs[IDfound][0] <
-             g_serumData.nbackgrounds) &&
-            (frame[tk] == 0) && (g_serumData.backgroundmask[IDfound][tk] > 0)) {
+    prt = view.colorrotations;
+    const ColorRotationLookup& rotlookup =
+        GetColorRotationLookup(IDfound, prt, false);
+    memset(isdynapix, 0, serumData->fheight * serumData->fwidth);
+    for (tj = 0; tj < serumData->fheight; tj++) {
+      for (ti = 0; ti < serumData->fwidth; ti++) {
+        uint16_t tk = tj * serumData->fwidth + ti;
+        if (view.backgroundframe && (frame[tk] == 0) &&
+            (view.backgroundmask[tk] > 0)) {
           if (isdynapix[tk] == 0) {
-            pfr[tk] =
-                g_serumData
-                    .backgroundframes_v2[g_serumData.backgroundIDs[IDfound][0]]
-                                        [tk];
-            if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                &prot[tk * 2 + 1], false))
+            pfr[tk] = view.backgroundframe[tk];
+            if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                &prot[tk * 2 + 1]))
               pfr[tk] = prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                             (cshft[prot[tk * 2]] + prot[tk * 2 + 1]) %
                                 prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION]];
           }
         } else {
-          uint8_t dynacouche = g_serumData.dynamasks[IDfound][tk];
+          uint8_t dynacouche = view.dynamask[tk];
           if (dynacouche == 255) {
             if (isdynapix[tk] == 0) {
-              pfr[tk] = g_serumData.cframes_v2[IDfound][tk];
-              if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                  &prot[tk * 2 + 1], false))
+              pfr[tk] = view.cframe[tk];
+              if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                  &prot[tk * 2 + 1]))
                 pfr[tk] =
                     prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                         (prot[tk * 2 + 1] + cshft[prot[tk * 2]]) %
@@ -1736,18 +2144,15 @@ void Colorize_Framev2(uint8_t* frame, uint32_t IDfound) {
             }
           } else {
             if (frame[tk] > 0) {
-              CheckDynaShadow(pfr, IDfound, dynacouche, isdynapix, ti, tj,
-                              g_serumData.fwidth, g_serumData.fheight, false);
+              CheckDynaShadow(pfr, view.dynashadowsdir, view.dynashadowscol,
+                              dynacouche, isdynapix, ti, tj, serumData->fwidth,
+                              serumData->fheight);
               isdynapix[tk] = 1;
               pfr[tk] =
-                  g_serumData
-                      .dyna4cols_v2[IDfound][dynacouche * g_serumData.nocolors +
-                                             frame[tk]];
+                  view.dyna4cols[dynacouche * serumData->nocolors + frame[tk]];
             } else if (isdynapix[tk] == 0)
               pfr[tk] =
-                  g_serumData
-                      .dyna4cols_v2[IDfound][dynacouche * g_serumData.nocolors +
-                                             frame[tk]];
+                  view.dyna4cols[dynacouche * serumData->nocolors + frame[tk]];
             prot[tk * 2] = prot[tk * 2 + 1] = 0xffff;
           }
         }
@@ -1755,56 +2160,55 @@ void Colorize_Framev2(uint8_t* frame, uint32_t IDfound) {
     }
   }
   if (isextra &&
-      ((mySerum.frame32 && g_serumData.fheight_extra == 32) ||
-       (mySerum.frame64 && g_serumData.fheight_extra == 64)) &&
+      ((mySerum.frame32 && serumData->fheight_extra == 32) ||
+       (mySerum.frame64 && serumData->fheight_extra == 64)) &&
       isextrarequested) {
     // create the extra res frame
-    if (g_serumData.fheight_extra == 32) {
+    const SerumData::FrameView view = serumData->GetFrameView(IDfound, true);
+    if (serumData->fheight_extra == 32) {
       pfr = mySerum.frame32;
       mySerum.flags |= FLAG_RETURNED_32P_FRAME_OK;
       prot = mySerum.rotationsinframe32;
-      mySerum.width32 = g_serumData.fwidth_extra;
-      prt = g_serumData.colorrotations_v2_extra[IDfound];
+      mySerum.width32 = serumData->fwidth_extra;
       cshft = colorshifts32;
     } else {
       pfr = mySerum.frame64;
       mySerum.flags |= FLAG_RETURNED_64P_FRAME_OK;
       prot = mySerum.rotationsinframe64;
-      mySerum.width64 = g_serumData.fwidth_extra;
-      prt = g_serumData.colorrotations_v2_extra[IDfound];
+      mySerum.width64 = serumData->fwidth_extra;
       cshft = colorshifts64;
     }
-    memset(isdynapix, 0, g_serumData.fheight_extra * g_serumData.fwidth_extra);
-    for (tj = 0; tj < g_serumData.fheight_extra; tj++) {
-      for (ti = 0; ti < g_serumData.fwidth_extra; ti++) {
-        uint16_t tk = tj * g_serumData.fwidth_extra + ti;
+    prt = view.colorrotations;
+    const ColorRotationLookup& rotlookup =
+        GetColorRotationLookup(IDfound, prt, true);
+    memset(isdynapix, 0, serumData->fheight_extra * serumData->fwidth_extra);
+    for (tj = 0; tj < serumData->fheight_extra; tj++) {
+      for (ti = 0; ti < serumData->fwidth_extra; ti++) {
+        uint16_t tk = tj * serumData->fwidth_extra + ti;
         uint16_t tl;
-        if (g_serumData.fheight_extra == 64)
-          tl = tj / 2 * g_serumData.fwidth + ti / 2;
+        if (serumData->fheight_extra == 64)
+          tl = tj / 2 * serumData->fwidth + ti / 2;
         else
-          tl = tj * 2 * g_serumData.fwidth + ti * 2;
+          tl = tj * 2 * serumData->fwidth + ti * 2;
 
-        if ((g_serumData.backgroundIDs[IDfound][0] <
-             g_serumData.nbackgrounds) &&
-            (frame[tl] == 0) &&
-            (g_serumData.backgroundmask_extra[IDfound][tk] > 0)) {
+        if (view.backgroundframe && (frame[tl] == 0) &&
+            (view.backgroundmask[tk] > 0)) {
           if (isdynapix[tk] == 0) {
-            pfr[tk] = g_serumData.backgroundframes_v2_extra
-                          [g_serumData.backgroundIDs[IDfound][0]][tk];
-            if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                &prot[tk * 2 + 1], true)) {
+            pfr[tk] = view.backgroundframe[tk];
+            if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                &prot[tk * 2 + 1])) {
               pfr[tk] = prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                             (prot[tk * 2 + 1] + cshft[prot[tk * 2]]) %
                                 prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION]];
             }
           }
         } else {
-          uint8_t dynacouche = g_serumData.dynamasks_extra[IDfound][tk];
+          uint8_t dynacouche = view.dynamask[tk];
           if (dynacouche == 255) {
             if (isdynapix[tk] == 0) {
-              pfr[tk] = g_serumData.cframes_v2_extra[IDfound][tk];
-              if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                  &prot[tk * 2 + 1], true)) {
+              pfr[tk] = view.cframe[tk];
+              if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                  &prot[tk * 2 + 1])) {
                 pfr[tk] =
                     prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                         (prot[tk * 2 + 1] + cshft[prot[tk * 2]]) %
@@ -1813,17 +2217,16 @@ void Colorize_Framev2(uint8_t* frame, uint32_t IDfound) {
             }
           } else {
             if (frame[tl] > 0) {
-              CheckDynaShadow(pfr, IDfound, dynacouche, isdynapix, ti, tj,
-                              g_serumData.fwidth_extra,
-                              g_serumData.fheight_extra, true);
+              CheckDynaShadow(pfr, view.dynashadowsdir, view.dynashadowscol,
+                              dynacouche, isdynapix, ti, tj,
+                              serumData->fwidth_extra,
+                              serumData->fheight_extra);
               isdynapix[tk] = 1;
               pfr[tk] =
-                  g_serumData.dyna4cols_v2_extra
-                      [IDfound][dynacouche * g_serumData.nocolors + frame[tl]];
+                  view.dyna4cols[dynacouche * serumData->nocolors + frame[tl]];
             } else if (isdynapix[tk] == 0)
               pfr[tk] =
-                  g_serumData.dyna4cols_v2_extra
-                      [IDfound][dynacouche * g_serumData.nocolors + frame[tl]];
+                  view.dyna4cols[dynacouche * serumData->nocolors + frame[tl]];
             prot[tk * 2] = prot[tk * 2 + 1] = 0xffff;
           }
         }
@@ -1832,64 +2235,78 @@ void Colorize_Framev2(uint8_t* frame, uint32_t IDfound) {
   }
 }
 
-void Colorize_Spritev1(uint8_t nosprite, uint16_t frx, uint16_t fry,
-                       uint16_t spx, uint16_t spy, uint16_t wid, uint16_t hei) {
+void Serum_Context::Colorize_Spritev1(uint8_t nosprite, uint16_t frx,
+                                      uint16_t fry, uint16_t spx, uint16_t spy,
+                                      uint16_t wid, uint16_t hei) {
+  const uint8_t* spriteo = serumData->spritedescriptionso[nosprite];
+  const uint8_t* spritec = serumData->spritedescriptionsc[nosprite];
+  const uint16_t* spans = serumData->spritespans[nosprite];
   for (uint16_t tj = 0; tj < hei; tj++) {
-    for (uint16_t ti = 0; ti < wid; ti++) {
-      if (g_serumData
-              .spritedescriptionso[nosprite][(tj + spy) * MAX_SPRITE_SIZE + ti +
-                                             spx] < 255) {
-        mySerum.frame[(fry + tj) * g_serumData.fwidth + frx + ti] =
-            g_serumData
-                .spritedescriptionsc[nosprite]
-                                    [(tj + spy) * MAX_SPRITE_SIZE + ti + spx];
+    // only the opaque part of the sprite row
+    const int first = std::max(spans[(tj + spy) * 2] - spx, 0);
+    const int last = std::min(spans[(tj + spy) * 2 + 1] - spx, (int)wid);
+    for (int ti = first; ti < last; ti++) {
+      uint32_t tl = (tj + spy) * MAX_SPRITE_SIZE + ti + spx;
+      if (spriteo[tl] < 255) {
+        mySerum.frame[(fry + tj) * serumData->fwidth + frx + ti] = spritec[tl];
       }
     }
   }
 }
 
-void Colorize_Spritev2(uint8_t* oframe, uint8_t nosprite, uint16_t frx,
-                       uint16_t fry, uint16_t spx, uint16_t spy, uint16_t wid,
-                       uint16_t hei, uint32_t IDfound) {
+void Serum_Context::Colorize_Spritev2(uint8_t* oframe, uint8_t nosprite,
+                                      uint16_t frx, uint16_t fry, uint16_t spx,
+                                      uint16_t spy, uint16_t wid, uint16_t hei,
+                                      uint32_t IDfound) {
   uint16_t *pfr, *prot;
-  uint16_t* prt;
+  const uint16_t* prt;
   uint32_t* cshft;
   if (((mySerum.flags & FLAG_RETURNED_32P_FRAME_OK) &&
-       g_serumData.fheight == 32) ||
+       serumData->fheight == 32) ||
       ((mySerum.flags & FLAG_RETURNED_64P_FRAME_OK) &&
-       g_serumData.fheight == 64)) {
-    if (g_serumData.fheight == 32) {
+       serumData->fheight == 64)) {
+    if (serumData->fheight == 32) {
       pfr = mySerum.frame32;
       prot = mySerum.rotationsinframe32;
-      prt = g_serumData.colorrotations_v2[IDfound];
+      prt = serumData->colorrotations_v2[IDfound];
       cshft = colorshifts32;
     } else {
       pfr = mySerum.frame64;
       prot = mySerum.rotationsinframe64;
-      prt = g_serumData.colorrotations_v2[IDfound];
+      prt = serumData->colorrotations_v2[IDfound];
       cshft = colorshifts64;
     }
+    const ColorRotationLookup& rotlookup =
+        GetColorRotationLookup(IDfound, prt, false);
+    const uint8_t* spriteoriginal = serumData->spriteoriginal[nosprite];
+    const uint8_t* dynaspritemask = serumData->dynaspritemasks[nosprite];
+    const uint16_t* spritecolored = serumData->spritecolored[nosprite];
+    const uint16_t* dynasprite4cols = serumData->dynasprite4cols[nosprite];
+    const uint16_t* spans = serumData->spritespans[nosprite];
+    const uint16_t* bounds = serumData->spritebounds[nosprite];
     for (uint16_t tj = 0; tj < hei; tj++) {
-      for (uint16_t ti = 0; ti < wid; ti++) {
-        uint16_t tk = (fry + tj) * g_serumData.fwidth + frx + ti;
-        uint32_t tl = (tj + spy) * MAX_SPRITE_WIDTH + ti + spx;
-        uint8_t spriteref = g_serumData.spriteoriginal[nosprite][tl];
+      // only the opaque part of the sprite row, which is within the bounds
+      const int first = std::max(spans[(tj + spy) * 2] - spx, 0);
+      const int last = std::min(spans[(tj + spy) * 2 + 1] - spx, (int)wid);
+      for (int ti = first; ti < last; ti++) {
+        uint16_t tk = (fry + tj) * serumData->fwidth + frx + ti;
+        uint32_t tl =
+            (tj + spy - bounds[1]) * bounds[2] + ti + spx - bounds[0];
+        uint8_t spriteref = spriteoriginal[tl];
         if (spriteref < 255) {
-          uint8_t dynacouche = g_serumData.dynaspritemasks[nosprite][tl];
+          uint8_t dynacouche = dynaspritemask[tl];
           if (dynacouche == 255) {
-            pfr[tk] = g_serumData.spritecolored[nosprite][tl];
-            if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                &prot[tk * 2 + 1], false))
+            pfr[tk] = spritecolored[tl];
+            if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                &prot[tk * 2 + 1]))
               pfr[tk] = prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                             (prot[tk * 2 + 1] + cshft[prot[tk * 2]]) %
                                 prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION]];
           } else {
             pfr[tk] =
-                g_serumData.dynasprite4cols[nosprite]
-                                           [dynacouche * g_serumData.nocolors +
-                                            oframe[tk]];
-            if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                &prot[tk * 2 + 1], false))
+                dynasprite4cols[dynacouche * serumData->nocolors + oframe[tk]];
+            if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                &prot[tk * 2 + 1]))
               pfr[tk] = prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                             (prot[tk * 2 + 1] + cshft[prot[tk * 2]]) %
                                 prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION]];
@@ -1899,11 +2316,11 @@ void Colorize_Spritev2(uint8_t* oframe, uint8_t nosprite, uint16_t frx,
     }
   }
   if (((mySerum.flags & FLAG_RETURNED_32P_FRAME_OK) &&
-       g_serumData.fheight_extra == 32) ||
+       serumData->fheight_extra == 32) ||
       ((mySerum.flags & FLAG_RETURNED_64P_FRAME_OK) &&
-       g_serumData.fheight_extra == 64)) {
+       serumData->fheight_extra == 64)) {
     uint16_t thei, twid, tfrx, tfry, tspy, tspx;
-    if (g_serumData.fheight_extra == 32) {
+    if (serumData->fheight_extra == 32) {
       pfr = mySerum.frame32;
       prot = mySerum.rotationsinframe32;
       thei = hei / 2;
@@ -1912,7 +2329,7 @@ void Colorize_Spritev2(uint8_t* oframe, uint8_t nosprite, uint16_t frx,
       tfry = fry / 2;
       tspx = spx / 2;
       tspy = spy / 2;
-      prt = g_serumData.colorrotations_v2_extra[IDfound];
+      prt = serumData->colorrotations_v2_extra[IDfound];
       cshft = colorshifts32;
     } else {
       pfr = mySerum.frame64;
@@ -1923,40 +2340,47 @@ void Colorize_Spritev2(uint8_t* oframe, uint8_t nosprite, uint16_t frx,
       tfry = fry * 2;
       tspx = spx * 2;
       tspy = spy * 2;
-      prt = g_serumData.colorrotations_v2_extra[IDfound];
+      prt = serumData->colorrotations_v2_extra[IDfound];
       cshft = colorshifts64;
     }
-    for (uint16_t tj = 0; tj < thei; tj++) {
-      for (uint16_t ti = 0; ti < twid; ti++) {
-        uint16_t tk = (tfry + tj) * g_serumData.fwidth_extra + tfrx + ti;
-        if (g_serumData
-                .spritemask_extra[nosprite][(tj + tspy) * MAX_SPRITE_WIDTH +
-                                            ti + tspx] < 255) {
-          uint8_t dynacouche =
-              g_serumData.dynaspritemasks_extra[nosprite]
-                                               [(tj + tspy) * MAX_SPRITE_WIDTH +
-                                                ti + tspx];
+    const ColorRotationLookup& rotlookup =
+        GetColorRotationLookup(IDfound, prt, true);
+    const uint8_t* spritemask = serumData->spritemask_extra[nosprite];
+    const uint8_t* dynaspritemask =
+        serumData->dynaspritemasks_extra[nosprite];
+    const uint16_t* spritecolored = serumData->spritecolored_extra[nosprite];
+    const uint16_t* dynasprite4cols =
+        serumData->dynasprite4cols_extra[nosprite];
+    // the pixels outside of the bounds are transparent
+    const uint16_t* bounds = serumData->spritebounds_extra[nosprite];
+    const int firstRow = std::max(bounds[1] - tspy, 0);
+    const int lastRow = std::min(bounds[1] + bounds[3] - tspy, (int)thei);
+    const int firstColumn = std::max(bounds[0] - tspx, 0);
+    const int lastColumn = std::min(bounds[0] + bounds[2] - tspx, (int)twid);
+    for (int tj = firstRow; tj < lastRow; tj++) {
+      for (int ti = firstColumn; ti < lastColumn; ti++) {
+        uint16_t tk = (tfry + tj) * serumData->fwidth_extra + tfrx + ti;
+        uint32_t tm =
+            (tj + tspy - bounds[1]) * bounds[2] + ti + tspx - bounds[0];
+        if (spritemask[tm] < 255) {
+          uint8_t dynacouche = dynaspritemask[tm];
           if (dynacouche == 255) {
-            pfr[tk] =
-                g_serumData.spritecolored_extra[nosprite]
-                                               [(tj + tspy) * MAX_SPRITE_WIDTH +
-                                                ti + tspx];
-            if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                &prot[tk * 2 + 1], true))
+            pfr[tk] = spritecolored[tm];
+            if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                &prot[tk * 2 + 1]))
               pfr[tk] = prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                             (prot[tk * 2 + 1] + cshft[prot[tk * 2]]) %
                                 prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION]];
           } else {
             uint16_t tl;
-            if (g_serumData.fheight_extra == 64)
-              tl = (tj / 2 + fry) * g_serumData.fwidth + ti / 2 + frx;
+            if (serumData->fheight_extra == 64)
+              tl = (tj / 2 + fry) * serumData->fwidth + ti / 2 + frx;
             else
-              tl = (tj * 2 + fry) * g_serumData.fwidth + ti * 2 + frx;
+              tl = (tj * 2 + fry) * serumData->fwidth + ti * 2 + frx;
             pfr[tk] =
-                g_serumData.dynasprite4cols_extra
-                    [nosprite][dynacouche * g_serumData.nocolors + oframe[tl]];
-            if (ColorInRotation(IDfound, pfr[tk], &prot[tk * 2],
-                                &prot[tk * 2 + 1], true))
+                dynasprite4cols[dynacouche * serumData->nocolors + oframe[tl]];
+            if (ColorInRotation(rotlookup, pfr[tk], &prot[tk * 2],
+                                &prot[tk * 2 + 1]))
               pfr[tk] = prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION + 2 +
                             (prot[tk * 2 + 1] + cshft[prot[tk * 2]]) %
                                 prt[prot[tk * 2] * MAX_LENGTH_COLOR_ROTATION]];
@@ -1967,34 +2391,69 @@ void Colorize_Spritev2(uint8_t* oframe, uint8_t nosprite, uint16_t frx,
   }
 }
 
-void Copy_Frame_Palette(uint32_t nofr) {
-  memcpy(mySerum.palette, g_serumData.cpal[nofr], g_serumData.nccolors * 3);
+void Serum_Context::Copy_Frame_Palette(uint32_t nofr) {
+  memcpy(mySerum.palette, serumData->cpal[nofr], serumData->nccolors * 3);
+}
+
+SERUM_API void Serum_ContextSetIgnoreUnknownFramesTimeout(
+    Serum_Context* context, uint16_t milliseconds) {
+  if (!context) return;
+  context->ignoreUnknownFramesTimeout = milliseconds;
 }
 
 SERUM_API void Serum_SetIgnoreUnknownFramesTimeout(uint16_t milliseconds) {
-  ignoreUnknownFramesTimeout = milliseconds;
+  Serum_ContextSetIgnoreUnknownFramesTimeout(&g_defaultContext, milliseconds);
+}
+
+SERUM_API void Serum_ContextSetMaximumUnknownFramesToSkip(
+    Serum_Context* context, uint8_t maximum) {
+  if (!context) return;
+  context->maxFramesToSkip = maximum;
 }
 
 SERUM_API void Serum_SetMaximumUnknownFramesToSkip(uint8_t maximum) {
-  maxFramesToSkip = maximum;
+  Serum_ContextSetMaximumUnknownFramesToSkip(&g_defaultContext, maximum);
+}
+
+SERUM_API void Serum_ContextSetGenerateCRomC(Serum_Context* context,
+                                             bool generate) {
+  if (!context) return;
+  context->generateCRomC = generate;
 }
 
 SERUM_API void Serum_SetGenerateCRomC(bool generate) {
-  generateCRomC = generate;
+  Serum_ContextSetGenerateCRomC(&g_defaultContext, generate);
 }
 
-SERUM_API void Serum_SetStandardPalette(const uint8_t* palette,
-                                        const int bitDepth) {
+SERUM_API void Serum_ContextSetTemporalSpriteDetection(Serum_Context* context,
+                                                       bool enable) {
+  if (!context) return;
+  context->temporalSpriteDetection = enable;
+}
+
+SERUM_API void Serum_SetTemporalSpriteDetection(bool enable) {
+  Serum_ContextSetTemporalSpriteDetection(&g_defaultContext, enable);
+}
+
+SERUM_API void Serum_ContextSetStandardPalette(Serum_Context* context,
+                                               const uint8_t* palette,
+                                               const int bitDepth) {
+  if (!context) return;
   int palette_length = (1 << bitDepth) * 3;
   assert(palette_length < PALETTE_SIZE);
 
   if (palette_length <= PALETTE_SIZE) {
-    memcpy(standardPalette, palette, palette_length);
-    standardPaletteLength = palette_length;
+    memcpy(context->standardPalette, palette, palette_length);
+    context->standardPaletteLength = palette_length;
   }
 }
 
-uint32_t Calc_Next_Rotationv1(uint32_t now) {
+SERUM_API void Serum_SetStandardPalette(const uint8_t* palette,
+                                        const int bitDepth) {
+  Serum_ContextSetStandardPalette(&g_defaultContext, palette, bitDepth);
+}
+
+uint32_t Serum_Context::Calc_Next_Rotationv1(uint32_t now) {
   uint32_t nextrot = 0xffffffff;
   for (int ti = 0; ti < MAX_COLOR_ROTATIONS; ti++) {
     if (mySerum.rotations[ti * 3] == 255) continue;
@@ -2004,7 +2463,7 @@ uint32_t Calc_Next_Rotationv1(uint32_t now) {
   return nextrot - now;
 }
 
-uint32_t Serum_ColorizeWithMetadatav1(uint8_t* frame) {
+uint32_t Serum_Context::Serum_ColorizeWithMetadatav1(uint8_t* frame) {
   // return IDENTIFY_NO_FRAME if no new frame detected
   // return 0 if new frame with no rotation detected
   // return > 0 if new frame with rotations detected, the value is the delay
@@ -2042,7 +2501,7 @@ uint32_t Serum_ColorizeWithMetadatav1(uint8_t* frame) {
     bool isspr = Check_Spritesv1(frame, (uint32_t)lastfound, nosprite, &nspr,
                                  frx, fry, spx, spy, wid, hei);
     if (((frameID < MAX_NUMBER_FRAMES) || isspr) &&
-        g_serumData.activeframes[lastfound][0] != 0) {
+        serumData->activeframes[lastfound][0] != 0) {
       Colorize_Framev1(frame, lastfound);
       Copy_Frame_Palette(lastfound);
       {
@@ -2053,7 +2512,7 @@ uint32_t Serum_ColorizeWithMetadatav1(uint8_t* frame) {
           ti++;
         }
       }
-      memcpy(mySerum.rotations, g_serumData.colorrotations[lastfound],
+      memcpy(mySerum.rotations, serumData->colorrotations[lastfound],
              MAX_COLOR_ROTATIONS * 3);
       for (uint32_t ti = 0; ti < MAX_COLOR_ROTATIONS; ti++) {
         if (mySerum.rotations[ti * 3] == 255) {
@@ -2078,10 +2537,10 @@ uint32_t Serum_ColorizeWithMetadatav1(uint8_t* frame) {
 
       mySerum.rotationtimer = Calc_Next_Rotationv1(now);
 
-      if (g_serumData.triggerIDs[lastfound][0] != lasttriggerID ||
+      if (serumData->triggerIDs[lastfound][0] != lasttriggerID ||
           lasttriggerTimestamp < (now - PUP_TRIGGER_REPEAT_TIMEOUT)) {
         lasttriggerID = mySerum.triggerID =
-            g_serumData.triggerIDs[lastfound][0];
+            serumData->triggerIDs[lastfound][0];
         lasttriggerTimestamp = now;
       }
 
@@ -2107,7 +2566,7 @@ uint32_t Serum_ColorizeWithMetadatav1(uint8_t* frame) {
                              // rotations!
 }
 
-uint32_t Calc_Next_Rotationv2(uint32_t now) {
+uint32_t Serum_Context::Calc_Next_Rotationv2(uint32_t now) {
   uint32_t nextrot = 0xffffffff;
   for (int ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
     if (mySerum.frame32 &&
@@ -2125,32 +2584,185 @@ uint32_t Calc_Next_Rotationv2(uint32_t now) {
   return nextrot - now;
 }
 
-SERUM_API uint32_t
-Serum_ColorizeWithMetadatav2(uint8_t* frame, bool sceneFrameRequested = false) {
+void Serum_Context::Build_RotationPixelLists(void) {
+  Build_RotationPixels(rotationPixels32, mySerum.rotationsinframe32,
+                       mySerum.frame32 ? mySerum.width32 : 0, 32);
+  Build_RotationPixels(rotationPixels64, mySerum.rotationsinframe64,
+                       mySerum.frame64 ? mySerum.width64 : 0, 64);
+}
+
+void Serum_Context::Set_FullFrameDirtyRects(void) {
+  // the whole frames have changed
+  dirtyRectsFrameId = 0xffffffff;
+  if (mySerum.dirtyrects32) {
+    mySerum.ndirtyrects32 = 0;
+    if (mySerum.frame32 && mySerum.width32 > 0)
+      mySerum.dirtyrects32[mySerum.ndirtyrects32++] = {
+          0, 0, (uint16_t)mySerum.width32, 32};
+  }
+  if (mySerum.dirtyrects64) {
+    mySerum.ndirtyrects64 = 0;
+    if (mySerum.frame64 && mySerum.width64 > 0)
+      mySerum.dirtyrects64[mySerum.ndirtyrects64++] = {
+          0, 0, (uint16_t)mySerum.width64, 64};
+  }
+}
+
+// Adds r to the rects, merged with the ones it overlaps
+static void Add_DirtyRect(Serum_Dirty_Rect* rects, uint32_t& n,
+                          Serum_Dirty_Rect r) {
+  if (r.width == 0 || r.height == 0) return;
+  for (uint32_t ti = 0; ti < n;) {
+    const Serum_Dirty_Rect& o = rects[ti];
+    if (o.x >= r.x + r.width || r.x >= o.x + o.width ||
+        o.y >= r.y + r.height || r.y >= o.y + o.height) {
+      ti++;
+      continue;
+    }
+    const uint16_t x = std::min(o.x, r.x), y = std::min(o.y, r.y);
+    r = {x, y,
+         (uint16_t)(std::max(o.x + o.width, r.x + r.width) - x),
+         (uint16_t)(std::max(o.y + o.height, r.y + r.height) - y)};
+    // the union might overlap the rects already checked
+    rects[ti] = rects[--n];
+    ti = 0;
+  }
+  rects[n++] = r;
+}
+
+void Serum_Context::Set_FrameDirtyRects(uint32_t IDfound, uint8_t nspr,
+                                        const uint16_t* frx,
+                                        const uint16_t* fry,
+                                        const uint16_t* wid,
+                                        const uint16_t* hei) {
+  Serum_Dirty_Rect sprites[MAX_SPRITES_PER_FRAME];
+  for (uint8_t ti = 0; ti < nspr; ti++)
+    sprites[ti] = {frx[ti], fry[ti], wid[ti], hei[ti]};
+  const bool sameFrame = IDfound == dirtyRectsFrameId;
+  if (!sameFrame) Set_FullFrameDirtyRects();
+
+  // With the same frame ID as the frame in the buffers, only the pixels
+  // depending on the frame content and the sprites of both frames can have
+  // changed
+  const uint16_t* dynaBounds = serumData->framedynabounds[IDfound];
+  auto addRects = [&](Serum_Dirty_Rect* rects, uint32_t& nrects,
+                      uint32_t width, uint32_t height) {
+    if (!rects || !sameFrame) return;
+    nrects = 0;
+    if (width == 0) return;
+    const bool extra = height != serumData->fheight;
+    Serum_Dirty_Rect merged[2 * MAX_SPRITES_PER_FRAME + 1];
+    uint32_t nmerged = 0;
+    const uint16_t* box = &dynaBounds[extra ? 4 : 0];
+    Add_DirtyRect(merged, nmerged, {box[0], box[1], box[2], box[3]});
+    for (uint8_t ti = 0; ti < ndirtySprites + nspr; ti++) {
+      Serum_Dirty_Rect r =
+          ti < ndirtySprites ? dirtySprites[ti] : sprites[ti - ndirtySprites];
+      if (extra && height > serumData->fheight) {
+        r = {(uint16_t)(r.x * 2), (uint16_t)(r.y * 2),
+             (uint16_t)(r.width * 2), (uint16_t)(r.height * 2)};
+      } else if (extra) {
+        // rounded outwards
+        r = {(uint16_t)(r.x / 2), (uint16_t)(r.y / 2),
+             (uint16_t)((r.x + r.width + 1) / 2 - r.x / 2),
+             (uint16_t)((r.y + r.height + 1) / 2 - r.y / 2)};
+      }
+      Add_DirtyRect(merged, nmerged, r);
+    }
+    if (nmerged > (uint32_t)MAX_DIRTY_RECTS) {
+      rects[nrects++] = {0, 0, (uint16_t)width, (uint16_t)height};
+      return;
+    }
+    for (uint32_t ti = 0; ti < nmerged; ti++) rects[nrects++] = merged[ti];
+  };
+  addRects(mySerum.dirtyrects32, mySerum.ndirtyrects32,
+           mySerum.frame32 ? mySerum.width32 : 0, 32);
+  addRects(mySerum.dirtyrects64, mySerum.ndirtyrects64,
+           mySerum.frame64 ? mySerum.width64 : 0, 64);
+
+  dirtyRectsFrameId = IDfound;
+  memcpy(dirtySprites, sprites, nspr * sizeof(Serum_Dirty_Rect));
+  ndirtySprites = nspr;
+}
+
+uint32_t Serum_Context::Colorize_Monochrome(uint8_t* frame) {
+  // apply standard palette
+  for (uint16_t y = 0; y < serumData->fheight; y++) {
+    for (uint16_t x = 0; x < serumData->fwidth; x++) {
+      if (serumData->nocolors < 16)
+        mySerum.frame32[y * serumData->fwidth + x] =
+            greyscale_4[frame[y * serumData->fwidth + x]];
+      else
+        mySerum.frame32[y * serumData->fwidth + x] =
+            greyscale_16[frame[y * serumData->fwidth + x]];
+    }
+  }
+
+  mySerum.flags = FLAG_RETURNED_32P_FRAME_OK;
+  mySerum.width32 = serumData->fwidth;
+  mySerum.width64 = 0;
+  mySerum.triggerID = 0xffffffff;
+  mySerum.frameID = 0xfffffffd;  // monochrome frame ID
+  Build_RotationPixelLists();
+  Set_FullFrameDirtyRects();
+
+  // disable render features like rotations
+  for (uint8_t ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
+    colorrotnexttime32[ti] = 0;
+    colorrotnexttime64[ti] = 0;
+  }
+  mySerum.rotationtimer = 0;
+
+  return 0;  // "colorized" frame with no rotations
+}
+
+uint32_t Serum_Context::Colorize_WhileLoading(uint8_t* frame) {
+  if (!mySerum.frame32) {
+    // the frame size is needed first
+    {
+      std::lock_guard<std::mutex> lock(asyncLoad->mutex);
+      serumData->fwidth = asyncLoad->width;
+      serumData->fheight = asyncLoad->height;
+      serumData->nocolors = asyncLoad->nocolors;
+    }
+    if (serumData->fwidth == 0) return IDENTIFY_NO_FRAME;
+    mySerum.frame32 = (uint16_t*)malloc(
+        serumData->fwidth * serumData->fheight * sizeof(uint16_t));
+    if (!mySerum.frame32) return IDENTIFY_NO_FRAME;
+  }
+  return Colorize_Monochrome(frame);
+}
+
+uint32_t Serum_Context::Serum_ColorizeWithMetadatav2(uint8_t* frame,
+                                                     bool sceneFrameRequested) {
   // return IDENTIFY_NO_FRAME if no new frame detected
   // return 0 if new frame with no rotation detected
   // return > 0 if new frame with rotations detected, the value is the delay
   // before the first rotation in ms
   mySerum.triggerID = 0xffffffff;
   mySerum.frameID = IDENTIFY_NO_FRAME;
+  mySerum.ndirtyrects32 = mySerum.ndirtyrects64 = 0;
 
   // Let's first identify the incoming frame among the ones we have in the crom
   uint32_t frameID = Identify_Frame(frame);
   uint32_t now = GetMonotonicTimeMs();
   bool rotationIsScene = false;
   if (is_real_machine() && !showStatusMessages) {
-    showStatusMessages = (g_serumData.triggerIDs[lastfound][0] > 0xff98 &&
-                          g_serumData.triggerIDs[lastfound][0] < 0xffffffff);
+    uint32_t triggerID = GetTriggerID(lastfound);
+    showStatusMessages = (triggerID > 0xff98 && triggerID < 0xffffffff);
     if (showStatusMessages) ignoreUnknownFramesTimeout = 0x2000;
   }
   if (frameID != IDENTIFY_NO_FRAME && !showStatusMessages) {
-    monochromeMode = (g_serumData.triggerIDs[lastfound][0] == 65432);
-    if (g_serumData.triggerIDs[lastfound][0] > 0xff98)
-      g_serumData.triggerIDs[lastfound][0] = 0xffffffff;
+    uint32_t triggerID = GetTriggerID(lastfound);
+    monochromeMode = (triggerID == 65432);
+    if (triggerID > 0xff98) {
+      if (triggerCleared.size() < serumData->nframes)
+        triggerCleared.resize(serumData->nframes, false);
+      triggerCleared[lastfound] = true;
+    }
 
-    if (!monochromeMode && g_serumData.sceneGenerator->isActive() &&
-        !sceneFrameRequested && sceneCurrentFrame < sceneFrameCount &&
-        !sceneInterruptable) {
+    if (!monochromeMode && sceneGenerator.isActive() && !sceneFrameRequested &&
+        sceneCurrentFrame < sceneFrameCount && !sceneInterruptable) {
       // Scene is active and not interruptable
       return IDENTIFY_NO_FRAME;
     }
@@ -2175,18 +2787,18 @@ Serum_ColorizeWithMetadatav2(uint8_t* frame, bool sceneFrameRequested = false) {
 
     // lastfound is set by Identify_Frame, check if we have a new PUP trigger
     if (!monochromeMode && !sceneFrameRequested &&
-        (g_serumData.triggerIDs[lastfound][0] != lasttriggerID ||
+        (GetTriggerID(lastfound) != lasttriggerID ||
          lasttriggerTimestamp < (now - PUP_TRIGGER_REPEAT_TIMEOUT))) {
-      lasttriggerID = mySerum.triggerID = g_serumData.triggerIDs[lastfound][0];
+      lasttriggerID = mySerum.triggerID = GetTriggerID(lastfound);
       lasttriggerTimestamp = now;
 
-      if (g_serumData.sceneGenerator->isActive() &&
-          lasttriggerID < 0xffffffff) {
-        if (g_serumData.sceneGenerator->getSceneInfo(
-                lasttriggerID, sceneFrameCount, sceneDurationPerFrame,
-                sceneInterruptable, sceneStartImmediately, sceneRepeatCount,
-                sceneEndFrame)) {
-          memcpy(lastFrame, frame, g_serumData.fwidth * g_serumData.fheight);
+      if (sceneGenerator.isActive() && lasttriggerID < 0xffffffff) {
+        if (sceneGenerator.getSceneInfo(lasttriggerID, sceneFrameCount,
+                                        sceneDurationPerFrame,
+                                        sceneInterruptable,
+                                        sceneStartImmediately,
+                                        sceneRepeatCount, sceneEndFrame)) {
+          memcpy(lastFrame, frame, serumData->fwidth * serumData->fheight);
           // Log(DMDUtil_LogLevel_DEBUG, "Serum: trigger ID %lu found in scenes,
           // frame count=%d, duration=%dms",
           //     m_pSerum->triggerID, sceneFrameCount, sceneDurationPerFrame);
@@ -2194,8 +2806,8 @@ Serum_ColorizeWithMetadatav2(uint8_t* frame, bool sceneFrameRequested = false) {
           if (sceneStartImmediately) {
             // Overwrite the current frame with the first scene frame, ignore
             // the result
-            g_serumData.sceneGenerator->generateFrame(
-                lasttriggerID, sceneCurrentFrame++, frame);
+            sceneGenerator.generateFrame(lasttriggerID, sceneCurrentFrame++,
+                                         frame);
           }
           mySerum.rotationtimer = sceneDurationPerFrame;
           rotationIsScene = true;
@@ -2212,7 +2824,7 @@ Serum_ColorizeWithMetadatav2(uint8_t* frame, bool sceneFrameRequested = false) {
     bool isspr = Check_Spritesv2(frame, lastfound, nosprite, &nspr, frx, fry,
                                  spx, spy, wid, hei);
     if (((frameID < MAX_NUMBER_FRAMES) || isspr) &&
-        g_serumData.activeframes[lastfound][0] != 0) {
+        serumData->activeframes[lastfound][0] != 0) {
       // the frame identified is not the same as the preceding
       Colorize_Framev2(frame, lastfound);
       uint8_t ti = 0;
@@ -2221,16 +2833,18 @@ Serum_ColorizeWithMetadatav2(uint8_t* frame, bool sceneFrameRequested = false) {
                           spy[ti], wid[ti], hei[ti], lastfound);
         ti++;
       }
+      Build_RotationPixelLists();
+      Set_FrameDirtyRects(lastfound, nspr, frx, fry, wid, hei);
 
       // Skip rotations if the scene is active
       if (sceneCurrentFrame >= sceneFrameCount) {
         uint16_t *pcr32, *pcr64;
-        if (g_serumData.fheight == 32) {
-          pcr32 = g_serumData.colorrotations_v2[lastfound];
-          pcr64 = g_serumData.colorrotations_v2_extra[lastfound];
+        if (serumData->fheight == 32) {
+          pcr32 = serumData->colorrotations_v2[lastfound];
+          pcr64 = serumData->colorrotations_v2_extra[lastfound];
         } else {
-          pcr32 = g_serumData.colorrotations_v2_extra[lastfound];
-          pcr64 = g_serumData.colorrotations_v2[lastfound];
+          pcr32 = serumData->colorrotations_v2_extra[lastfound];
+          pcr64 = serumData->colorrotations_v2[lastfound];
         }
 
         bool isRotation = false;
@@ -2303,13 +2917,12 @@ Serum_ColorizeWithMetadatav2(uint8_t* frame, bool sceneFrameRequested = false) {
         }
       }
 
-      if (0 == mySerum.rotationtimer &&
-          g_serumData.sceneGenerator->isActive() && !sceneFrameRequested &&
-          sceneCurrentFrame >= sceneFrameCount &&
-          g_serumData.sceneGenerator->getAutoStartSceneInfo(
+      if (0 == mySerum.rotationtimer && sceneGenerator.isActive() &&
+          !sceneFrameRequested && sceneCurrentFrame >= sceneFrameCount &&
+          sceneGenerator.getAutoStartSceneInfo(
               sceneFrameCount, sceneDurationPerFrame, sceneInterruptable,
               sceneStartImmediately, sceneRepeatCount, sceneEndFrame)) {
-        mySerum.rotationtimer = g_serumData.sceneGenerator->getAutoStartTimer();
+        mySerum.rotationtimer = sceneGenerator.getAutoStartTimer();
         rotationIsScene = true;
       }
 
@@ -2323,49 +2936,43 @@ Serum_ColorizeWithMetadatav2(uint8_t* frame, bool sceneFrameRequested = false) {
        (now - lastframe_found) >= ignoreUnknownFramesTimeout) ||
       (maxFramesToSkip && (frameID == IDENTIFY_NO_FRAME) &&
        (++framesSkippedCounter >= maxFramesToSkip))) {
-    // apply standard palette
-    for (uint16_t y = 0; y < g_serumData.fheight; y++) {
-      for (uint16_t x = 0; x < g_serumData.fwidth; x++) {
-        if (g_serumData.nocolors < 16)
-          mySerum.frame32[y * g_serumData.fwidth + x] =
-              greyscale_4[frame[y * g_serumData.fwidth + x]];
-        else
-          mySerum.frame32[y * g_serumData.fwidth + x] =
-              greyscale_16[frame[y * g_serumData.fwidth + x]];
-      }
-    }
-
-    mySerum.flags = FLAG_RETURNED_32P_FRAME_OK;
-    mySerum.width32 = g_serumData.fwidth;
-    mySerum.width64 = 0;
-    mySerum.triggerID = 0xffffffff;
-    mySerum.frameID = 0xfffffffd;  // monochrome frame ID
-
-    // disable render features like rotations
-    for (uint8_t ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
-      colorrotnexttime32[ti] = 0;
-      colorrotnexttime64[ti] = 0;
-    }
-    mySerum.rotationtimer = 0;
-
-    return 0;  // "colorized" frame with no rotations
+    return Colorize_Monochrome(frame);
   }
 
   return IDENTIFY_NO_FRAME;  // no new frame, client has to update rotations!
 }
 
-SERUM_API uint32_t Serum_Colorize(uint8_t* frame) {
+uint32_t Serum_Context::Colorize(uint8_t* frame) {
   // return IDENTIFY_NO_FRAME if no new frame detected
   // return 0 if new frame with no rotation detected
   // return > 0 if new frame with rotations detected, the value is the delay
   // before the first rotation in ms
-  if (g_serumData.SerumVersion == SERUM_V2)
+  if (asyncLoad && !FinishAsyncLoad(false)) return Colorize_WhileLoading(frame);
+  if (serumData->SerumVersion == SERUM_V2)
     return Serum_ColorizeWithMetadatav2(frame);
   else
     return Serum_ColorizeWithMetadatav1(frame);
 }
 
-uint32_t Serum_ApplyRotationsv1(void) {
+SERUM_API uint32_t Serum_ColorizeWithMetadatav2(
+    uint8_t* frame, bool sceneFrameRequested = false) {
+  if (g_defaultContext.asyncLoad && !g_defaultContext.FinishAsyncLoad(false))
+    return g_defaultContext.Colorize(frame);
+  return g_defaultContext.Serum_ColorizeWithMetadatav2(frame,
+                                                       sceneFrameRequested);
+}
+
+SERUM_API uint32_t Serum_Colorize(uint8_t* frame) {
+  return g_defaultContext.Colorize(frame);
+}
+
+SERUM_API uint32_t Serum_ContextColorize(Serum_Context* context,
+                                         uint8_t* frame) {
+  if (!context) return IDENTIFY_NO_FRAME;
+  return context->Colorize(frame);
+}
+
+uint32_t Serum_Context::Serum_ApplyRotationsv1(void) {
   uint32_t isrotation = 0;
   uint32_t now = GetMonotonicTimeMs();
   for (int ti = 0; ti < MAX_COLOR_ROTATIONS; ti++) {
@@ -2400,14 +3007,15 @@ uint32_t Serum_ApplyRotationsv1(void) {
                         // if not, just the delay to the next rotation
 }
 
-uint32_t Serum_ApplyRotationsv2(void) {
+uint32_t Serum_Context::Serum_ApplyRotationsv2(void) {
   // rotation[0] = number of colors in rotation
   // rotation[1] = delay in ms between each color change
   // rotation[2..n] = color indexes
 
-  if (g_serumData.sceneGenerator->isActive() &&
-      sceneCurrentFrame < sceneFrameCount) {
-    uint16_t result = g_serumData.sceneGenerator->generateFrame(
+  mySerum.ndirtyrects32 = mySerum.ndirtyrects64 = 0;
+
+  if (sceneGenerator.isActive() && sceneCurrentFrame < sceneFrameCount) {
+    uint16_t result = sceneGenerator.generateFrame(
         lasttriggerID, sceneCurrentFrame, sceneFrame);
     // if result is 0xffff, the frame was generated and we can go
     if (0xffff == result) {
@@ -2439,7 +3047,7 @@ uint32_t Serum_ApplyRotationsv2(void) {
 
           case 2:  // previous frame before the scene
             if (lastfound < MAX_NUMBER_FRAMES &&
-                g_serumData.activeframes[lastfound][0] != 0) {
+                serumData->activeframes[lastfound][0] != 0) {
               Serum_ColorizeWithMetadatav2(lastFrame);
             } else {
               if (mySerum.frame32)
@@ -2462,6 +3070,7 @@ uint32_t Serum_ApplyRotationsv2(void) {
       sceneFrameCount = 0;  // error generating scene frame, stop the scene
       mySerum.rotationtimer = 0;
     }
+    Set_FullFrameDirtyRects();
     return (mySerum.rotationtimer & 0xffff) | FLAG_RETURNED_V2_ROTATED32 |
            FLAG_RETURNED_V2_ROTATED64 |
            FLAG_RETURNED_V2_SCENE;  // scene frame, so we consider both frames
@@ -2473,8 +3082,21 @@ uint32_t Serum_ApplyRotationsv2(void) {
   uint32_t now = GetMonotonicTimeMs();
   if (mySerum.frame32) {
     sizeframe = 32 * mySerum.width32;
-    if (mySerum.modifiedelements32)
-      memset(mySerum.modifiedelements32, 0, sizeframe);
+    RotationPixels& rp = rotationPixels32;
+    if (mySerum.modifiedelements32) {
+      if (rp.clearModified) {
+        memset(mySerum.modifiedelements32, 0, sizeframe);
+        rp.clearModified = false;
+      } else {
+        // only reset the pixels of the rotations applied last time
+        for (int ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
+          if (!(rp.lastRotated & (1 << ti))) continue;
+          for (uint32_t tk = rp.start[ti]; tk < rp.start[ti + 1]; tk++)
+            mySerum.modifiedelements32[rp.index[tk]] = 0;
+        }
+      }
+    }
+    rp.lastRotated = 0;
     for (int ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
       if (mySerum.rotations32[ti * MAX_LENGTH_COLOR_ROTATION] == 0 ||
           mySerum.rotations32[ti * MAX_LENGTH_COLOR_ROTATION + 1] == 0)
@@ -2489,25 +3111,39 @@ uint32_t Serum_ApplyRotationsv2(void) {
         colorrotnexttime32[ti] =
             now + mySerum.rotations32[ti * MAX_LENGTH_COLOR_ROTATION + 1];
         isrotation |= FLAG_RETURNED_V2_ROTATED32;
-        for (uint32_t tj = 0; tj < sizeframe; tj++) {
-          if (mySerum.rotationsinframe32[tj * 2] == ti) {
-            // if we have a pixel which is part of this rotation, we modify it
-            mySerum.frame32[tj] =
-                mySerum.rotations32
-                    [ti * MAX_LENGTH_COLOR_ROTATION + 2 +
-                     (mySerum.rotationsinframe32[tj * 2 + 1] +
-                      colorshifts32[ti]) %
-                         mySerum.rotations32[ti * MAX_LENGTH_COLOR_ROTATION]];
-            if (mySerum.modifiedelements32) mySerum.modifiedelements32[tj] = 1;
-          }
+        rp.lastRotated |= 1 << ti;
+        if (mySerum.dirtyrects32 && rp.start[ti + 1] > rp.start[ti])
+          mySerum.dirtyrects32[mySerum.ndirtyrects32++] = rp.bounds[ti];
+        // modify the pixels which are part of this rotation
+        const uint16_t* prt =
+            &mySerum.rotations32[ti * MAX_LENGTH_COLOR_ROTATION];
+        for (uint32_t tk = rp.start[ti]; tk < rp.start[ti + 1]; tk++) {
+          uint16_t tj = rp.index[tk];
+          if (tj >= sizeframe) break;
+          mySerum.frame32[tj] =
+              prt[2 + (rp.position[tk] + colorshifts32[ti]) % prt[0]];
+          if (mySerum.modifiedelements32) mySerum.modifiedelements32[tj] = 1;
         }
       }
     }
   }
   if (mySerum.frame64) {
     sizeframe = 64 * mySerum.width64;
-    if (mySerum.modifiedelements64)
-      memset(mySerum.modifiedelements64, 0, sizeframe);
+    RotationPixels& rp = rotationPixels64;
+    if (mySerum.modifiedelements64) {
+      if (rp.clearModified) {
+        memset(mySerum.modifiedelements64, 0, sizeframe);
+        rp.clearModified = false;
+      } else {
+        // only reset the pixels of the rotations applied last time
+        for (int ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
+          if (!(rp.lastRotated & (1 << ti))) continue;
+          for (uint32_t tk = rp.start[ti]; tk < rp.start[ti + 1]; tk++)
+            mySerum.modifiedelements64[rp.index[tk]] = 0;
+        }
+      }
+    }
+    rp.lastRotated = 0;
     for (int ti = 0; ti < MAX_COLOR_ROTATION_V2; ti++) {
       if (mySerum.rotations64[ti * MAX_LENGTH_COLOR_ROTATION] == 0 ||
           mySerum.rotations64[ti * MAX_LENGTH_COLOR_ROTATION + 1] == 0)
@@ -2522,17 +3158,18 @@ uint32_t Serum_ApplyRotationsv2(void) {
         colorrotnexttime64[ti] =
             now + mySerum.rotations64[ti * MAX_LENGTH_COLOR_ROTATION + 1];
         isrotation |= FLAG_RETURNED_V2_ROTATED64;
-        for (uint32_t tj = 0; tj < sizeframe; tj++) {
-          if (mySerum.rotationsinframe64[tj * 2] == ti) {
-            // if we have a pixel which is part of this rotation, we modify it
-            mySerum.frame64[tj] =
-                mySerum.rotations64
-                    [ti * MAX_LENGTH_COLOR_ROTATION + 2 +
-                     (mySerum.rotationsinframe64[tj * 2 + 1] +
-                      colorshifts64[ti]) %
-                         mySerum.rotations64[ti * MAX_LENGTH_COLOR_ROTATION]];
-            if (mySerum.modifiedelements64) mySerum.modifiedelements64[tj] = 1;
-          }
+        rp.lastRotated |= 1 << ti;
+        if (mySerum.dirtyrects64 && rp.start[ti + 1] > rp.start[ti])
+          mySerum.dirtyrects64[mySerum.ndirtyrects64++] = rp.bounds[ti];
+        // modify the pixels which are part of this rotation
+        const uint16_t* prt =
+            &mySerum.rotations64[ti * MAX_LENGTH_COLOR_ROTATION];
+        for (uint32_t tk = rp.start[ti]; tk < rp.start[ti + 1]; tk++) {
+          uint16_t tj = rp.index[tk];
+          if (tj >= sizeframe) break;
+          mySerum.frame64[tj] =
+              prt[2 + (rp.position[tk] + colorshifts64[ti]) % prt[0]];
+          if (mySerum.modifiedelements64) mySerum.modifiedelements64[tj] = 1;
         }
       }
     }
@@ -2551,8 +3188,9 @@ uint32_t Serum_ApplyRotationsv2(void) {
                       // lowest word
 }
 
-SERUM_API uint32_t Serum_Rotate(void) {
-  if (g_serumData.SerumVersion == SERUM_V2) {
+uint32_t Serum_Context::Rotate(void) {
+  if (asyncLoad && !FinishAsyncLoad(false)) return 0;
+  if (serumData->SerumVersion == SERUM_V2) {
     return Serum_ApplyRotationsv2();
   } else {
     return Serum_ApplyRotationsv1();
@@ -2560,52 +3198,120 @@ SERUM_API uint32_t Serum_Rotate(void) {
   return 0;
 }
 
-SERUM_API void Serum_DisableColorization() { enabled = false; }
+SERUM_API uint32_t Serum_Rotate(void) { return g_defaultContext.Rotate(); }
+
+SERUM_API uint32_t Serum_ContextRotate(Serum_Context* context) {
+  if (!context) return 0;
+  return context->Rotate();
+}
+
+SERUM_API void Serum_ContextDisableColorization(Serum_Context* context) {
+  if (!context) return;
+  context->enabled = false;
+}
 
-SERUM_API void Serum_EnableColorization() { enabled = true; }
+SERUM_API void Serum_DisableColorization() {
+  Serum_ContextDisableColorization(&g_defaultContext);
+}
+
+SERUM_API void Serum_ContextEnableColorization(Serum_Context* context) {
+  if (!context) return;
+  context->enabled = true;
+}
+
+SERUM_API void Serum_EnableColorization() {
+  Serum_ContextEnableColorization(&g_defaultContext);
+}
+
+SERUM_API bool Serum_ContextScene_ParseCSV(Serum_Context* context,
+                                           const char* const csv_filename) {
+  if (!context) return false;
+  return context->sceneGenerator.parseCSV(csv_filename);
+}
 
 SERUM_API bool Serum_Scene_ParseCSV(const char* const csv_filename) {
-  if (!g_serumData.sceneGenerator) return false;
-  return g_serumData.sceneGenerator->parseCSV(csv_filename);
+  return Serum_ContextScene_ParseCSV(&g_defaultContext, csv_filename);
+}
+
+SERUM_API bool Serum_ContextScene_GenerateDump(Serum_Context* context,
+                                               const char* const dump_filename,
+                                               int id) {
+  if (!context) return false;
+  return context->sceneGenerator.generateDump(dump_filename, id);
 }
 
 SERUM_API bool Serum_Scene_GenerateDump(const char* const dump_filename,
                                         int id) {
-  if (!g_serumData.sceneGenerator) return false;
-  return g_serumData.sceneGenerator->generateDump(dump_filename, id);
+  return Serum_ContextScene_GenerateDump(&g_defaultContext, dump_filename, id);
+}
+
+SERUM_API bool Serum_ContextScene_GetInfo(
+    Serum_Context* context, uint16_t sceneId, uint16_t* frameCount,
+    uint16_t* durationPerFrame, bool* interruptable, bool* startImmediately,
+    uint8_t* repeat, uint8_t* endFrame) {
+  if (!context) return false;
+  return context->sceneGenerator.getSceneInfo(
+      sceneId, *frameCount, *durationPerFrame, *interruptable,
+      *startImmediately, *repeat, *endFrame);
 }
 
 SERUM_API bool Serum_Scene_GetInfo(uint16_t sceneId, uint16_t* frameCount,
                                    uint16_t* durationPerFrame,
                                    bool* interruptable, bool* startImmediately,
                                    uint8_t* repeat, uint8_t* endFrame) {
-  if (!g_serumData.sceneGenerator) return false;
-  return g_serumData.sceneGenerator->getSceneInfo(
-      sceneId, *frameCount, *durationPerFrame, *interruptable,
-      *startImmediately, *repeat, *endFrame);
+  return Serum_ContextScene_GetInfo(&g_defaultContext, sceneId, frameCount,
+                                    durationPerFrame, interruptable,
+                                    startImmediately, repeat, endFrame);
+}
+
+SERUM_API bool Serum_ContextScene_GenerateFrame(Serum_Context* context,
+                                                uint16_t sceneId,
+                                                uint16_t frameIndex,
+                                                uint8_t* buffer, int group) {
+  if (!context) return false;
+  return (0xffff == context->sceneGenerator.generateFrame(
+                        sceneId, frameIndex, buffer, group, true));
 }
 
 SERUM_API bool Serum_Scene_GenerateFrame(uint16_t sceneId, uint16_t frameIndex,
                                          uint8_t* buffer, int group) {
-  if (!g_serumData.sceneGenerator) return false;
-  return (0xffff == g_serumData.sceneGenerator->generateFrame(
-                        sceneId, frameIndex, buffer, group, true));
+  return Serum_ContextScene_GenerateFrame(&g_defaultContext, sceneId,
+                                          frameIndex, buffer, group);
+}
+
+SERUM_API void Serum_ContextScene_SetDepth(Serum_Context* context,
+                                           uint8_t depth) {
+  if (!context) return;
+  context->sceneGenerator.setDepth(depth);
 }
 
 SERUM_API void Serum_Scene_SetDepth(uint8_t depth) {
-  if (g_serumData.sceneGenerator) g_serumData.sceneGenerator->setDepth(depth);
+  Serum_ContextScene_SetDepth(&g_defaultContext, depth);
+}
+
+SERUM_API int Serum_ContextScene_GetDepth(Serum_Context* context) {
+  if (!context) return 0;
+  return context->sceneGenerator.getDepth();
 }
 
 SERUM_API int Serum_Scene_GetDepth(void) {
-  if (!g_serumData.sceneGenerator) return 0;
-  return g_serumData.sceneGenerator->getDepth();
+  return Serum_ContextScene_GetDepth(&g_defaultContext);
+}
+
+SERUM_API bool Serum_ContextScene_IsActive(Serum_Context* context) {
+  if (!context) return false;
+  return context->sceneGenerator.isActive();
 }
 
 SERUM_API bool Serum_Scene_IsActive(void) {
-  if (!g_serumData.sceneGenerator) return false;
-  return g_serumData.sceneGenerator->isActive();
+  return Serum_ContextScene_IsActive(&g_defaultContext);
+}
+
+SERUM_API void Serum_ContextScene_Reset(Serum_Context* context) {
+  if (!context) return;
+  context->sceneGenerator.Reset();
 }
 
 SERUM_API void Serum_Scene_Reset(void) {
-  if (g_serumData.sceneGenerator) g_serumData.sceneGenerator->Reset();
+  Serum_ContextScene_Reset(&g_defaultContext);
 }
@@ -10,9 +10,20 @@
 
 #include "serum.h"
 
+/** @brief Opaque handle to an independent Serum decoder
+ *
+ *  A context holds a loaded Serum file and all the colorization state. The
+ *  Serum_Context*() functions can be used from different threads at the same
+ *  time as long as each context is only used by one thread at a time. The
+ *  other functions work on a default context.
+ */
+typedef struct Serum_Context Serum_Context;
+
 /** @brief Set the log callback
  *
- *  Set the log callback.
+ *  Set the log callback. It is also called from the background threads
+ * loading a Serum file or writing a cROMc file. A Serum file which is already
+ * loaded keeps logging its data through the callback set when it was loaded.
  *
  *  @param callback
  *  @param userData
@@ -30,6 +41,8 @@ SERUM_API void Serum_SetLogCallback(Serum_LogCallback callback,
  * if available) / FLAG_REQUEST_64P_FRAMES (same for 64-pixel-high frame) /
  * FLAG_REQUEST_FILL_MODIFIED_ELEMENTS (Serum_Rotate() fills the
  * modifiedelementsXX buffers to know which points have changed in the rotation)
+ * / FLAG_REQUEST_DIRTY_RECTS (Serum_Colorize() and Serum_Rotate() fill the
+ * dirtyrectsXX arrays with the regions of the frames that have changed)
  *
  *  @return A pointer to the Serum_Frame_Struc as described in the serum.h file
  * (to keep and read all along the use of the loaded Serum)
@@ -37,6 +50,28 @@ SERUM_API void Serum_SetLogCallback(Serum_LogCallback callback,
 SERUM_API Serum_Frame_Struc* Serum_Load(const char* const altcolorpath,
                                         const char* const romname,
                                         uint8_t flags);
+
+/** @brief Load a Serum file on a worker thread
+ *
+ *  Same as Serum_Load(), but returns immediately. Until the load has
+ * finished, Serum_Colorize() returns greyscale frames (as soon as the frame
+ * size is known) and switches over to the loaded Serum file with its first
+ * call after the load finished. Serum_Load() and Serum_Dispose() wait for a
+ * running load.
+ *
+ *  @param callback: optional, called on the worker thread with the current
+ * phase (SERUM_LOAD_*) and its percentage done. It must not call any Serum
+ * function.
+ *  @param userData: passed to the callback
+ *
+ *  @return A pointer to the Serum_Frame_Struc, which describes the loaded
+ * Serum file once SERUM_LOAD_DONE has been reported, or NULL if the load
+ * couldn't be started
+ */
+SERUM_API Serum_Frame_Struc* Serum_LoadAsync(
+    const char* const altcolorpath, const char* const romname, uint8_t flags,
+    Serum_LoadProgressCallback callback, const void* userData);
+
 SERUM_API void Serum_SetIgnoreUnknownFramesTimeout(uint16_t milliseconds);
 
 SERUM_API void Serum_SetMaximumUnknownFramesToSkip(uint8_t maximum);
@@ -46,10 +81,75 @@ SERUM_API void Serum_SetStandardPalette(const uint8_t* palette,
 
 SERUM_API void Serum_SetGenerateCRomC(bool generate);
 
+/** @brief Same as the functions above for the given context
+ */
+SERUM_API void Serum_ContextSetIgnoreUnknownFramesTimeout(
+    Serum_Context* context, uint16_t milliseconds);
+
+SERUM_API void Serum_ContextSetMaximumUnknownFramesToSkip(
+    Serum_Context* context, uint8_t maximum);
+
+SERUM_API void Serum_ContextSetStandardPalette(Serum_Context* context,
+                                               const uint8_t* palette,
+                                               const int bitDepth);
+
+SERUM_API void Serum_ContextSetGenerateCRomC(Serum_Context* context,
+                                             bool generate);
+
+/** @brief Reuse the sprite detection of the previous frame
+ *
+ *  While the same frame is identified, the sprites are only looked for again
+ * in the rows of the frame which changed since the previous one. The sprites
+ * found are the same as without it. Off by default.
+ *
+ *  @param enable: true to turn it on
+ */
+SERUM_API void Serum_SetTemporalSpriteDetection(bool enable);
+
+/** @brief Same as Serum_SetTemporalSpriteDetection() for the given context
+ */
+SERUM_API void Serum_ContextSetTemporalSpriteDetection(Serum_Context* context,
+                                                       bool enable);
+
 /** @brief Release the content and memory of the loaded Serum file.
+ *
+ *  Waits for a cROMc file which is still written in the background.
  */
 SERUM_API void Serum_Dispose(void);
 
+/** @brief Create a new, empty Serum context
+ *
+ *  The log callback set with Serum_SetLogCallback() at that time is used.
+ *
+ *  @return The context, to release with Serum_DestroyContext(), or NULL if
+ * out of memory
+ */
+SERUM_API Serum_Context* Serum_CreateContext(void);
+
+/** @brief Release a context and the Serum file loaded in it
+ */
+SERUM_API void Serum_DestroyContext(Serum_Context* context);
+
+/** @brief Same as Serum_Load() for the given context
+ *
+ *  Contexts loading the same cROMc file with the same frame flags share its
+ * read-only data, only the colorization state is kept per context.
+ *
+ *  @return A pointer to the Serum_Frame_Struc of this context, valid until
+ * the context is destroyed or another file is loaded in it
+ */
+SERUM_API Serum_Frame_Struc* Serum_ContextLoad(Serum_Context* context,
+                                               const char* const altcolorpath,
+                                               const char* const romname,
+                                               uint8_t flags);
+
+/** @brief Same as Serum_LoadAsync() for the given context
+ */
+SERUM_API Serum_Frame_Struc* Serum_ContextLoadAsync(
+    Serum_Context* context, const char* const altcolorpath,
+    const char* const romname, uint8_t flags,
+    Serum_LoadProgressCallback callback, const void* userData);
+
 /** @brief Colorize a frame and set the values in the Serum_Frame_Struc
  * (corresponding to the pointer returned at Serum_Load() time)
  *
@@ -62,6 +162,11 @@ SERUM_API void Serum_Dispose(void);
  */
 SERUM_API uint32_t Serum_Colorize(uint8_t* frame);
 
+/** @brief Same as Serum_Colorize() for the given context
+ */
+SERUM_API uint32_t Serum_ContextColorize(Serum_Context* context,
+                                         uint8_t* frame);
+
 /** @brief Perform the color rotations of the current frame. For v1, it modifies
  * "palette", for v2, it modifies "frame32" and/or "frame64"
  *
@@ -72,10 +177,21 @@ SERUM_API uint32_t Serum_Colorize(uint8_t* frame);
  */
 SERUM_API uint32_t Serum_Rotate(void);
 
+/** @brief Same as Serum_Rotate() for the given context
+ */
+SERUM_API uint32_t Serum_ContextRotate(Serum_Context* context);
+
 SERUM_API void Serum_DisableColorization(void);
 
 SERUM_API void Serum_EnableColorization(void);
 
+/** @brief Same as Serum_DisableColorization() and Serum_EnableColorization()
+ * for the given context
+ */
+SERUM_API void Serum_ContextDisableColorization(Serum_Context* context);
+
+SERUM_API void Serum_ContextEnableColorization(Serum_Context* context);
+
 /** @brief Get the full version of this library
  *
  * @return A string formatted "major.minor.patch"
@@ -152,3 +268,31 @@ SERUM_API bool Serum_Scene_IsActive(void);
 /** @brief Reset scene generator to initial state
  */
 SERUM_API void Serum_Scene_Reset(void);
+
+/** @brief Same as the Serum_Scene_* functions above for the given context
+ */
+SERUM_API bool Serum_ContextScene_ParseCSV(Serum_Context* context,
+                                           const char* const csv_filename);
+
+SERUM_API bool Serum_ContextScene_GenerateDump(Serum_Context* context,
+                                               const char* const dump_filename,
+                                               int id);
+
+SERUM_API bool Serum_ContextScene_GetInfo(
+    Serum_Context* context, uint16_t sceneId, uint16_t* frameCount,
+    uint16_t* durationPerFrame, bool* interruptable, bool* startImmediately,
+    uint8_t* repeat, uint8_t* endFrame);
+
+SERUM_API bool Serum_ContextScene_GenerateFrame(Serum_Context* context,
+                                                uint16_t sceneId,
+                                                uint16_t frameIndex,
+                                                uint8_t* buffer, int group);
+
+SERUM_API void Serum_ContextScene_SetDepth(Serum_Context* context,
+                                           uint8_t depth);
+
+SERUM_API int Serum_ContextScene_GetDepth(Serum_Context* context);
+
+SERUM_API bool Serum_ContextScene_IsActive(Serum_Context* context);
+
+SERUM_API void Serum_ContextScene_Reset(Serum_Context* context);
@@ -26,6 +26,8 @@ enum {
   FLAG_REQUEST_FILL_MODIFIED_ELEMENTS =
       4,  // does the modifiedelementsXX structures must be allocated and
           // returned
+  FLAG_REQUEST_DIRTY_RECTS = 8,  // does the dirtyrectsXX structures must be
+                                 // allocated and returned (v2 only)
 };
 
 enum  // returned values in Serum_Frame_Sttruc::flags for v2+ format
@@ -48,6 +50,24 @@ enum  // returned flags that are added to the timings if there were rotations
   FLAG_RETURNED_V2_SCENE = 0x40000,
 };
 
+enum  // load phases reported to the Serum_LoadProgressCallback
+{
+  SERUM_LOAD_FIND = 0,    // looking for the Serum files
+  SERUM_LOAD_PARSE = 1,   // reading the Serum file
+  SERUM_LOAD_SAVE = 2,    // starting the cROMc file in the background
+  SERUM_LOAD_DONE = 3,    // the Serum file is loaded
+  SERUM_LOAD_FAILED = 4,  // the Serum file couldn't be loaded
+};
+
+typedef void(SERUM_CALLBACK* Serum_LoadProgressCallback)(uint8_t phase,
+                                                         uint8_t percent,
+                                                         const void* userData);
+
+typedef struct _Serum_Dirty_Rect {
+  uint16_t x, y;
+  uint16_t width, height;
+} Serum_Dirty_Rect;
+
 typedef struct _Serum_Frame_Struc {
   // data for v1 Serum format
   uint8_t* frame;      // return the colorized frame
@@ -94,6 +114,12 @@ typedef struct _Serum_Frame_Struc {
                        // the trigger if one is set for that frame
   uint32_t frameID;    // for CDMD ingame tester
   uint32_t rotationtimer;
+  // (optional) regions of frame32/frame64 modified by the last Serum_Colorize
+  // or Serum_Rotate, rectangles may overlap
+  uint32_t ndirtyrects32;
+  Serum_Dirty_Rect* dirtyrects32;  // [MAX_DIRTY_RECTS]
+  uint32_t ndirtyrects64;
+  Serum_Dirty_Rect* dirtyrects64;  // [MAX_DIRTY_RECTS]
 } Serum_Frame_Struc;
 
 const int MAX_DYNA_4COLS_PER_FRAME =
@@ -115,6 +141,9 @@ const int MAX_COLOR_ROTATION_V2 =
     4;  // maximum number of new color rotations per frame
 const int MAX_LENGTH_COLOR_ROTATION =
     64;  // maximum number of new colors in a rotation
+const int MAX_DIRTY_RECTS =
+    MAX_COLOR_ROTATION_V2;  // maximum number of dirty rectangles returned per
+                            // frame resolution
 const int MAX_SPRITE_DETECT_AREAS =
     4;  // maximum number of areas to detect the sprite
 
@@ -1,13 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cereal/access.hpp>
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/vector.hpp>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
 #include <unordered_map>
 #include <vector>
 
+#include "CRomReader.h"
+#include "FileUtils.h"
 #include "LZ4Stream.h"
+
+// Alignment of the frozen storage block and of its larger elements
+#define SPARSE_VECTOR_FLAT_ALIGNMENT 64
+// Number of decompressed elements cached per thread and element type
+#define SPARSE_VECTOR_DECOMPRESS_CACHE 32
+
 template <typename T>
 class SparseVector {
   static_assert(
@@ -19,12 +33,125 @@ class SparseVector {
   std::unordered_map<uint32_t, std::vector<uint8_t>>
       data;  // Changed to uint8_t for compressed data
   std::vector<T> noData;
-  uint64_t elementSize = 0;  // Size of each element in bytes
+  // Number of values of each element, of the largest one if the elements
+  // have different sizes
+  uint64_t elementSize = 0;
   std::vector<T> decompBuffer;
   bool useIndex;
   bool useCompression;
-  mutable uint32_t lastAccessedId = UINT32_MAX;
-  mutable std::vector<T> lastDecompressed;
+  // Identifies the current content of this vector in the decompression cache
+  uint64_t cacheKey = NewCacheKey();
+
+  // Frozen storage, see freeze(). All elements live in one block:
+  // [FlatHeader | offsets[count] | sizes[count] | padding | arena]
+  // Elements of at least 64 bytes start 64-byte aligned within the arena.
+  // The block is self-contained, so it can be stored in a file as is and used
+  // in place from there, see flatData() and adoptFlat().
+  struct FlatHeader {
+    uint64_t count;        // number of element IDs covered by the tables
+    uint64_t arenaOffset;  // start of the arena within the block
+    uint64_t arenaSize;
+    uint64_t blockSize;    // size of the whole block
+    uint64_t elementSize;
+    uint64_t noDataSize;   // number of values in noData
+    uint64_t noDataValue;  // the value noData is filled with
+    uint32_t typeSize;     // sizeof(T)
+    uint32_t flags;        // FLAT_USE_INDEX | FLAT_USE_COMPRESSION | ...
+  };
+  static constexpr uint64_t FLAT_NO_DATA = UINT64_MAX;
+  static constexpr uint32_t FLAT_USE_INDEX = 1;
+  static constexpr uint32_t FLAT_USE_COMPRESSION = 2;
+  // elements smaller than elementSize, the user knows their sizes
+  static constexpr uint32_t FLAT_VARIABLE_SIZE = 4;
+  struct FlatDeleter {
+    void operator()(uint8_t *p) const {
+      ::operator delete(p, std::align_val_t(SPARSE_VECTOR_FLAT_ALIGNMENT));
+    }
+  };
+  // Either owns the block or keeps the memory it was adopted from alive
+  std::shared_ptr<uint8_t> flatBlock;
+  uint32_t flatCount = 0;
+  const uint64_t *flatOffsets = nullptr;
+  const uint32_t *flatSizes = nullptr;
+  uint8_t *flatArena = nullptr;
+
+  static uint64_t NewCacheKey() {
+    static std::atomic<uint64_t> nextKey{1};
+    return nextKey.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  struct DecompressCacheEntry {
+    uint64_t key = 0;  // cacheKey of the vector, 0 if unused
+    uint32_t elementId = UINT32_MAX;
+    uint64_t lastUse = 0;
+    std::vector<T> buffer;
+  };
+
+  // The decompressed elements are kept in a small LRU cache of the calling
+  // thread, so a loaded vector can be shared and read by several threads at
+  // the same time. A returned pointer stays valid until the thread has
+  // decompressed SPARSE_VECTOR_DECOMPRESS_CACHE other elements of this type.
+  T *decompress(const uint32_t elementId, const uint8_t *compressed,
+                size_t compressedSize) {
+    thread_local DecompressCacheEntry cache[SPARSE_VECTOR_DECOMPRESS_CACHE];
+    thread_local uint64_t useCounter = 0;
+
+    DecompressCacheEntry *victim = &cache[0];
+    for (DecompressCacheEntry &entry : cache) {
+      if (entry.key == cacheKey && entry.elementId == elementId) {
+        entry.lastUse = ++useCounter;
+        return entry.buffer.data();
+      }
+      if (entry.lastUse < victim->lastUse) victim = &entry;
+    }
+
+    if (victim->buffer.size() < elementSize) {
+      victim->buffer.resize(elementSize);
+    }
+
+    int decompressedSize = LZ4_decompress_safe(
+        reinterpret_cast<const char *>(compressed),
+        reinterpret_cast<char *>(victim->buffer.data()),
+        static_cast<int>(compressedSize),
+        static_cast<int>(elementSize * sizeof(T)));
+
+    if (decompressedSize < 0) {
+      victim->key = 0;
+      return noData.data();
+    }
+
+    victim->key = cacheKey;
+    victim->elementId = elementId;
+    victim->lastUse = ++useCounter;
+    return victim->buffer.data();
+  }
+
+  void releaseFlat() {
+    flatBlock.reset();
+    flatCount = 0;
+    flatOffsets = nullptr;
+    flatSizes = nullptr;
+    flatArena = nullptr;
+  }
+
+  // Rebuilds the index or map representation from the frozen storage
+  void unflatten(std::vector<std::vector<T>> &outIndex,
+                 std::unordered_map<uint32_t, std::vector<uint8_t>> &outData)
+      const {
+    outIndex.clear();
+    outData.clear();
+    if (useIndex) outIndex.resize(flatCount);
+    for (uint32_t i = 0; i < flatCount; ++i) {
+      if (flatOffsets[i] == FLAT_NO_DATA) continue;
+      const uint8_t *element = flatArena + flatOffsets[i];
+      if (useIndex) {
+        outIndex[i].resize(flatSizes[i] / sizeof(T));
+        memcpy(outIndex[i].data(), element, flatSizes[i]);
+      } else {
+        outData[i].assign(element, element + flatSizes[i]);
+      }
+    }
+  }
 
  public:
   SparseVector(T noDataSignature, bool index, bool compress = false)
@@ -37,6 +164,15 @@ class SparseVector {
   }
 
   T *operator[](const uint32_t elementId) {
+    if (flatOffsets) {
+      if (elementId >= flatCount) return noData.data();
+      const uint64_t offset = flatOffsets[elementId];
+      if (offset == FLAT_NO_DATA) return noData.data();
+      if (useCompression)
+        return decompress(elementId, flatArena + offset, flatSizes[elementId]);
+      return reinterpret_cast<T *>(flatArena + offset);
+    }
+
     if (useIndex) {
       if (elementId >= index.size()) return noData.data();
       return index[elementId].data();
@@ -44,37 +180,21 @@ class SparseVector {
       auto it = data.find(elementId);
       if (it == data.end()) return noData.data();
 
-      if (useCompression) {
-        // Cache-Hit
-        if (elementId == lastAccessedId) {
-          return lastDecompressed.data();
-        }
-
-        const auto &compressed = it->second;
-
-        // ensure decompBuffer is large enough
-        if (lastDecompressed.size() < elementSize) {
-          lastDecompressed.resize(elementSize);
-        }
-
-        int decompressedSize = LZ4_decompress_safe(
-            reinterpret_cast<const char *>(compressed.data()),
-            reinterpret_cast<char *>(lastDecompressed.data()),
-            static_cast<int>(compressed.size()),
-            static_cast<int>(elementSize * sizeof(T)));
-
-        if (decompressedSize < 0) return noData.data();
-
-        // Cache-Update
-        lastAccessedId = elementId;
-        return lastDecompressed.data();
-      }
+      if (useCompression)
+        return decompress(elementId, it->second.data(), it->second.size());
 
       return reinterpret_cast<T *>(it->second.data());
     }
   }
 
   bool hasData(uint32_t elementId) const {
+    if (flatOffsets) {
+      if (elementId >= flatCount || flatOffsets[elementId] == FLAT_NO_DATA)
+        return false;
+      return !useIndex ||
+             *reinterpret_cast<const T *>(flatArena +
+                                          flatOffsets[elementId]) != noData[0];
+    }
     if (useIndex)
       return elementId < index.size() && !index[elementId].empty() &&
              index[elementId][0] != noData[0];
@@ -87,8 +207,12 @@ class SparseVector {
     if (useIndex) {
       throw std::runtime_error("set() must not be used for index");
     }
+    if (flatOffsets) {
+      throw std::runtime_error("set() must not be used after freeze()");
+    }
 
-    elementSize = size;
+    if (size > elementSize) elementSize = size;
+    cacheKey = NewCacheKey();
 
     if (decompBuffer.size() < (elementSize * sizeof(T))) {
       decompBuffer.resize(elementSize * sizeof(T));
@@ -99,23 +223,20 @@ class SparseVector {
     }
 
     if (parent == nullptr || parent->hasData(elementId)) {
-      if (memcmp(values, noData.data(), elementSize * sizeof(T)) != 0) {
+      if (memcmp(values, noData.data(), size * sizeof(T)) != 0) {
         if (useCompression) {
           const size_t maxCompressedSize =
-              LZ4_compressBound(static_cast<int>(elementSize * sizeof(T)));
+              LZ4_compressBound(static_cast<int>(size * sizeof(T)));
           std::vector<uint8_t> compBuffer(maxCompressedSize);
 
+          // Fast while parsing, the cROMc writer recompresses the elements
+          // with the maximum level, see writeCompressedFlat()
           int compressedSize =
               LZ4_compress_HC(reinterpret_cast<const char *>(values),
                               reinterpret_cast<char *>(compBuffer.data()),
-                              static_cast<int>(elementSize * sizeof(T)),
+                              static_cast<int>(size * sizeof(T)),
                               static_cast<int>(maxCompressedSize),
-#ifdef WRITE_CROMC
-                              LZ4HC_CLEVEL_MAX  // max compression level
-#else
-                              LZ4HC_CLEVEL_MIN  // min compression level
-#endif
-              );
+                              LZ4HC_CLEVEL_MIN);
 
           if (compressedSize > 0) {
             data[elementId].assign(compBuffer.begin(),
@@ -124,38 +245,36 @@ class SparseVector {
         } else {
           // Without compression, store directly.
           const uint8_t *byteValues = reinterpret_cast<const uint8_t *>(values);
-          data[elementId].assign(byteValues,
-                                 byteValues + elementSize * sizeof(T));
+          data[elementId].assign(byteValues, byteValues + size * sizeof(T));
         }
       }
     }
   }
 
+  // Returns false if the file is truncated, the reader is failed then
   template <typename U = T>
-  void readFromCRomFile(size_t elementSize, uint32_t numElements, FILE *stream,
-                        SparseVector<U> *parent = nullptr) {
+  bool readFromCRomFile(size_t elementSize, uint32_t numElements,
+                        CRomReader &stream, SparseVector<U> *parent = nullptr) {
+    // check before allocating anything for sizes read from a corrupt file
+    if (!stream.canRead((uint64_t)elementSize * sizeof(T) * numElements))
+      return false;
+
     if (useIndex) {
       index.resize(numElements);
       for (uint32_t i = 0; i < numElements; ++i) {
         index[i].resize(elementSize);
-        if (fread(index[i].data(), sizeof(T), elementSize, stream) !=
-            elementSize) {
-          fprintf(stderr, "File read error\n");
-          exit(1);
-        }
+        if (!stream.readArray(index[i].data(), elementSize)) return false;
       }
     } else {
       std::vector<T> tmp(elementSize);
 
       for (uint32_t i = 0; i < numElements; ++i) {
-        if (fread(tmp.data(), elementSize * sizeof(T), 1, stream) != 1) {
-          fprintf(stderr, "File read error\n");
-          exit(1);
-        }
+        if (!stream.readArray(tmp.data(), elementSize)) return false;
 
         set(i, tmp.data(), elementSize, parent);
       }
     }
+    return true;
   }
 
   void reserve(size_t elementSize) {
@@ -164,14 +283,283 @@ class SparseVector {
     }
   }
 
-  void clearIndex() { index.clear(); }
+  void clearIndex() {
+    index.clear();
+    if (useIndex) releaseFlat();
+  }
+
+  // Moves all elements into one contiguous, aligned block and releases the
+  // per-element allocations. Lookups then only need an offset table access.
+  // The vector must not be modified by set() or setParent() afterwards.
+  void freeze() {
+    if (flatOffsets) return;
+
+    uint32_t count = 0;
+    if (useIndex) {
+      count = (uint32_t)index.size();
+    } else {
+      for (const auto &entry : data)
+        if (entry.first >= count) count = entry.first + 1;
+    }
+
+    auto elementBytes = [&](uint32_t i) -> std::pair<const uint8_t *, size_t> {
+      if (useIndex) {
+        return {reinterpret_cast<const uint8_t *>(index[i].data()),
+                index[i].size() * sizeof(T)};
+      }
+      auto it = data.find(i);
+      if (it == data.end()) return {nullptr, 0};
+      return {it->second.data(), it->second.size()};
+    };
+    auto alignUp = [](uint64_t value, uint64_t alignment) {
+      return (value + alignment - 1) & ~(alignment - 1);
+    };
+    // larger elements start on a cache line, smaller ones are only aligned
+    // for T to not waste too much memory
+    auto elementAlignment = [](size_t size) -> uint64_t {
+      return size >= SPARSE_VECTOR_FLAT_ALIGNMENT
+                 ? SPARSE_VECTOR_FLAT_ALIGNMENT
+                 : (alignof(T) < 8 ? 8 : alignof(T));
+    };
+
+    const uint64_t arenaOffset =
+        alignUp(sizeof(FlatHeader) + count * (sizeof(uint64_t) +
+                                              sizeof(uint32_t)),
+                SPARSE_VECTOR_FLAT_ALIGNMENT);
+    uint64_t arenaSize = 0;
+    bool variableSize = false;
+    for (uint32_t i = 0; i < count; ++i) {
+      auto element = elementBytes(i);
+      if (element.second == 0) continue;
+      arenaSize = alignUp(arenaSize, elementAlignment(element.second)) +
+                  element.second;
+      if (!useIndex && !useCompression &&
+          element.second != elementSize * sizeof(T))
+        variableSize = true;
+    }
+    const uint64_t blockSize =
+        alignUp(arenaOffset + arenaSize, SPARSE_VECTOR_FLAT_ALIGNMENT);
+
+    uint8_t *block = static_cast<uint8_t *>(::operator new(
+        blockSize, std::align_val_t(SPARSE_VECTOR_FLAT_ALIGNMENT)));
+    memset(block, 0, blockSize);
+    flatBlock.reset(block, FlatDeleter());
+
+    FlatHeader *header = reinterpret_cast<FlatHeader *>(block);
+    header->count = count;
+    header->arenaOffset = arenaOffset;
+    header->arenaSize = arenaSize;
+    header->blockSize = blockSize;
+    header->elementSize = elementSize;
+    header->noDataSize = noData.size();
+    header->noDataValue = (uint64_t)noData[0];
+    header->typeSize = sizeof(T);
+    header->flags = (useIndex ? FLAT_USE_INDEX : 0) |
+                    (useCompression ? FLAT_USE_COMPRESSION : 0) |
+                    (variableSize ? FLAT_VARIABLE_SIZE : 0);
+    uint64_t *offsets =
+        reinterpret_cast<uint64_t *>(block + sizeof(FlatHeader));
+    uint32_t *sizes = reinterpret_cast<uint32_t *>(offsets + count);
+    uint8_t *arena = block + arenaOffset;
+
+    uint64_t position = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      auto element = elementBytes(i);
+      if (element.second == 0) {
+        offsets[i] = FLAT_NO_DATA;
+        sizes[i] = 0;
+        continue;
+      }
+      position = alignUp(position, elementAlignment(element.second));
+      memcpy(arena + position, element.first, element.second);
+      offsets[i] = position;
+      sizes[i] = (uint32_t)element.second;
+      position += element.second;
+    }
+
+    flatCount = count;
+    flatOffsets = offsets;
+    flatSizes = sizes;
+    flatArena = arena;
+
+    std::vector<std::vector<T>>().swap(index);
+    std::unordered_map<uint32_t, std::vector<uint8_t>>().swap(data);
+  }
+
+  bool isFrozen() const { return flatOffsets != nullptr; }
+  // true if the elements are stored LZ4 compressed
+  bool isCompressed() const { return useCompression; }
+
+  // Number of values which can be read at operator[](elementId). For
+  // compressed elements, the size of the decompression buffer.
+  size_t elementLength(uint32_t elementId) const {
+    size_t bytes;
+    if (flatOffsets) {
+      if (elementId >= flatCount || flatOffsets[elementId] == FLAT_NO_DATA)
+        return noData.size();
+      bytes = flatSizes[elementId];
+    } else if (useIndex) {
+      return elementId < index.size() ? index[elementId].size()
+                                      : noData.size();
+    } else {
+      auto it = data.find(elementId);
+      if (it == data.end()) return noData.size();
+      bytes = it->second.size();
+    }
+    if (useCompression)
+      return (size_t)std::min<uint64_t>(elementSize, noData.size());
+    return bytes / sizeof(T);
+  }
+
+  // An empty vector with the same settings, to rebuild this one
+  SparseVector<T> emptyCopy() const {
+    return SparseVector<T>(noData[0], useIndex, useCompression);
+  }
+
+  // The frozen block, to store it in a file. NULL if the vector isn't frozen.
+  const uint8_t *flatData(size_t &size) const {
+    if (!flatOffsets) {
+      size = 0;
+      return nullptr;
+    }
+    size = (size_t)reinterpret_cast<const FlatHeader *>(flatBlock.get())
+               ->blockSize;
+    return flatBlock.get();
+  }
+
+  // Writes a block like flatData() to the current position of fp, but with
+  // every element LZ4 compressed on its own, so a vector using this block only
+  // decompresses the elements which are accessed. The elements of a compressed
+  // vector are recompressed with the given level. The elements are written as
+  // soon as they are compressed, the tables in front of them once all are
+  // written, so only one element is kept in memory. Leaves fp at the end of
+  // the block. Elements of different sizes are kept as they are. Returns false
+  // if the vector isn't frozen, is an index or if writing failed.
+  // Only reads the frozen block, so it can run while other threads use the
+  // vector.
+  bool writeCompressedFlat(FILE *fp, int compressionLevel,
+                           uint64_t &blockSize) const {
+    if (!flatOffsets || useIndex || elementSize == 0) return false;
+    const FlatHeader *header =
+        reinterpret_cast<const FlatHeader *>(flatBlock.get());
+    const int maxRawSize = (int)(elementSize * sizeof(T));
+    const int64_t start = FileTell(fp);
+    if (start < 0 ||
+        FileSeek(fp, (uint64_t)start + header->arenaOffset, SEEK_SET) != 0)
+      return false;
+
+    static const uint8_t padding[SPARSE_VECTOR_FLAT_ALIGNMENT] = {0};
+    std::vector<uint64_t> offsets(flatCount, FLAT_NO_DATA);
+    std::vector<uint32_t> sizes(flatCount, 0);
+    std::vector<char> buffer(LZ4_compressBound(maxRawSize));
+    std::vector<char> raw(useCompression ? maxRawSize : 0);
+    uint64_t position = 0;
+    for (uint32_t i = 0; i < flatCount; ++i) {
+      if (flatOffsets[i] == FLAT_NO_DATA) continue;
+      const char *element =
+          reinterpret_cast<const char *>(flatArena + flatOffsets[i]);
+      int rawSize = (int)flatSizes[i];
+      if (useCompression) {
+        rawSize = LZ4_decompress_safe(element, raw.data(), (int)flatSizes[i],
+                                      maxRawSize);
+        if (rawSize <= 0) return false;
+        element = raw.data();
+      } else if (flatSizes[i] > (uint32_t)maxRawSize) {
+        return false;
+      }
+      int compressedSize = LZ4_compress_HC(element, buffer.data(), rawSize,
+                                           (int)buffer.size(),
+                                           compressionLevel);
+      if (compressedSize <= 0) return false;
+      const uint64_t aligned = (position + 7) & ~(uint64_t)7;
+      if (fwrite(padding, 1, aligned - position, fp) != aligned - position ||
+          fwrite(buffer.data(), 1, compressedSize, fp) !=
+              (size_t)compressedSize)
+        return false;
+      offsets[i] = aligned;
+      sizes[i] = (uint32_t)compressedSize;
+      position = aligned + compressedSize;
+    }
+
+    FlatHeader newHeader = *header;
+    newHeader.arenaSize = position;
+    newHeader.blockSize =
+        (header->arenaOffset + position + SPARSE_VECTOR_FLAT_ALIGNMENT - 1) &
+        ~(uint64_t)(SPARSE_VECTOR_FLAT_ALIGNMENT - 1);
+    newHeader.flags |= FLAT_USE_COMPRESSION;
+    const uint64_t tablesEnd =
+        sizeof(FlatHeader) + flatCount * (sizeof(uint64_t) + sizeof(uint32_t));
+    const uint64_t blockEnd = header->arenaOffset + position;
+    if (fwrite(padding, 1, newHeader.blockSize - blockEnd, fp) !=
+            newHeader.blockSize - blockEnd ||
+        FileSeek(fp, (uint64_t)start, SEEK_SET) != 0 ||
+        fwrite(&newHeader, sizeof(FlatHeader), 1, fp) != 1 ||
+        fwrite(offsets.data(), sizeof(uint64_t), flatCount, fp) != flatCount ||
+        fwrite(sizes.data(), sizeof(uint32_t), flatCount, fp) != flatCount ||
+        fwrite(padding, 1, header->arenaOffset - tablesEnd, fp) !=
+            header->arenaOffset - tablesEnd ||
+        FileSeek(fp, (uint64_t)start + newHeader.blockSize, SEEK_SET) != 0)
+      return false;
+    blockSize = newHeader.blockSize;
+    return true;
+  }
+
+  // Uses a block returned by flatData() in place, e.g. from a memory mapped
+  // file. owner keeps the memory alive as long as the vector uses it. The
+  // vector is frozen afterwards. Returns false if the block is invalid.
+  bool adoptFlat(uint8_t *block, size_t size, std::shared_ptr<void> owner) {
+    if (size < sizeof(FlatHeader) || ((uintptr_t)block & 7)) return false;
+    const FlatHeader *header = reinterpret_cast<const FlatHeader *>(block);
+    if (header->typeSize != sizeof(T) || header->blockSize > size ||
+        header->count > UINT32_MAX || header->noDataSize == 0 ||
+        header->noDataSize > UINT32_MAX || header->elementSize > UINT32_MAX)
+      return false;
+    const uint64_t tablesEnd =
+        sizeof(FlatHeader) +
+        header->count * (sizeof(uint64_t) + sizeof(uint32_t));
+    if (header->arenaOffset < tablesEnd ||
+        header->arenaOffset > header->blockSize ||
+        header->arenaSize > header->blockSize - header->arenaOffset)
+      return false;
+
+    const bool compressed = (header->flags & FLAT_USE_COMPRESSION) != 0;
+    const uint64_t *offsets =
+        reinterpret_cast<const uint64_t *>(block + sizeof(FlatHeader));
+    const uint32_t *sizes =
+        reinterpret_cast<const uint32_t *>(offsets + header->count);
+    for (uint64_t i = 0; i < header->count; ++i) {
+      if (offsets[i] == FLAT_NO_DATA) continue;
+      if (offsets[i] > header->arenaSize ||
+          sizes[i] > header->arenaSize - offsets[i] ||
+          (!compressed && !(header->flags & FLAT_VARIABLE_SIZE) &&
+           sizes[i] < header->elementSize * sizeof(T)))
+        return false;
+    }
+
+    releaseFlat();
+    std::vector<std::vector<T>>().swap(index);
+    std::unordered_map<uint32_t, std::vector<uint8_t>>().swap(data);
+    useIndex = (header->flags & FLAT_USE_INDEX) != 0;
+    useCompression = compressed;
+    elementSize = header->elementSize;
+    noData.assign(header->noDataSize, (T)header->noDataValue);
+    cacheKey = NewCacheKey();
+
+    flatBlock = std::shared_ptr<uint8_t>(std::move(owner), block);
+    flatCount = (uint32_t)header->count;
+    flatOffsets = offsets;
+    flatSizes = sizes;
+    flatArena = block + header->arenaOffset;
+    return true;
+  }
 
   void clear() {
+    releaseFlat();
     index.clear();
     data.clear();
     noData.resize(1);
-    lastAccessedId = UINT32_MAX;
-    lastDecompressed.clear();
+    elementSize = 0;
+    cacheKey = NewCacheKey();
   }
 
   template <typename U = T>
@@ -194,21 +582,33 @@ class SparseVector {
     data = std::move(filteredData);
 
     // Clear cache
-    lastAccessedId = UINT32_MAX;
-    lastDecompressed.clear();
+    cacheKey = NewCacheKey();
   }
 
   friend class cereal::access;
 
   template <class Archive>
   void serialize(Archive &ar) {
+    if constexpr (Archive::is_saving::value) {
+      if (flatOffsets) {
+        // keep the file format independent from the in-memory storage
+        std::vector<std::vector<T>> flatIndex;
+        std::unordered_map<uint32_t, std::vector<uint8_t>> flatData;
+        unflatten(flatIndex, flatData);
+        ar(flatIndex, flatData, noData, elementSize, decompBuffer, useIndex,
+           useCompression);
+        return;
+      }
+    } else {
+      releaseFlat();
+    }
+
     ar(index, data, noData, elementSize, decompBuffer, useIndex,
        useCompression);
 
     if constexpr (Archive::is_loading::value) {
       // Clear cache
-      lastAccessedId = UINT32_MAX;
-      lastDecompressed.clear();
+      cacheKey = NewCacheKey();
     }
   }
 };
@@ -0,0 +1,263 @@
+#include "sprite-scan.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#define SPRITE_SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SPRITE_SCAN_TARGET_SSE2
+#define SPRITE_SCAN_TARGET_AVX2
+#else
+#define SPRITE_SCAN_TARGET_SSE2 __attribute__((target("sse2")))
+#define SPRITE_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SPRITE_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+typedef uint64_t (*FindDwordsKernel)(const uint8_t* row, size_t count,
+                                     const uint32_t* patterns,
+                                     size_t npatterns);
+typedef bool (*RowMatchesKernel)(const uint8_t* sprite, const uint8_t* frame,
+                                 size_t n);
+
+static inline uint32_t Load32LE(const uint8_t* s) {
+  return (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) |
+         ((uint32_t)s[3] << 24);
+}
+
+static uint64_t FindDwordsScalar(const uint8_t* row, size_t count,
+                                 const uint32_t* patterns, size_t npatterns) {
+  uint64_t found = 0;
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t dword = Load32LE(row + i);
+    for (size_t k = 0; k < npatterns; k++) {
+      if (dword == patterns[k]) {
+        found |= (uint64_t)1 << i;
+        break;
+      }
+    }
+  }
+  return found;
+}
+
+static bool RowMatchesScalar(const uint8_t* sprite, const uint8_t* frame,
+                             size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (sprite[i] != 255 && sprite[i] != frame[i]) return false;
+  }
+  return true;
+}
+
+#ifdef SPRITE_SCAN_X86
+
+// The windows at row + i .. row + i + 15 are compared at once: the bytes of
+// the 4 shifted loads are compared to the bytes of each pattern.
+SPRITE_SCAN_TARGET_SSE2 static uint64_t FindDwordsSse2(
+    const uint8_t* row, size_t count, const uint32_t* patterns,
+    size_t npatterns) {
+  uint64_t found = 0;
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i b0 = _mm_loadu_si128((const __m128i*)(row + i));
+    const __m128i b1 = _mm_loadu_si128((const __m128i*)(row + i + 1));
+    const __m128i b2 = _mm_loadu_si128((const __m128i*)(row + i + 2));
+    const __m128i b3 = _mm_loadu_si128((const __m128i*)(row + i + 3));
+    __m128i any = _mm_setzero_si128();
+    for (size_t k = 0; k < npatterns; k++) {
+      const uint32_t p = patterns[k];
+      const __m128i m01 =
+          _mm_and_si128(_mm_cmpeq_epi8(b0, _mm_set1_epi8((char)p)),
+                        _mm_cmpeq_epi8(b1, _mm_set1_epi8((char)(p >> 8))));
+      const __m128i m23 =
+          _mm_and_si128(_mm_cmpeq_epi8(b2, _mm_set1_epi8((char)(p >> 16))),
+                        _mm_cmpeq_epi8(b3, _mm_set1_epi8((char)(p >> 24))));
+      any = _mm_or_si128(any, _mm_and_si128(m01, m23));
+    }
+    found |= (uint64_t)(uint32_t)_mm_movemask_epi8(any) << i;
+  }
+  if (i < count)
+    found |= FindDwordsScalar(row + i, count - i, patterns, npatterns) << i;
+  return found;
+}
+
+SPRITE_SCAN_TARGET_SSE2 static bool RowMatchesSse2(const uint8_t* sprite,
+                                                   const uint8_t* frame,
+                                                   size_t n) {
+  const __m128i transparent = _mm_set1_epi8((char)255);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)(sprite + i));
+    const __m128i f = _mm_loadu_si128((const __m128i*)(frame + i));
+    const __m128i ok =
+        _mm_or_si128(_mm_cmpeq_epi8(s, f), _mm_cmpeq_epi8(s, transparent));
+    if (_mm_movemask_epi8(ok) != 0xffff) return false;
+  }
+  return RowMatchesScalar(sprite + i, frame + i, n - i);
+}
+
+SPRITE_SCAN_TARGET_AVX2 static uint64_t FindDwordsAvx2(
+    const uint8_t* row, size_t count, const uint32_t* patterns,
+    size_t npatterns) {
+  uint64_t found = 0;
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const __m256i b0 = _mm256_loadu_si256((const __m256i*)(row + i));
+    const __m256i b1 = _mm256_loadu_si256((const __m256i*)(row + i + 1));
+    const __m256i b2 = _mm256_loadu_si256((const __m256i*)(row + i + 2));
+    const __m256i b3 = _mm256_loadu_si256((const __m256i*)(row + i + 3));
+    __m256i any = _mm256_setzero_si256();
+    for (size_t k = 0; k < npatterns; k++) {
+      const uint32_t p = patterns[k];
+      const __m256i m01 = _mm256_and_si256(
+          _mm256_cmpeq_epi8(b0, _mm256_set1_epi8((char)p)),
+          _mm256_cmpeq_epi8(b1, _mm256_set1_epi8((char)(p >> 8))));
+      const __m256i m23 = _mm256_and_si256(
+          _mm256_cmpeq_epi8(b2, _mm256_set1_epi8((char)(p >> 16))),
+          _mm256_cmpeq_epi8(b3, _mm256_set1_epi8((char)(p >> 24))));
+      any = _mm256_or_si256(any, _mm256_and_si256(m01, m23));
+    }
+    found |= (uint64_t)(uint32_t)_mm256_movemask_epi8(any) << i;
+  }
+  if (i < count)
+    found |= FindDwordsSse2(row + i, count - i, patterns, npatterns) << i;
+  return found;
+}
+
+SPRITE_SCAN_TARGET_AVX2 static bool RowMatchesAvx2(const uint8_t* sprite,
+                                                   const uint8_t* frame,
+                                                   size_t n) {
+  const __m256i transparent = _mm256_set1_epi8((char)255);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i s = _mm256_loadu_si256((const __m256i*)(sprite + i));
+    const __m256i f = _mm256_loadu_si256((const __m256i*)(frame + i));
+    const __m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(s, f),
+                                       _mm256_cmpeq_epi8(s, transparent));
+    if ((uint32_t)_mm256_movemask_epi8(ok) != 0xffffffff) return false;
+  }
+  return RowMatchesSse2(sprite + i, frame + i, n - i);
+}
+
+static bool SpriteScanHasSse2() {
+#if defined(__x86_64__) || defined(_M_X64)
+  return true;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool SpriteScanHasAvx2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  // the OS has to save the AVX registers
+  if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28))) return false;
+  if ((_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // SPRITE_SCAN_X86
+
+#ifdef SPRITE_SCAN_NEON
+
+static inline uint32_t MoveMaskNeon(uint8x16_t m) {
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t bits = vandq_u8(m, vld1q_u8(weights));
+  return (uint32_t)vaddv_u8(vget_low_u8(bits)) |
+         ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+}
+
+static uint64_t FindDwordsNeon(const uint8_t* row, size_t count,
+                               const uint32_t* patterns, size_t npatterns) {
+  uint64_t found = 0;
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const uint8x16_t b0 = vld1q_u8(row + i);
+    const uint8x16_t b1 = vld1q_u8(row + i + 1);
+    const uint8x16_t b2 = vld1q_u8(row + i + 2);
+    const uint8x16_t b3 = vld1q_u8(row + i + 3);
+    uint8x16_t any = vdupq_n_u8(0);
+    for (size_t k = 0; k < npatterns; k++) {
+      const uint32_t p = patterns[k];
+      const uint8x16_t m01 =
+          vandq_u8(vceqq_u8(b0, vdupq_n_u8((uint8_t)p)),
+                   vceqq_u8(b1, vdupq_n_u8((uint8_t)(p >> 8))));
+      const uint8x16_t m23 =
+          vandq_u8(vceqq_u8(b2, vdupq_n_u8((uint8_t)(p >> 16))),
+                   vceqq_u8(b3, vdupq_n_u8((uint8_t)(p >> 24))));
+      any = vorrq_u8(any, vandq_u8(m01, m23));
+    }
+    found |= (uint64_t)MoveMaskNeon(any) << i;
+  }
+  if (i < count)
+    found |= FindDwordsScalar(row + i, count - i, patterns, npatterns) << i;
+  return found;
+}
+
+static bool RowMatchesNeon(const uint8_t* sprite, const uint8_t* frame,
+                           size_t n) {
+  const uint8x16_t transparent = vdupq_n_u8(255);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const uint8x16_t s = vld1q_u8(sprite + i);
+    const uint8x16_t f = vld1q_u8(frame + i);
+    const uint8x16_t ok = vorrq_u8(vceqq_u8(s, f), vceqq_u8(s, transparent));
+    if (vminvq_u8(ok) != 255) return false;
+  }
+  return RowMatchesScalar(sprite + i, frame + i, n - i);
+}
+
+#endif  // SPRITE_SCAN_NEON
+
+struct SpriteScanEngine {
+  FindDwordsKernel findDwords;
+  RowMatchesKernel rowMatches;
+  const char* name;
+};
+
+static SpriteScanEngine SelectSpriteScanEngine() {
+#ifdef SPRITE_SCAN_X86
+  if (SpriteScanHasSse2()) {
+    if (SpriteScanHasAvx2()) return {FindDwordsAvx2, RowMatchesAvx2, "avx2"};
+    return {FindDwordsSse2, RowMatchesSse2, "sse2"};
+  }
+#endif
+#ifdef SPRITE_SCAN_NEON
+  // NEON is part of ARMv8
+  return {FindDwordsNeon, RowMatchesNeon, "neon"};
+#endif
+  return {FindDwordsScalar, RowMatchesScalar, "scalar"};
+}
+
+static const SpriteScanEngine& GetSpriteScanEngine() {
+  static const SpriteScanEngine engine = SelectSpriteScanEngine();
+  return engine;
+}
+
+uint64_t sprite_find_dwords(const uint8_t* row, size_t count,
+                            const uint32_t* patterns, size_t npatterns) {
+  return GetSpriteScanEngine().findDwords(row, count, patterns, npatterns);
+}
+
+bool sprite_row_matches(const uint8_t* sprite, const uint8_t* frame,
+                        size_t n) {
+  return GetSpriteScanEngine().rowMatches(sprite, frame, n);
+}
+
+const char* sprite_scan_kernel_name() { return GetSpriteScanEngine().name; }
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels for the sprite detection. The fastest implementation available on
+// the running CPU (AVX2 or SSE2 on x86, NEON on ARMv8, plain C++ otherwise)
+// is selected on first use.
+
+// Maximum number of patterns for sprite_find_dwords(), with more patterns a
+// lookup per position is faster
+#define SPRITE_SCAN_MAX_PATTERNS 16
+
+// Sets bit i of the result if the 4 bytes at row + i, read as a little-endian
+// dword, are one of the patterns. count is at most 64 and the row must have
+// count + 3 readable bytes.
+uint64_t sprite_find_dwords(const uint8_t* row, size_t count,
+                            const uint32_t* patterns, size_t npatterns);
+
+// Returns true if each of the n bytes of the sprite row is either 255 (not
+// part of the sprite) or the same as the byte of the frame row.
+bool sprite_row_matches(const uint8_t* sprite, const uint8_t* frame,
+                        size_t n);
+
+// Name of the selected kernels, for logging
+const char* sprite_scan_kernel_name();
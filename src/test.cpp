@@ -1,38 +1,61 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 
 #include "serum-decode.h"
 
-int main(int argc, const char* argv[]) {
-  int width;
-  int height;
+// Loads a Serum file a few times and reports the load times. The library logs
+// the decode speed of the cROMc sections per codec.
 
-  /*unsigned int numColors;
-  unsigned int numTriggers;
+static void SERUM_CALLBACK LogCallback(const char* format, va_list args,
+                                       const void* /*userData*/) {
+  vprintf(format, args);
+  printf("\n");
+}
 
+int main(int argc, const char* argv[]) {
   if (argc < 3) {
-    std::cout << "Usage: " << argv[0] << " [path] [rom]" << std::endl;
+    std::cout << "Usage: " << argv[0] << " [path] [rom] [runs]" << std::endl;
 
     return 1;
   }
 
   const char* path = argv[1];
   const char* rom = argv[2];
-
-  if (!Serum_Load(path, rom, &width, &height, &numColors, &numTriggers)) {
-    std::cout << "Failed to load Serum: path=" << path << ", rom=" << rom
+  const int runs = argc > 3 ? atoi(argv[3]) : 5;
+
+  Serum_SetLogCallback(LogCallback, nullptr);
+
+  double total = 0.0;
+  for (int run = 0; run < runs; run++) {
+    const auto start = std::chrono::steady_clock::now();
+    Serum_Frame_Struc* serum = Serum_Load(
+        path, rom, FLAG_REQUEST_32P_FRAMES | FLAG_REQUEST_64P_FRAMES);
+    const double milliseconds =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+    if (!serum) {
+      std::cout << "Failed to load Serum: path=" << path << ", rom=" << rom
+                << std::endl;
+
+      Serum_Dispose();
+
+      return 1;
+    }
+
+    // the first run might have to convert the file to cROMc
+    std::cout << "Run " << run + 1 << ": " << milliseconds << " ms"
               << std::endl;
+    if (run > 0 || runs == 1) total += milliseconds;
 
     Serum_Dispose();
-
-    return 1;
   }
 
   std::cout << "Serum successfully loaded: path=" << path << ", rom=" << rom
-            << ", width=" << width << ", height=" << height
-            << ", numColors=" << numColors << ", numTriggers=" << numTriggers
-            << std::endl;
-
-  Serum_Dispose();*/
+            << ", average load time="
+            << total / (runs > 1 ? runs - 1 : 1) << " ms" << std::endl;
 
   return 0;
-}
\ No newline at end of file
+}